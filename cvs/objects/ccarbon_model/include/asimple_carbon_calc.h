@@ -117,17 +117,20 @@ protected:
     DEFINE_DATA_WITH_PARENT(
         ICarbonCalc,
         
-        //! Above ground total emissions by year
+        //! Above ground total emissions by year, only stored from the first year
+        //! with non-zero emissions, see getEmissions
         DEFINE_VARIABLE( ARRAY | NOT_PARSABLE, "above-ground-land-use-change-emissions", mTotalEmissionsAbove, objects::YearVector<double> ),
         
-        //! Below ground total emissions by year
+        //! Below ground total emissions by year, only stored from the first year
+        //! with non-zero emissions, see getEmissions
         DEFINE_VARIABLE( ARRAY | NOT_PARSABLE, "below-ground-land-use-change-emissions", mTotalEmissionsBelow, objects::YearVector<double> ),
         
         //! Above ground carbon stock
         DEFINE_VARIABLE( ARRAY | STATE | NOT_PARSABLE, "above-ground-carbon-stock", mCarbonStock, objects::YearVector<Value> ),
         
         //! Track gross positive above ground emissions explicitly so we can partition the net emissions to gross
-        //! to report to the climate model
+        //! to report to the climate model, only stored from the first year with non-zero
+        //! emissions, see getEmissions
         DEFINE_VARIABLE( ARRAY | NOT_PARSABLE, "gross-positive-above-ground-land-use-change-emissions", mPositiveEmissionsAbove, objects::YearVector<double> ),
         
         //! Time scale for soil carbon emissions
@@ -216,6 +219,28 @@ protected:
                                         const int aYear,
                                         const int aEndYear,
                                         objects::YearVector<double>& aEmissVector);
+    
+    /*!
+     * \brief Get the emissions in a year from an emissions vector.
+     * \details Emissions vectors which are kept for the life of this object only
+     *          store years from the first year with non-zero emissions to the end
+     *          of the carbon model, years before then are zero.  This avoids storing
+     *          a long run of zeros from the start of the carbon model for land which
+     *          did not change until late in the historical period or the model
+     *          periods, or at all.
+     * \param aEmissVector The emissions vector.
+     * \param aYear The year to get.
+     * \return The emissions in aYear.
+     */
+    static double getEmissions( const objects::YearVector<double>& aEmissVector, const int aYear ) {
+        return aYear >= static_cast<int>( aEmissVector.getStartYear() ) ? aEmissVector[ aYear ] : 0.0;
+    }
+    
+    static void extendEmissions( objects::YearVector<double>& aEmissVector, const int aYear );
+    
+    static void addEmissions( objects::YearVector<double>& aTotalVector,
+                              const objects::YearVector<double>& aCurrVector,
+                              const double aSign );
 private:
     void calcSigmoidCurve( const double aCarbonDiff,
                            const int aYear,
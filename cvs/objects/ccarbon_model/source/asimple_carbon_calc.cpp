@@ -54,10 +54,11 @@ using namespace objects;
 
 extern Scenario* scenario;
 
+// Note the emissions vectors start out empty and are extended as emissions occur.
 ASimpleCarbonCalc::ASimpleCarbonCalc():
-mTotalEmissionsAbove( CarbonModelUtils::getStartYear(), CarbonModelUtils::getEndYear() ),
-mTotalEmissionsBelow( CarbonModelUtils::getStartYear(), CarbonModelUtils::getEndYear() ),
-mPositiveEmissionsAbove( CarbonModelUtils::getStartYear(), CarbonModelUtils::getEndYear() ),
+mTotalEmissionsAbove( CarbonModelUtils::getEndYear() + 1, CarbonModelUtils::getEndYear() ),
+mTotalEmissionsBelow( CarbonModelUtils::getEndYear() + 1, CarbonModelUtils::getEndYear() ),
+mPositiveEmissionsAbove( CarbonModelUtils::getEndYear() + 1, CarbonModelUtils::getEndYear() ),
 mCarbonStock( scenario->getModeltime()->getStartYear(), CarbonModelUtils::getEndYear() )
 {
     int endYear = CarbonModelUtils::getEndYear();
@@ -110,7 +111,7 @@ double ASimpleCarbonCalc::calc( const int aPeriod, const int aEndYear, const Car
                 calcAboveGroundCarbonEmission( aCalcMode, currCarbonStock, prevLand, currLand, aboveGroundCarbonDensity, year, aEndYear, mTotalEmissionsAbove );
                 calcBelowGroundCarbonEmission( landDifference * belowGroundCarbonDensity, year, aEndYear, mTotalEmissionsBelow );
                 prevLand = currLand;
-                currCarbonStock -= mTotalEmissionsAbove[ year ];
+                currCarbonStock -= getEmissions( mTotalEmissionsAbove, year );
             }
             mHasCalculatedHistoricEmiss = true;
             mCarbonStock[ modeltime->getStartYear() ] = currCarbonStock;
@@ -147,35 +148,32 @@ double ASimpleCarbonCalc::calc( const int aPeriod, const int aEndYear, const Car
             calcBelowGroundCarbonEmission( prevCarbonBelow - currCarbonBelow, year, aEndYear, currEmissionsBelow );
 
             if( aCalcMode != eReverseCalc ) {
-                mCarbonStock[ year ] = mCarbonStock[ year - 1 ] - ( mTotalEmissionsAbove[ year ] + currEmissionsAbove[ year ] );
+                mCarbonStock[ year ] = mCarbonStock[ year - 1 ] - ( getEmissions( mTotalEmissionsAbove, year ) + currEmissionsAbove[ year ] );
             }
             prevCarbonBelow = currCarbonBelow;
         }
         
         if( aCalcMode == eStoreResults ) {
             // add current emissions to the total
-            for( year = prevModelYear + 1; year <= aEndYear; ++year ) {
-                mTotalEmissionsAbove[ year ] += currEmissionsAbove[ year ];
-                mTotalEmissionsBelow[ year ] += currEmissionsBelow[ year ];
-            }
+            addEmissions( mTotalEmissionsAbove, currEmissionsAbove, 1.0 );
+            addEmissions( mTotalEmissionsBelow, currEmissionsBelow, 1.0 );
             mSavedCarbonStock[ aPeriod - 1 ] = mCarbonStock[ prevModelYear ];
             mSavedLandAllocation[ aPeriod - 1 ] = mLandLeaf->getLandAllocation( mLandLeaf->getName(), aPeriod - 1 );
         }
         else if( aCalcMode == eReverseCalc ) {
             // back out the current emissions from the total
-            for( year = prevModelYear + 1; year <= aEndYear; ++year ) {
-                mTotalEmissionsAbove[ year ] -= currEmissionsAbove[ year ];
-                mTotalEmissionsBelow[ year ] -= currEmissionsBelow[ year ];
-            }
+            addEmissions( mTotalEmissionsAbove, currEmissionsAbove, -1.0 );
+            addEmissions( mTotalEmissionsBelow, currEmissionsBelow, -1.0 );
         }
         else if( aCalcMode == eReturnTotal ) {
             // Since the flag to avoid storing the full emissions is set we will just calculate
             // and return the appropriate total emissions.
-            return mTotalEmissionsAbove[ aEndYear ] + mTotalEmissionsBelow[ aEndYear ] + currEmissionsAbove[ aEndYear ] + currEmissionsBelow[ aEndYear ];
+            return getEmissions( mTotalEmissionsAbove, aEndYear ) + getEmissions( mTotalEmissionsBelow, aEndYear )
+                + currEmissionsAbove[ aEndYear ] + currEmissionsBelow[ aEndYear ];
         }
     }
     
-    return mTotalEmissionsAbove[ aEndYear ] + mTotalEmissionsBelow[ aEndYear ];
+    return getEmissions( mTotalEmissionsAbove, aEndYear ) + getEmissions( mTotalEmissionsBelow, aEndYear );
 }
 
 /*!
@@ -218,11 +216,13 @@ void ASimpleCarbonCalc::calcAboveGroundCarbonEmission( const CarbonCalcMode aCal
         // If this land category didn't exist before, and now it does,
         // then the calculation below will generate a NaN.  Avoid that
         // by taking the appropriate limit here.
+        extendEmissions( aEmissVector, aYear );
         aEmissVector[ aYear ] += carbonDiff;
         if(aCalcMode == eStoreResults && carbonDiff > 0.0) {
+            extendEmissions( mPositiveEmissionsAbove, aYear );
             mPositiveEmissionsAbove[ aYear ] += carbonDiff;
         }
-        else if(aCalcMode == eReverseCalc) {
+        else if(aCalcMode == eReverseCalc && getEmissions( mPositiveEmissionsAbove, aYear ) != 0.0) {
             mPositiveEmissionsAbove[ aYear ] = 0.0;
         }
     }
@@ -236,11 +236,13 @@ void ASimpleCarbonCalc::calcAboveGroundCarbonEmission( const CarbonCalcMode aCal
         // don't have a separate branch for it).  (It's not obvious,
         // but you can show that the formula below just reduces to the
         // expression for carbonDiff at the top of the function.)
+        extendEmissions( aEmissVector, aYear );
         aEmissVector[ aYear ] += ( aPrevCarbonStock / aPrevLandArea ) * ( aPrevLandArea - aCurrLandArea );
         if(aCalcMode == eStoreResults) {
+            extendEmissions( mPositiveEmissionsAbove, aYear );
             mPositiveEmissionsAbove[ aYear ] += ( aPrevCarbonStock / aPrevLandArea ) * ( aPrevLandArea - aCurrLandArea );
         }
-        else if(aCalcMode == eReverseCalc) {
+        else if(aCalcMode == eReverseCalc && getEmissions( mPositiveEmissionsAbove, aYear ) != 0.0) {
             mPositiveEmissionsAbove[ aYear ] = 0.0;
         }
         if( getMatureAge() > 1 ) {
@@ -285,6 +287,7 @@ void ASimpleCarbonCalc::calcBelowGroundCarbonEmission( const double aCarbonDiff,
     // have occured, at twice the half-life 75% would have occurred, etc.
     // Note also that the aCarbonDiff is passed here as previous carbon minus current carbon
     // so a positive difference means that emissions will occur and a negative means uptake.
+    extendEmissions( aEmissVector, aYear );
     for( int currYear = aYear; currYear <= aEndYear; ++currYear ) {
         aEmissVector[ currYear ] += precalc_expsoil_diff.get()[currYear - aYear] * aCarbonDiff;
     }
@@ -309,6 +312,7 @@ void ASimpleCarbonCalc::calcSigmoidCurve( const double aCarbonDiff,
      */
     assert( getMatureAge() > 1 );
     
+    extendEmissions( aEmissVector, aYear );
     for( int currYear = aYear; currYear <= aEndYear; ++currYear ){
         // To avoid expensive calculations the difference in the sigmoid curve
         // has already been precomputed.
@@ -316,16 +320,66 @@ void ASimpleCarbonCalc::calcSigmoidCurve( const double aCarbonDiff,
     }
 }
 
+/*!
+ * \brief Make sure an emissions vector stores the given year.
+ * \details If the vector starts after aYear it is reallocated to start at aYear
+ *          with the years in between set to zero.
+ * \param aEmissVector The emissions vector.
+ * \param aYear The year which is about to be set.
+ * \sa getEmissions
+ */
+void ASimpleCarbonCalc::extendEmissions( YearVector<double>& aEmissVector, const int aYear ) {
+    const int startYear = aEmissVector.getStartYear();
+    if( aYear >= startYear ) {
+        return;
+    }
+    
+    const int endYear = aEmissVector.getEndYear();
+    YearVector<double> extended( aYear, endYear, 0.0 );
+    for( int year = startYear; year <= endYear; ++year ) {
+        extended[ year ] = aEmissVector[ year ];
+    }
+    aEmissVector = extended;
+}
+
+/*!
+ * \brief Add or subtract the emissions calculated in a period to a total emissions
+ *        vector.
+ * \details The total is only extended back to the first year in which the
+ *          current emissions are non-zero.
+ * \param aTotalVector The total emissions vector to update.
+ * \param aCurrVector The emissions calculated in the current period.
+ * \param aSign 1 to add the current emissions or -1 to subtract them.
+ */
+void ASimpleCarbonCalc::addEmissions( YearVector<double>& aTotalVector,
+                                      const YearVector<double>& aCurrVector,
+                                      const double aSign )
+{
+    int year = aCurrVector.getStartYear();
+    const int endYear = aCurrVector.getEndYear();
+    while( year <= endYear && aCurrVector[ year ] == 0.0 ) {
+        ++year;
+    }
+    if( year > endYear ) {
+        return;
+    }
+    
+    extendEmissions( aTotalVector, year );
+    for( ; year <= endYear; ++year ) {
+        aTotalVector[ year ] += aSign * aCurrVector[ year ];
+    }
+}
+
 double ASimpleCarbonCalc::getNetLandUseChangeEmission( const int aYear ) const {
-    return mTotalEmissionsAbove[ aYear ] + mTotalEmissionsBelow[ aYear ];
+    return getEmissions( mTotalEmissionsAbove, aYear ) + getEmissions( mTotalEmissionsBelow, aYear );
 }
 
 double ASimpleCarbonCalc::getNetLandUseChangeEmissionAbove( const int aYear ) const {
-    return mTotalEmissionsAbove[ aYear ];
+    return getEmissions( mTotalEmissionsAbove, aYear );
 }
 
 double ASimpleCarbonCalc::getNetLandUseChangeEmissionBelow( const int aYear ) const {
-    return mTotalEmissionsBelow[ aYear ];
+    return getEmissions( mTotalEmissionsBelow, aYear );
 }
 
 void ASimpleCarbonCalc::accept( IVisitor* aVisitor, const int aPeriod ) const {
@@ -426,5 +480,5 @@ double ASimpleCarbonCalc::getBelowGroundCarbonStock( const int aYear ) const {
 }
 
 double ASimpleCarbonCalc::getGrossPositiveLandUseChangeEmissionAbove( const int aYear ) const {
-    return mPositiveEmissionsAbove[ aYear ];
+    return getEmissions( mPositiveEmissionsAbove, aYear );
 }
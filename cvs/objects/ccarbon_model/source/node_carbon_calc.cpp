@@ -193,7 +193,7 @@ void NodeCarbonCalc::calcLandUseHistory()
                                                                   CarbonModelUtils::getEndYear(), mCarbonCalcs[ i ]->mTotalEmissionsBelow );
             }
             // Adjust carbon stock for any emissions that occurred from this change.
-            carbonStock[ i ] -= mCarbonCalcs[ i ]->mTotalEmissionsAbove[ year ];
+            carbonStock[ i ] -= ASimpleCarbonCalc::getEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, year );
         }
         // The difference in total land area change should have all been allocated
         // across the various land types.
@@ -234,7 +234,7 @@ void NodeCarbonCalc::calcLandUseHistory()
         // options that increased in land.
         for( size_t i = 0; i < mCarbonCalcs.size(); ++i ) {
             if( diffLand[ i ] > 0 ) {
-                double emissBeforeMove = mCarbonCalcs[ i ]->mTotalEmissionsAbove[ year ];
+                double emissBeforeMove = ASimpleCarbonCalc::getEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, year );
                 // Calculate the difference in carbon densities which would drive any
                 // emissions or uptake.
                 double fractionOfGain = diffLand[ i ] / totalLandGain;
@@ -247,7 +247,7 @@ void NodeCarbonCalc::calcLandUseHistory()
                                                                   mCarbonCalcs[ i ]->mTotalEmissionsBelow );
                 // Adjust carbon stock to include the carbon being moved in minus any emissions because of moving
                 // the carbon.
-                carbonStock[ i ] += currCarbonMove - ( mCarbonCalcs[ i ]->mTotalEmissionsAbove[ year ] - emissBeforeMove );
+                carbonStock[ i ] += currCarbonMove - ( ASimpleCarbonCalc::getEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, year ) - emissBeforeMove );
             }
         }
         
@@ -388,7 +388,7 @@ void NodeCarbonCalc::calc( const int aPeriod, const int aEndYear, const ICarbonC
             if( aCalcMode != ICarbonCalc::eReverseCalc ) {
                 for( size_t i = 0; i < mCarbonCalcs.size(); ++i ) {
                     mCarbonCalcs[ i ]->mCarbonStock[ year ] = mCarbonCalcs[ i ]->mCarbonStock[ year - 1 ] -
-                        ( mCarbonCalcs[ i ]->mTotalEmissionsAbove[ year ] + (*currEmissionsAbove[ i ])[ year ] );
+                        ( ASimpleCarbonCalc::getEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, year ) + (*currEmissionsAbove[ i ])[ year ] );
                 }
             }
             // Calculate emissions from changes in land that was removed/added from outside of this node.
@@ -447,22 +447,18 @@ void NodeCarbonCalc::calc( const int aPeriod, const int aEndYear, const ICarbonC
         // add current emissions to the total
         for( size_t i = 0; i < mCarbonCalcs.size(); ++i ) {
             if( aCalcMode == ICarbonCalc::eStoreResults ) {
-                for( year = prevModelYear + 1; year <= aEndYear; ++year ) {
-                    mCarbonCalcs[ i ]->mTotalEmissionsAbove[ year ] += (*currEmissionsAbove[ i ])[ year ];
-                    mCarbonCalcs[ i ]->mTotalEmissionsBelow[ year ] += (*currEmissionsBelow[ i ])[ year ];
-                    mCarbonCalcs[ i ]->mSavedCarbonStock[ aPeriod - 1 ] = mCarbonCalcs[ i ]->mCarbonStock[ prevModelYear ];
-                    mCarbonCalcs[ i ]->mSavedLandAllocation[ aPeriod - 1 ] = mCarbonCalcs[ i ]->mLandLeaf->getLandAllocation( mCarbonCalcs[ i ]->mLandLeaf->getName(), aPeriod - 1 );
-                }
+                ASimpleCarbonCalc::addEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, *currEmissionsAbove[ i ], 1.0 );
+                ASimpleCarbonCalc::addEmissions( mCarbonCalcs[ i ]->mTotalEmissionsBelow, *currEmissionsBelow[ i ], 1.0 );
+                mCarbonCalcs[ i ]->mSavedCarbonStock[ aPeriod - 1 ] = mCarbonCalcs[ i ]->mCarbonStock[ prevModelYear ];
+                mCarbonCalcs[ i ]->mSavedLandAllocation[ aPeriod - 1 ] = mCarbonCalcs[ i ]->mLandLeaf->getLandAllocation( mCarbonCalcs[ i ]->mLandLeaf->getName(), aPeriod - 1 );
             }
             else if( aCalcMode == ICarbonCalc::eReverseCalc ) {
-                for( year = prevModelYear + 1; year <= aEndYear; ++year ) {
-                    mCarbonCalcs[ i ]->mTotalEmissionsAbove[ year ] -= (*currEmissionsAbove[ i ])[ year ];
-                    mCarbonCalcs[ i ]->mTotalEmissionsBelow[ year ] -= (*currEmissionsBelow[ i ])[ year ];
-                }
+                ASimpleCarbonCalc::addEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, *currEmissionsAbove[ i ], -1.0 );
+                ASimpleCarbonCalc::addEmissions( mCarbonCalcs[ i ]->mTotalEmissionsBelow, *currEmissionsBelow[ i ], -1.0 );
             }
             else if( aCalcMode == ICarbonCalc::eReturnTotal ) {
-                mCarbonCalcs[ i ]->mStoredEmissions = mCarbonCalcs[ i ]->mTotalEmissionsAbove[ aEndYear ] +
-                    mCarbonCalcs[ i ]->mTotalEmissionsBelow[ aEndYear ] +
+                mCarbonCalcs[ i ]->mStoredEmissions = ASimpleCarbonCalc::getEmissions( mCarbonCalcs[ i ]->mTotalEmissionsAbove, aEndYear ) +
+                    ASimpleCarbonCalc::getEmissions( mCarbonCalcs[ i ]->mTotalEmissionsBelow, aEndYear ) +
                     (*currEmissionsAbove[ i ])[ aEndYear ] + (*currEmissionsBelow[ i ])[ aEndYear ];
             }
             // clean up memory now that we are done with it
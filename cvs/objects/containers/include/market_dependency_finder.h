@@ -48,10 +48,12 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <unordered_map>
 
 #include "util/base/include/definitions.h"
 
 class Marketplace;
+class Market;
 class IActivity;
 #if GCAM_PARALLEL_ENABLED
 class GcamFlowGraph;
@@ -79,8 +81,15 @@ class GcamFlowGraph;
  *                are directly affected by a change in the price of that market.
  *              - Get the global ordering via getOrdering() or a market specific
  *                ordering via getOrdering(int marketNumber).  Note that for market
- *                specific ordering a search will be performed to get a complete
- *                list of items to calculate.
+ *                specific ordering the complete list of items to calculate is
+ *                found for every solved market along with the global ordering
+ *                and for other markets a search will be performed the first
+ *                time it is requested.
+ *
+ *          When the "dependency-finder-cache" file is enabled the global ordering,
+ *          the cycles broken, and the orderings of the solved markets are saved keyed by
+ *          a hash of the dependency graph so that later runs with the same inputs
+ *          can simply reload them.
  *
  * \author Pralit Patel
  */
@@ -108,6 +117,9 @@ public:
                                       IActivity* aPriceActivity = 0 );
     
     void createOrdering();
+    
+    void getActivityMarkets( const int aPeriod,
+                             std::unordered_map<const IActivity*, std::vector<const Market*> >& aActivityMarkets ) const;
 
     // CalcVertex and related declarations
     struct DependencyItem;
@@ -193,8 +205,8 @@ public:
     struct DependencyItem {
         DependencyItem( const std::string& aName, const std::string& aLocatedInRegion )
         :mName( aName ), mLocatedInRegion( aLocatedInRegion ), mIsSolved( false ),
-        mLinkedMarket( -1 ), mCanBreakCycle( true ), mHasSelfDependence( false ),
-        mHasIncomingDependency( false ){}
+        mLinkedMarket( -1 ), mTrialDemandMarket( -1 ), mCanBreakCycle( true ),
+        mHasSelfDependence( false ), mHasIncomingDependency( false ){}
         ~DependencyItem();
         
         //! A name of a dependency which will correspond to a sector or resource, etc.
@@ -222,6 +234,10 @@ public:
         //! and this graph will be static through all model periods.
         int mLinkedMarket;
         
+        //! The market number of the trial demand market demands for this item
+        //! get added to instead if trial markets were created for it, or -1.
+        int mTrialDemandMarket;
+        
         //! Whether this item can be used to break a cycle.
         bool mCanBreakCycle;
 
@@ -300,7 +316,7 @@ public:
      *        which would need to recalculate if the solver changed it's price.
      */
     struct MarketToDependencyItem {
-        MarketToDependencyItem( const int aMarketNumber ):mMarket( aMarketNumber )
+        MarketToDependencyItem( const int aMarketNumber ):mMarket( aMarketNumber ), mIsSolved( false )
 #if GCAM_PARALLEL_ENABLED
                                                           ,mFlowGraph( 0 )
 #endif
@@ -311,13 +327,18 @@ public:
         //! and the graph will be static through all model periods.
         const int mMarket;
         
+        //! If this market is solved in any model period.  Only these markets have
+        //! their calc list created along with the global ordering.
+        bool mIsSolved;
+        
         //! A unique set of vertices to re-calculate should this market change
         //! it's price.
         std::set<CalcVertex*> mImpliedVertices;
 
         //! A complete list of vertices to re-calculate should this market change
-        //! it's price.  Note that this is essentially a cache and only computed
-        //! the first time it is needed.
+        //! it's price in calculation order.  Note this is computed for every solved
+        //! market by createOrdering and for any other market only the first time
+        //! it is needed.
         std::vector<IActivity*> mCalcList;
 
 #if GCAM_PARALLEL_ENABLED
@@ -361,11 +382,18 @@ public:
     GcamFlowGraph* mTBBGraphGlobal;
 #endif
     
+    void createMarketOrderings();
     void findVerticesToCalculate( CalcVertex* aVertex, std::set<IActivity*>& aVisited ) const;
     void findStronglyConnected( CalcVertex* aCurrVertex, int& aMaxIndex,std::list<CalcVertex*>& aHasVisited,
                                 CalcVertexCountMap& aTotalVisits ) const;
     int markCycles( CalcVertex* aCurrVertex, std::list<CalcVertex*>& aHasVisited, CalcVertexCountMap& aTotalVisits ) const;
     void createTrialsForItem( CItemIterator aItemToReset, CalcVertexCountMap& aNumDependencies );
+    
+    uint64_t hashDependencyGraph() const;
+    std::string getOrderingCacheFileName( const uint64_t aGraphHash ) const;
+    bool loadOrderingCache( const uint64_t aGraphHash, CalcVertexCountMap& aNumDependencies,
+                            std::vector<DependencyItem*>& aBrokenItems );
+    void saveOrderingCache( const uint64_t aGraphHash, const std::vector<DependencyItem*>& aBrokenItems ) const;
 };
 
 #endif // _MARKET_DEPENDENCY_FINDER_H_
@@ -87,6 +87,13 @@ private:
     //! more than one GHG if for instance we are calculating a CO2-equivalent policy
     std::vector<std::string> mGHGQuantityNames;
 
+    //! Whether trials only recalculate the periods from the first taxed period
+    //! on.  This is turned off should a checked trial not match a full run.
+    bool mUsePartialRuns;
+    
+    //! Whether each partial trial run is checked against a full run.
+    bool mCheckPartialRuns;
+
     //! The scenario runner which controls running the initial scenario, and all
     //! fixed taxed scenarios after. This is a weak reference.
     SingleScenarioRunner* mSingleScenario;
@@ -112,6 +119,7 @@ private:
     RegionCurves mRegionalCostCurves;
 
     bool runTrials();
+    bool checkPartialRun( RegionCurves& aEmissionsQCurves, const int aPoint, const bool aRestorePrices );
     void createCostCurvesByPeriod();
     void createRegionalCostCurves();
     const std::string createXMLOutputString() const;
@@ -40,6 +40,10 @@
 
 #include "util/base/include/definitions.h"
 #include <cassert>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
 #include <boost/algorithm/string/predicate.hpp>
 #include "containers/include/market_dependency_finder.h"
 #include "util/logger/include/ilogger.h"
@@ -49,8 +53,13 @@
 #include "marketplace/include/market.h"
 #include "marketplace/include/linked_market.h"
 #include "containers/include/iactivity.h"
+#include "util/base/include/configuration.h"
+#include "util/base/include/util.h"
+
+#include "parallel/include/bitvector.hpp"
 
 #if GCAM_PARALLEL_ENABLED
+#include <tbb/parallel_for_each.h>
 #include "parallel/include/gcam_parallel.hpp"
 #endif
 
@@ -193,8 +202,9 @@ void MarketDependencyFinder::resolveActivityToDependency( const string& aRegionN
  * \details If called with a market number of -1 (the default value) then the complete
  *          ordering which will calculate all objects in the model is returned.
  *          When a valid market number is given the in-order list of activities which
- *          would be affected by that market changing it's price would be generated
- *          and returned.
+ *          would be affected by that market changing it's price is returned.  These
+ *          are precomputed by createMarketOrderings for solved markets and otherwise
+ *          generated and cached the first time they are requested.
  * \param aMarketNumber The market number to get an ordered list of items which
  *                      are required to be calculated if that market changes prices,
  *                      or if -1 the full global list.
@@ -219,19 +229,12 @@ const vector<IActivity*> MarketDependencyFinder::getOrdering( const int aMarketN
             exit( 1 );
         }
 
-        // First check the MarketToDependencyItem and see if we have this cached.
-        if( !(*mrktIter)->mCalcList.empty() ) {
+        // The calc lists for solved markets are created along with the global
+        // ordering so only other markets need a search.
+        if( !(*mrktIter)->mCalcList.empty() || (*mrktIter)->mIsSolved ) {
             return (*mrktIter)->mCalcList;
         }
 
-        // We must generate the full list of nodes to calculate.  The createOrdering
-        // method has created a link from markets to "entry points" into the graph.
-        // We must then do a search on the graph from those entry points to come up
-        // with a full set of items which must be recalculated.
-        // To ensure the set of items are in order we can utilize the already created
-        // global ordering.
-        
-        
         // Do a search from all of the entry points to get a set of unique items
         // to calculate.
         set<IActivity*> dependenentCalcs;
@@ -305,6 +308,61 @@ GcamFlowGraph* MarketDependencyFinder::getFlowGraph( const int aMarketNumber ) {
 }
 #endif
 
+/*!
+ * \brief Get the markets each activity may change the price, supply, or demand
+ *        of in the given period.
+ * \details This follows the dependencies between items: the activities of an
+ *          item may set its own market and add to the market of every item it
+ *          depends on, for instance the demand for an input or the supply of a
+ *          secondary output.  Once trial markets have been created for an item
+ *          the demands for it go to the trial demand market instead so both are
+ *          included.  Linked markets are followed to the market they add to.
+ *          This is the structure of the Jacobian used by LogEDFun::partialRows.
+ * \param aPeriod The model period of the markets.
+ * \param aActivityMarkets The map to fill with the markets of each activity in
+ *                         the graph.
+ */
+void MarketDependencyFinder::getActivityMarkets( const int aPeriod,
+                                                 unordered_map<const IActivity*, vector<const Market*> >& aActivityMarkets ) const
+{
+    // the market numbers the activities of each item may change, an item is in
+    // the dependent list of each item it depends on
+    unordered_map<const DependencyItem*, vector<int> > itemMarkets;
+    for( const DependencyItem* item : mDependencyItems ) {
+        for( const int marketNumber : { item->mLinkedMarket, item->mTrialDemandMarket } ) {
+            if( marketNumber != -1 ) {
+                itemMarkets[ item ].push_back( marketNumber );
+                for( const DependencyItem* dependent : item->mDependentList ) {
+                    itemMarkets[ dependent ].push_back( marketNumber );
+                }
+            }
+        }
+    }
+    
+    aActivityMarkets.clear();
+    for( const DependencyItem* item : mDependencyItems ) {
+        const vector<int>& marketNumbers = itemMarkets[ item ];
+        for( const VertexList* vertices : { &item->mPriceVertices, &item->mDemandVertices } ) {
+            for( const CalcVertex* vertex : *vertices ) {
+                vector<const Market*>& markets = aActivityMarkets[ vertex->mCalcItem ];
+                for( const int marketNumber : marketNumbers ) {
+                    const Market* market = mMarketplace->mMarkets[ marketNumber ]->getMarket( aPeriod );
+                    while( market ) {
+                        markets.push_back( market );
+                        const LinkedMarket* linkedMarket = dynamic_cast<const LinkedMarket*>( market );
+                        market = linkedMarket ? linkedMarket->mLinkedMarket : 0;
+                    }
+                }
+            }
+        }
+    }
+    for( auto& activityMarkets : aActivityMarkets ) {
+        vector<const Market*>& markets = activityMarkets.second;
+        sort( markets.begin(), markets.end() );
+        markets.erase( unique( markets.begin(), markets.end() ), markets.end() );
+    }
+}
+
 /*!
  * \brief A depth first search collecting a unique set of the vertices visited.
  * \details Recursively search for vertices.  The end points for recursion are if
@@ -382,6 +440,7 @@ void MarketDependencyFinder::createOrdering() {
                 isSolved = mMarketplace->mMarkets[ marketNumber ]->getMarket( period )->isSolvable();
             }
             (*it)->mIsSolved = isSolved;
+            (*mrktIter)->mIsSolved = (*mrktIter)->mIsSolved || isSolved;
             // we don't need to wory about grouping solved markets since they will just
             // get disconnected anyways
             if( !isSolved || !(*it)->mCanBreakCycle ) {
@@ -556,6 +615,18 @@ void MarketDependencyFinder::createOrdering() {
         }
     }
     
+    // The ordering and the cycles broken to create it only depend on the structure
+    // of the graph so if a previous run had the same graph we can just reload
+    // what it found.
+    const bool useOrderingCache = Configuration::getInstance()->shouldWriteFile( "dependency-finder-cache", false );
+    const uint64_t graphHash = useOrderingCache ? hashDependencyGraph() : 0;
+    vector<DependencyItem*> brokenItems;
+    const bool isCached = useOrderingCache && loadOrderingCache( graphHash, numDependencies, brokenItems );
+    if( isCached ) {
+        // the global ordering has been loaded so there is nothing left to sort
+        numDependencies.clear();
+    }
+    
     // A map which will be populated with vertices in cycles the first time one is
     // found and can be used there after to break cycles as needed while
     // performing the topological sort.
@@ -674,6 +745,7 @@ void MarketDependencyFinder::createOrdering() {
             
             // Reset this item to be solved via trials and adjust the depenencies accordingly.
             createTrialsForItem( maxItem, numDependencies );
+            brokenItems.push_back( *maxItem );
 
             // Remove both the price and demand vertex from totalVisits since they can not be
             // used again to try to break a dependency.
@@ -694,6 +766,92 @@ void MarketDependencyFinder::createOrdering() {
     for( vector<IActivity*>::iterator it = mGlobalOrdering.begin(); it != mGlobalOrdering.end(); ++it ) {
         depLog << "- " << (*it)->getDescription() << endl;
     }
+    
+    if( !isCached ) {
+        createMarketOrderings();
+        if( useOrderingCache ) {
+            saveOrderingCache( graphHash, brokenItems );
+        }
+    }
+}
+
+/*!
+ * \brief Create the in-order list of activities to calculate for every solved
+ *        market should the solver change its price.
+ * \details Every activity reachable from a market's entry points in the graph
+ *          must be recalculated.  Since edges in the graph always point forward
+ *          in the global ordering we can find them in a single sweep through the
+ *          ordering starting at the earliest entry point, marking the dependents
+ *          of each marked activity in a bitset as we go.  The marked activities
+ *          are then already in calculation order.  Each market is independent so
+ *          they are processed in parallel when enabled.  Markets which are never
+ *          solved are left to getOrdering to search for should they be needed so
+ *          that a list is not kept for each of them.
+ */
+void MarketDependencyFinder::createMarketOrderings() {
+    // index the out edges by the position of the activities in the global ordering
+    map<const IActivity*, int> orderIndex;
+    for( size_t i = 0; i < mGlobalOrdering.size(); ++i ) {
+        orderIndex[ mGlobalOrdering[ i ] ] = i;
+    }
+    vector<vector<int> > outEdges( mGlobalOrdering.size() );
+    for( const DependencyItem* item : mDependencyItems ) {
+        for( auto vertexList : { &item->mPriceVertices, &item->mDemandVertices } ) {
+            for( const CalcVertex* vertex : *vertexList ) {
+                vector<int>& currOutEdges = outEdges[ orderIndex[ vertex->mCalcItem ] ];
+                for( const CalcVertex* outVertex : vertex->mOutEdges ) {
+                    currOutEdges.push_back( orderIndex[ outVertex->mCalcItem ] );
+                }
+                // implied in edges must also be calculated (special case for the
+                // land-allocator)
+                for( const CalcVertex* inVertex : vertex->mImpliedInEdges ) {
+                    currOutEdges.push_back( orderIndex[ inVertex->mCalcItem ] );
+                }
+            }
+        }
+    }
+    
+    vector<MarketToDependencyItem*> marketsToDep;
+    for( MarketToDependencyItem* marketToDep : mMarketsToDep ) {
+        if( marketToDep->mIsSolved ) {
+            marketsToDep.push_back( marketToDep );
+        }
+    }
+    auto createMarketOrdering = [this, &orderIndex, &outEdges]( MarketToDependencyItem* aMarketToDep ) {
+        bitvector toCalc( mGlobalOrdering.size() );
+        int curr = mGlobalOrdering.size();
+        for( const CalcVertex* vertex : aMarketToDep->mImpliedVertices ) {
+            const int index = (*orderIndex.find( vertex->mCalcItem )).second;
+            toCalc.set( index );
+            curr = min( curr, index );
+        }
+        while( curr < static_cast<int>( mGlobalOrdering.size() ) ) {
+            int next = curr + 1;
+            if( toCalc.get( curr ) ) {
+                for( int to : outEdges[ curr ] ) {
+                    if( !toCalc.get( to ) ) {
+                        toCalc.set( to );
+                        // an implied in edge may point back in the ordering in
+                        // which case resume the sweep from there
+                        next = min( next, to );
+                    }
+                }
+            }
+            curr = next;
+        }
+        aMarketToDep->mCalcList.clear();
+        aMarketToDep->mCalcList.reserve( toCalc.count() );
+        for( size_t i = 0; i < mGlobalOrdering.size(); ++i ) {
+            if( toCalc.get( i ) ) {
+                aMarketToDep->mCalcList.push_back( mGlobalOrdering[ i ] );
+            }
+        }
+    };
+#if GCAM_PARALLEL_ENABLED
+    tbb::parallel_for_each( marketsToDep.begin(), marketsToDep.end(), createMarketOrdering );
+#else
+    for_each( marketsToDep.begin(), marketsToDep.end(), createMarketOrdering );
+#endif
 }
 
 /*!
@@ -840,6 +998,7 @@ void MarketDependencyFinder::createTrialsForItem( CItemIterator aItemToReset, Ca
         abort();
     }
     (*aItemToReset)->mIsSolved = true;
+    (*aItemToReset)->mTrialDemandMarket = demandMrkt;
 
     // Remove dependencies on the demand vertex now that it is solved.
     // Dependencies on the price vertex must remain since it is responsible
@@ -866,6 +1025,9 @@ void MarketDependencyFinder::createTrialsForItem( CItemIterator aItemToReset, Ca
     MarketToDepIterator priceMrktIter = mMarketsToDep.find( marketToDep.get() );
     assert( priceMrktIter != mMarketsToDep.end() );
     MarketToDepIterator demandMrktIter = mMarketsToDep.insert( new MarketToDependencyItem( demandMrkt ) ).first;
+    // both trial markets will be solved
+    (*priceMrktIter)->mIsSolved = true;
+    (*demandMrktIter)->mIsSolved = true;
 
     // The price/demand vertices are obviously implied when the it's corresponding
     // price/demand trial price changes.
@@ -894,3 +1056,286 @@ void MarketDependencyFinder::createTrialsForItem( CItemIterator aItemToReset, Ca
     }
 }
 
+/*!
+ * \brief Calculate a hash of the structure of the dependency graph as it stands
+ *        before any cycles have been broken.
+ * \details Includes every dependency item, the markets they are linked to, the
+ *          activities bound to them, the edges between their vertices, and the
+ *          vertices implied by each market.  Anything which could change the
+ *          ordering or which cycles get broken will change the hash.
+ * \return A 64 bit FNV-1a hash of the graph.
+ */
+uint64_t MarketDependencyFinder::hashDependencyGraph() const {
+    uint64_t hash = 14695981039346656037ULL;
+    auto hashBytes = [&hash]( const void* aData, const size_t aSize ) {
+        const unsigned char* bytes = static_cast<const unsigned char*>( aData );
+        for( size_t i = 0; i < aSize; ++i ) {
+            hash = ( hash ^ bytes[ i ] ) * 1099511628211ULL;
+        }
+    };
+    auto hashInt = [&hashBytes]( const int aValue ) {
+        hashBytes( &aValue, sizeof( int ) );
+    };
+    auto hashString = [&hashBytes, &hashInt]( const string& aValue ) {
+        hashInt( aValue.size() );
+        hashBytes( aValue.data(), aValue.size() );
+    };
+    // Sets of vertices are ordered by address which is not stable between runs
+    // so hash their sorted UIDs instead.
+    auto hashVertexSet = [&hashInt]( const set<CalcVertex*>& aVertices ) {
+        vector<int> uids;
+        uids.reserve( aVertices.size() );
+        for( const CalcVertex* vertex : aVertices ) {
+            uids.push_back( vertex->mUID );
+        }
+        sort( uids.begin(), uids.end() );
+        hashInt( uids.size() );
+        for( const int uid : uids ) {
+            hashInt( uid );
+        }
+    };
+    auto hashVertices = [&hashInt, &hashString, &hashVertexSet]( const VertexList& aVertices ) {
+        hashInt( aVertices.size() );
+        for( const CalcVertex* vertex : aVertices ) {
+            hashInt( vertex->mUID );
+            hashString( vertex->mCalcItem->getDescription() );
+            hashInt( vertex->mOutEdges.size() );
+            for( const CalcVertex* outVertex : vertex->mOutEdges ) {
+                hashInt( outVertex->mUID );
+            }
+            hashVertexSet( vertex->mImpliedInEdges );
+        }
+    };
+    
+    hashInt( mMarketplace->mMarkets.size() );
+    for( const DependencyItem* item : mDependencyItems ) {
+        hashString( item->mName );
+        hashString( item->mLocatedInRegion );
+        hashInt( item->mLinkedMarket );
+        hashInt( item->mIsSolved );
+        hashInt( item->mCanBreakCycle );
+        hashVertices( item->mPriceVertices );
+        hashVertices( item->mDemandVertices );
+    }
+    for( const MarketToDependencyItem* marketToDep : mMarketsToDep ) {
+        hashInt( marketToDep->mMarket );
+        hashVertexSet( marketToDep->mImpliedVertices );
+    }
+    return hash;
+}
+
+/*!
+ * \brief Get the name of the ordering cache file for a dependency graph.
+ * \details The graph hash is included in the name so that runs with different
+ *          inputs can share a cache location without overwriting each other.
+ * \param aGraphHash The hash of the dependency graph.
+ * \return The file name to use.
+ */
+string MarketDependencyFinder::getOrderingCacheFileName( const uint64_t aGraphHash ) const {
+    const string fileName = Configuration::getInstance()->getFile( "dependency-finder-cache", "restart/dependency-cache" );
+    char hashStr[ 17 ];
+    snprintf( hashStr, sizeof( hashStr ), "%016llx", static_cast<unsigned long long>( aGraphHash ) );
+    return fileName + "." + hashStr;
+}
+
+/*!
+ * \brief Attempt to load the global ordering, broken cycles, and per market calc
+ *        lists saved from a previous run with the same dependency graph.
+ * \details The cycles are broken again by recreating the trial markets in the same
+ *          order they were originally created.  If any of the cached data is found
+ *          to be inconsistent with the current graph the cache is not used.  Note
+ *          that should that happen after some trial markets have been created the
+ *          dependency counts and aBrokenItems are still kept up to date so that the
+ *          ordering can be created as usual.
+ * \param aGraphHash The hash of the current dependency graph.
+ * \param aNumDependencies The current count of dependencies on each activity.
+ * \param aBrokenItems The items which trial markets were created for.
+ * \return True if the cache was loaded, false if the ordering still needs to be
+ *         created.
+ * \sa MarketDependencyFinder::saveOrderingCache
+ */
+bool MarketDependencyFinder::loadOrderingCache( const uint64_t aGraphHash, CalcVertexCountMap& aNumDependencies,
+                                                vector<DependencyItem*>& aBrokenItems )
+{
+    const string cacheFileName = getOrderingCacheFileName( aGraphHash );
+    fstream cacheFile( cacheFileName.c_str(), ios_base::in | ios_base::binary );
+    if( !cacheFile.is_open() ) {
+        // nothing cached for this graph yet
+        return false;
+    }
+    
+    ILogger& depLog = ILogger::getLogger( "dependency_finder_log" );
+    auto readInt = [&cacheFile]() {
+        int32_t value = -1;
+        cacheFile.read( reinterpret_cast<char*>( &value ), sizeof( int32_t ) );
+        return static_cast<int>( value );
+    };
+    auto readString = [&cacheFile, &readInt]() {
+        const int size = readInt();
+        string value( max( size, 0 ), '\0' );
+        cacheFile.read( &value[ 0 ], value.size() );
+        return value;
+    };
+    
+    uint64_t hashInCache = 0;
+    cacheFile.read( reinterpret_cast<char*>( &hashInCache ), sizeof( uint64_t ) );
+    
+    // find the items to break cycles with and ensure they are all still valid
+    // before making any changes to the marketplace
+    vector<CItemIterator> itemsToBreak( max( readInt(), 0 ) );
+    bool isValid = hashInCache == aGraphHash;
+    for( size_t i = 0; i < itemsToBreak.size() && isValid; ++i ) {
+        const string name = readString();
+        const string region = readString();
+        DependencyItem searchItem( name, region );
+        itemsToBreak[ i ] = mDependencyItems.find( &searchItem );
+        isValid = cacheFile && itemsToBreak[ i ] != mDependencyItems.end() && !(*itemsToBreak[ i ])->mIsSolved &&
+            (*itemsToBreak[ i ])->mCanBreakCycle;
+    }
+    
+    map<int, CalcVertex*> vertexByUID;
+    for( const DependencyItem* item : mDependencyItems ) {
+        for( auto vertexList : { &item->mPriceVertices, &item->mDemandVertices } ) {
+            for( CalcVertex* vertex : *vertexList ) {
+                vertexByUID[ vertex->mUID ] = vertex;
+            }
+        }
+    }
+    auto readActivities = [&readInt, &vertexByUID, &isValid]( vector<IActivity*>& aActivities ) {
+        aActivities.resize( max( readInt(), 0 ) );
+        for( size_t i = 0; i < aActivities.size() && isValid; ++i ) {
+            auto vertexIter = vertexByUID.find( readInt() );
+            isValid = vertexIter != vertexByUID.end();
+            aActivities[ i ] = isValid ? (*vertexIter).second->mCalcItem : 0;
+        }
+    };
+    vector<IActivity*> globalOrdering;
+    if( isValid ) {
+        readActivities( globalOrdering );
+        isValid = cacheFile && globalOrdering.size() == vertexByUID.size();
+    }
+    if( !isValid ) {
+        depLog.setLevel( ILogger::WARNING );
+        depLog << "Dependency finder cache " << cacheFileName << " does not match the current model and will be ignored." << endl;
+        return false;
+    }
+    
+    // recreate the trial markets in the order they were originally created
+    for( CItemIterator itemToBreak : itemsToBreak ) {
+        depLog.setLevel( ILogger::WARNING );
+        depLog << "Creating trial markets for " << (*itemToBreak)->mName << " in " << (*itemToBreak)->mLocatedInRegion
+               << " from the dependency finder cache." << endl;
+        createTrialsForItem( itemToBreak, aNumDependencies );
+        aBrokenItems.push_back( *itemToBreak );
+    }
+    
+    // the trial markets created above must line up with the markets in the cache
+    const int numMarkets = readInt();
+    const int numSolvedMarkets = count_if( mMarketsToDep.begin(), mMarketsToDep.end(),
+                                           []( const MarketToDependencyItem* aMarketToDep ) {
+                                               return aMarketToDep->mIsSolved;
+                                           } );
+    isValid = cacheFile && numMarkets == numSolvedMarkets;
+    vector<pair<MarketToDependencyItem*, vector<IActivity*> > > calcLists;
+    for( int i = 0; i < numMarkets && isValid; ++i ) {
+        MarketToDependencyItem searchItem( readInt() );
+        CMarketToDepIterator mrktIter = mMarketsToDep.find( &searchItem );
+        isValid = mrktIter != mMarketsToDep.end() && (*mrktIter)->mIsSolved;
+        if( isValid ) {
+            calcLists.push_back( make_pair( *mrktIter, vector<IActivity*>() ) );
+            readActivities( calcLists.back().second );
+            isValid = !cacheFile.fail();
+        }
+    }
+    if( !isValid || cacheFile.peek() != EOF ) {
+        depLog.setLevel( ILogger::WARNING );
+        depLog << "Dependency finder cache " << cacheFileName << " has inconsistent market orderings and will be ignored." << endl;
+        return false;
+    }
+    
+    mGlobalOrdering = globalOrdering;
+    for( auto calcList : calcLists ) {
+        calcList.first->mCalcList = calcList.second;
+    }
+    depLog.setLevel( ILogger::NOTICE );
+    depLog << "Loaded the global ordering from the dependency finder cache " << cacheFileName << endl;
+    return true;
+}
+
+/*!
+ * \brief Save the global ordering, the items which were used to break cycles, and
+ *        the calc lists for every solved market so that later runs with the same
+ *        dependency graph can skip creating them.
+ * \details All values are written in binary.  First the graph hash (uint64_t), then
+ *          the number of broken items followed by the name and region of each.
+ *          Next the global ordering as the count and then the UID of the vertex for
+ *          each activity.  Finally the number of solved markets followed by the market
+ *          number and its calc list in the same form as the global ordering.
+ *          Strings are written as their length then characters
+ *          and all counts and IDs as int32_t.  The file is written to a temporary
+ *          name first so that concurrent runs never read a partial cache.
+ * \param aGraphHash The hash of the dependency graph before any cycles were broken.
+ * \param aBrokenItems The items which trial markets were created for in order.
+ * \sa MarketDependencyFinder::loadOrderingCache
+ */
+void MarketDependencyFinder::saveOrderingCache( const uint64_t aGraphHash, const vector<DependencyItem*>& aBrokenItems ) const {
+    const string cacheFileName = getOrderingCacheFileName( aGraphHash );
+    const string tempFileName = cacheFileName + ".tmp" + util::toString( chrono::steady_clock::now().time_since_epoch().count() );
+    fstream cacheFile( tempFileName.c_str(), ios_base::out | ios_base::trunc | ios_base::binary );
+    if( !cacheFile.is_open() ) {
+        ILogger& depLog = ILogger::getLogger( "dependency_finder_log" );
+        depLog.setLevel( ILogger::WARNING );
+        depLog << "Could not open dependency finder cache: " << tempFileName << " for write." << endl;
+        return;
+    }
+    
+    auto writeInt = [&cacheFile]( const int aValue ) {
+        const int32_t value = aValue;
+        cacheFile.write( reinterpret_cast<const char*>( &value ), sizeof( int32_t ) );
+    };
+    auto writeString = [&cacheFile, &writeInt]( const string& aValue ) {
+        writeInt( aValue.size() );
+        cacheFile.write( aValue.data(), aValue.size() );
+    };
+    map<const IActivity*, int> activityUID;
+    for( const DependencyItem* item : mDependencyItems ) {
+        for( auto vertexList : { &item->mPriceVertices, &item->mDemandVertices } ) {
+            for( const CalcVertex* vertex : *vertexList ) {
+                activityUID[ vertex->mCalcItem ] = vertex->mUID;
+            }
+        }
+    }
+    auto writeActivities = [&writeInt, &activityUID]( const vector<IActivity*>& aActivities ) {
+        writeInt( aActivities.size() );
+        for( const IActivity* activity : aActivities ) {
+            writeInt( activityUID[ activity ] );
+        }
+    };
+    
+    cacheFile.write( reinterpret_cast<const char*>( &aGraphHash ), sizeof( uint64_t ) );
+    writeInt( aBrokenItems.size() );
+    for( const DependencyItem* item : aBrokenItems ) {
+        writeString( item->mName );
+        writeString( item->mLocatedInRegion );
+    }
+    writeActivities( mGlobalOrdering );
+    vector<const MarketToDependencyItem*> solvedMarketsToDep;
+    for( const MarketToDependencyItem* marketToDep : mMarketsToDep ) {
+        if( marketToDep->mIsSolved ) {
+            solvedMarketsToDep.push_back( marketToDep );
+        }
+    }
+    writeInt( solvedMarketsToDep.size() );
+    for( const MarketToDependencyItem* marketToDep : solvedMarketsToDep ) {
+        writeInt( marketToDep->mMarket );
+        writeActivities( marketToDep->mCalcList );
+    }
+    cacheFile.close();
+    
+    if( !cacheFile || rename( tempFileName.c_str(), cacheFileName.c_str() ) != 0 ) {
+        ILogger& depLog = ILogger::getLogger( "dependency_finder_log" );
+        depLog.setLevel( ILogger::WARNING );
+        depLog << "Failed to write dependency finder cache: " << cacheFileName << endl;
+        remove( tempFileName.c_str() );
+    }
+}
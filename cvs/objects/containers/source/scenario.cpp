@@ -66,10 +66,11 @@
 #include "util/base/include/manage_state_variables.hpp"
 #include "util/base/include/supply_demand_curve_saver.h"
 #include "containers/include/calc_base_price.h"
+#include "util/base/include/activity_profiler.h"
+#include "util/base/include/memory_report.h"
 
-#if GCAM_PARALLEL_ENABLED && PARALLEL_DEBUG
-#include <stdlib.h>
-#include <tbb/tick_count.h>
+#if GCAM_PARALLEL_ENABLED
+#include "parallel/include/parallel_check.hpp"
 #endif
 
 using namespace std;
@@ -230,9 +231,25 @@ void Scenario::completeInit() {
         mainLog << "No world container was parsed from the input files." << endl;
     }
 
+    // The structure of the model has been built or changed so the STATE must be
+    // found again.
+    ManageStateVariables::invalidateStateCache();
+
     // Set the valid period vector to false.
     mIsValidPeriod.clear();
     mIsValidPeriod.resize( mModeltime->getmaxper(), false );
+    
+    // Report the memory used by the fully initialized model if requested.
+    AutoOutputFile memoryReportFile( "memory-report", "memory-report.csv" );
+    if( memoryReportFile.shouldWrite() ) {
+        MemoryReport memoryReport;
+        memoryReport.calcFootprint( this );
+        memoryReport.printCSV( *memoryReportFile );
+        
+        ILogger& mainLog = ILogger::getLogger( "main_log" );
+        mainLog.setLevel( ILogger::NOTICE );
+        mainLog << "Memory accounted for in the model: " << memoryReport.getTotalBytes() << " bytes." << endl;
+    }
 }
 
 //! Return scenario name.
@@ -282,6 +299,9 @@ bool Scenario::run( const int aSinglePeriod,
     Timer& fullScenarioTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::FULLSCENARIO );
     fullScenarioTimer.start();
     
+    // Enable the activity profiler if requested before any calculations are made.
+    ActivityProfiler& activityProfiler = ActivityProfiler::getInstance();
+    
     // Log that a run is beginning.
     logRunBeginning();
 
@@ -362,6 +382,10 @@ bool Scenario::run( const int aSinglePeriod,
     mainLog.setLevel( ILogger::DEBUG );
     fullScenarioTimer.stop();
     TimerRegistry::getInstance().printAllTimers( mainLog );
+    activityProfiler.writeProfile();
+#if GCAM_PARALLEL_ENABLED
+    ParallelCheck::getInstance().writeSummary();
+#endif
 
     // Run the climate model.
     mWorld->runClimateModel();
@@ -417,63 +441,20 @@ bool Scenario::calculatePeriod( const int aPeriod,
     // they got set from a restart file.
     mMarketplace->nullSuppliesAndDemands( aPeriod );
 
-#if GCAM_PARALLEL_ENABLED && PARALLEL_DEBUG
-    mWorld->calc( aPeriod );       // get rid of transient bad data
-    mMarketplace->nullSuppliesAndDemands( aPeriod );
-
-    ILogger &mainlog = ILogger::getLogger("main_log"); 
-    
-    ILogger &pdebug = ILogger::getLogger( "parallel_debug_log" );
-    pdebug.setLevel(ILogger::DEBUG);
-    pdebug << "**************** Starting serial World::calc (period " << aPeriod << ") ****************\n";
-
-    tbb::tick_count t0 = tbb::tick_count::now();
+#if GCAM_PARALLEL_ENABLED
+    // Check that the parallel calculation reproduces the serial one if requested.
+    ParallelCheck& parallelCheck = ParallelCheck::getInstance();
+    if( parallelCheck.beginPeriod( aPeriod ) ) {
+        parallelCheck.checkWorldCalc( mWorld, mMarketplace, aPeriod );
+        mMarketplace->nullSuppliesAndDemands( aPeriod );
+    }
 #endif
     
     mWorld->calc( aPeriod ); // call to calculate initial supply and demand
-
-#if GCAM_PARALLEL_ENABLED && PARALLEL_DEBUG
-    tbb::tick_count t1 = tbb::tick_count::now();
-    
-    pdebug << "****************Ending serial World::calc****************\n";
-    std::vector<double> serialrslt = marketplace->fullstate( aPeriod );
-
-    pdebug << "%%%%%%%%%%%%%%%% Starting parallel World::calc (period " << aPeriod << ") %%%%%%%%%%%%%%%%\n";
-    tbb::tick_count t2;
-    tbb::tick_count t3;
-    mMarketplace->nullSuppliesAndDemands( aPeriod );
-
-    t2 = tbb::tick_count::now();
-    mWorld->calc(aPeriod, world->getGlobalFlowGraph());
-    t3 = tbb::tick_count::now();
-      
-    pdebug << "%%%%%%%%%%%%%%%% Ending parallel World::calc %%%%%%%%%%%%%%%%\n";
-
-    // check for consistency between serial and parallel versions
-
-    ILogger::WarningLevel old_main_log_level = mainlog.setLevel(ILogger::ERROR);
-    if(aPeriod > 0) {
-        if( !mMarketplace->checkstate(aPeriod, serialrslt, &mainlog, DBL_CMP_LOOSE) ) {
-            std::cerr << "ERROR: parallel calc failed to reproduce serial results in period " << aPeriod
-                      << ".\n";
-            mainlog << "ERROR: parallel calc failed to reproduce serial results in period " << aPeriod
-                    << ".\n"; 
-        } 
-        else {
-            mainlog.setLevel(ILogger::NOTICE);
-            std::cerr << "Period " << aPeriod << " parallel calc successful.\n";
-        }
-    }
-
-    mainlog.setLevel(ILogger::WARNING);
-    double sertime = (t1-t0).seconds();
-    double partime = (t3-t2).seconds();
-    double ratio   = sertime/partime;
-    mainlog << "===Period: " << aPeriod << ":\tserial time: " << sertime
-            << "\tparallel time:  " << partime << "\tspeedup:  " << ratio << "\n";
-    mainlog.setLevel( old_main_log_level );
-#endif
     
+    // Learn which state each activity writes so that partial derivatives only
+    // need to reset that state and so that state can be laid out by activity.
+    mManageStateVars->recordActivityState( mWorld->getGlobalOrdering(), aPeriod );
     
     bool success = solve( aPeriod ); // solution uses Bisect and NR routine to clear markets
 
@@ -636,6 +617,8 @@ void Scenario::printLandAllocatorGraph( const int aPeriod, const bool aPrintValu
 */
 void Scenario::setTax( const GHGPolicy* aTax ){
     mWorld->setTax( aTax );
+    // Setting a tax may replace policy objects so the STATE must be found again.
+    ManageStateVariables::invalidateStateCache();
 }
 
 /*! \brief Get the climate model.
@@ -42,6 +42,8 @@
 #include <cassert>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cmath>
 #include "containers/include/scenario.h"
 #include "containers/include/world.h"
 #include "util/base/include/util.h"
@@ -81,6 +83,8 @@ TotalPolicyCostCalculator::TotalPolicyCostCalculator( SingleScenarioRunner* aSin
     const Configuration* conf = Configuration::getInstance();
     mGHGName = conf->getString( "AbatedGasForCostCurves", "CO2" );
     mNumPoints = conf->getInt( "numPointsForCO2CostCurve", 5 );
+    mUsePartialRuns = true;
+    mCheckPartialRuns = conf->getBool( "policy-cost-check-partial", false, false );
     
     // A user may have specified more than one gas from which to sum emissions quantities
     // which would be seperated by a ';'.  In such a case the first gas is assumed to be
@@ -188,6 +192,9 @@ bool TotalPolicyCostCalculator::runTrials(){
     for( int currPoint = mNumPoints - 1; currPoint >= 0; currPoint-- ){
         // Determine the fraction of the full tax this tax will be.
         const double fraction = static_cast<double>( currPoint ) / static_cast<double>( mNumPoints );
+        // The first period in which the tax differs between trials, all periods
+        // before it will be the same in every trial.
+        int firstTaxPeriod = maxPeriod;
         // Iterate through the regions to set different taxes for each if necessary.
         // Currently this will set the same for all of them.
         for( CRegionCurvesIterator rIter = mEmissionsTCurves[ mNumPoints ].begin(); rIter != mEmissionsTCurves[ mNumPoints ].end(); ++rIter ){
@@ -200,6 +207,9 @@ bool TotalPolicyCostCalculator::runTrials(){
                 double origTax = rIter->second->getY( year );
                 currTaxes[ per ] = origTax == Marketplace::NO_MARKET_PRICE ? Marketplace::NO_MARKET_PRICE :
                     origTax * fraction;
+                if( origTax != Marketplace::NO_MARKET_PRICE && origTax != 0 ) {
+                    firstTaxPeriod = min( firstTaxPeriod, per );
+                }
             }
             // Set the fixed taxes into the world.
             GHGPolicy tax( mGHGName, rIter->first, currTaxes );
@@ -213,12 +223,34 @@ bool TotalPolicyCostCalculator::runTrials(){
 
         // Run the scenario with the add-on extension to the output file names
         // as the point number. This allows the output file to be named debug +
-        // point number.
-        success &= mSingleScenario->getInternalScenario()->run( Scenario::RUN_ALL_PERIODS, true,
-                                                                util::toString( currPoint ) );
+        // point number.  Only the periods from the first taxed period on need
+        // to be recalculated, the periods before it are assumed not to be
+        // affected by the tax and so are kept as solved in the previous trial.
+        // If no period is taxed every trial is the same as the one already solved.
+        // Note this relies on calculating a period not changing the results of
+        // earlier periods which may be checked with policy-cost-check-partial.
+        Scenario* internalScenario = mSingleScenario->getInternalScenario();
+        if( !mUsePartialRuns ) {
+            success &= internalScenario->run( Scenario::RUN_ALL_PERIODS, true, util::toString( currPoint ) );
+        }
+        else if( firstTaxPeriod < maxPeriod ) {
+            for( int per = firstTaxPeriod; per < maxPeriod; ++per ) {
+                internalScenario->invalidatePeriod( per );
+            }
+            success &= internalScenario->run( maxPeriod - 1, true, util::toString( currPoint ) );
+        }
+        else {
+            mainLog << "No period is taxed, skipping the model run." << endl;
+        }
+        
+        RegionCurves emissionsQCurves = getEmissionsQuantityCurve();
+        // A trial which taxes the first period was a full run anyway.
+        if( mUsePartialRuns && mCheckPartialRuns && firstTaxPeriod > 0 ) {
+            success &= checkPartialRun( emissionsQCurves, currPoint, !usingRestartPeriod );
+        }
 
         // Save information.
-        mEmissionsQCurves[ currPoint ] = getEmissionsQuantityCurve();
+        mEmissionsQCurves[ currPoint ] = emissionsQCurves;
         mEmissionsTCurves[ currPoint ] = mSingleScenario->getInternalScenario()->getEmissionsPriceCurves( mGHGName );
 
         // Restore original solved market prices after each cost iteration to ensure same
@@ -230,6 +262,70 @@ bool TotalPolicyCostCalculator::runTrials(){
     return success;
 }
 
+/*!
+ * \brief Check that a trial which only recalculated the taxed periods matches
+ *        a full run of the same trial.
+ * \details The trial is run again from the first period and the emissions
+ *          quantities, from which the costs are calculated, are compared for
+ *          each region and year.  Both runs are only solved to within the solver
+ *          tolerance so they are only expected to agree to a similar tolerance.
+ *          Any difference is logged and the full run results are kept, further
+ *          trials will then also be full runs.
+ * \param aEmissionsQCurves The emissions quantity curves of the partial run
+ *                          which will be replaced by those of the full run.
+ * \param aPoint The cost curve point of the trial.
+ * \param aRestorePrices Whether to restore the originally solved prices before
+ *                       the full run as is done before each trial.
+ * \return Whether the full run solved successfully.
+ */
+bool TotalPolicyCostCalculator::checkPartialRun( RegionCurves& aEmissionsQCurves, const int aPoint,
+                                                 const bool aRestorePrices )
+{
+    const double CHECK_TOLERANCE = 1e-3;
+    Scenario* internalScenario = mSingleScenario->getInternalScenario();
+    const Modeltime* modeltime = internalScenario->getModeltime();
+    if( aRestorePrices ) {
+        internalScenario->getMarketplace()->restore_prices_for_cost_calculation();
+    }
+    const bool success = internalScenario->run( Scenario::RUN_ALL_PERIODS, true, util::toString( aPoint ) );
+    RegionCurves fullEmissionsQCurves = getEmissionsQuantityCurve();
+    
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    int numMismatched = 0;
+    for( CRegionCurvesIterator rIter = fullEmissionsQCurves.begin(); rIter != fullEmissionsQCurves.end(); ++rIter ){
+        CRegionCurvesIterator partialIter = aEmissionsQCurves.find( rIter->first );
+        for( int per = 0; per < modeltime->getmaxper(); ++per ){
+            const int year = modeltime->getper_to_yr( per );
+            const double fullValue = rIter->second->getY( year );
+            const double partialValue = partialIter == aEmissionsQCurves.end() ? 0 : partialIter->second->getY( year );
+            const double scale = max( fabs( fullValue ), fabs( partialValue ) );
+            if( scale > util::getSmallNumber() && fabs( fullValue - partialValue ) > CHECK_TOLERANCE * scale ) {
+                ++numMismatched;
+                mainLog.setLevel( ILogger::ERROR );
+                mainLog << "Cost curve point " << aPoint << " emissions in " << rIter->first << " in " << year
+                        << " were " << partialValue << " when only the taxed periods were recalculated but "
+                        << fullValue << " in a full run." << endl;
+            }
+        }
+    }
+    
+    mainLog.setLevel( ILogger::NOTICE );
+    if( numMismatched > 0 ) {
+        mainLog << "Recalculating only the taxed periods did not match a full run, the remaining"
+                << " cost curve points will be full runs." << endl;
+        mUsePartialRuns = false;
+    }
+    else {
+        mainLog << "Cost curve point " << aPoint << " matched a full run." << endl;
+    }
+    
+    for( RegionCurvesIterator del = aEmissionsQCurves.begin(); del != aEmissionsQCurves.end(); ++del ){
+        delete del->second;
+    }
+    aEmissionsQCurves = fullEmissionsQCurves;
+    return success;
+}
+
 /*! \brief Create a cost curve for each period and region.
 * \details Using the cost curves generated by the trials, generate and stored a set of cost
 * curves by period and region.
@@ -74,9 +74,13 @@
 #include "containers/include/market_dependency_finder.h"
 #include "technologies/include/global_technology_database.h"
 #include "containers/include/iactivity.h"
+#include "util/base/include/activity_profiler.h"
 
 #if GCAM_PARALLEL_ENABLED
 #include "parallel/include/gcam_parallel.hpp"
+#include "parallel/include/execution_resources.hpp"
+#include "util/base/include/manage_state_variables.hpp"
+#include <tbb/task_arena.h>
 #endif
 
 // Uncommenting the following two lines will turn on floating-point exceptions within World::calc(),
@@ -257,7 +261,7 @@ void World::calc( const int aPeriod, const std::vector<IActivity*>& aItemsToCalc
     
     // Perform calculation on each item to calculate. 
     for( vector<IActivity*>::const_iterator it = aItemsToCalc.begin(); it != aItemsToCalc.end(); ++it ) {
-        (*it)->calc( aPeriod );
+        ActivityProfiler::calc( *it, aPeriod );
     }
 #ifdef GNU_SOURCE
     feenableexcept(except);
@@ -291,9 +295,42 @@ void World::calc( const int aPeriod, GcamFlowGraph *aWorkGraph, const vector<IAc
         aWorkGraph = mTBBGraphGlobal;
     }
 
-    // do the model calculation
-    aWorkGraph->mHead.try_put( tbb::flow::continue_msg() );
-    aWorkGraph->mTBBFlowGraph.wait_for_all();
+    if( aWorkGraph->mIsPartialGraph ) {
+        // Partial graphs are run from within a partial derivative calculation
+        // which has its own state slot.  All threads which help with this graph
+        // must calculate in that same slot.
+        ManageStateVariables* stateVars = scenario->getManageStateVariables();
+        if( aWorkGraph->mThreadPoolID != stateVars->mThreadPoolID ) {
+            // The graph was last run in a different thread pool, resetting it
+            // will bind its tasks to the thread pool we are currently in.
+            aWorkGraph->mTBBFlowGraph.reset();
+            aWorkGraph->mThreadPoolID = stateVars->mThreadPoolID;
+        }
+        aWorkGraph->mStateSlot = ManageStateVariables::getThreadState();
+        // Isolate the graph calculation so that this thread does not pick up
+        // some other partial derivative while it waits, which would overwrite
+        // the state it is using.
+        tbb::this_task_arena::isolate( [aWorkGraph] {
+            aWorkGraph->mHead.try_put( tbb::flow::continue_msg() );
+            aWorkGraph->mTBBFlowGraph.wait_for_all();
+        } );
+    }
+    else {
+        ExecutionResources::getInstance().execute( ExecutionResources::WORLD_CALC, [aWorkGraph, aPeriod] {
+            if( aWorkGraph->mThreadPoolID != ExecutionResources::WORLD_CALC ) {
+                // bind the graph's tasks to the world calc arena
+                aWorkGraph->mTBBFlowGraph.reset();
+                aWorkGraph->mThreadPoolID = ExecutionResources::WORLD_CALC;
+            }
+            // time the vertices in the first few evaluations of a period so that
+            // we can prioritize the critical path
+            GcamParallel::beginCostSample( *aWorkGraph, aPeriod );
+            // do the model calculation
+            aWorkGraph->mHead.try_put( tbb::flow::continue_msg() );
+            aWorkGraph->mTBBFlowGraph.wait_for_all();
+            GcamParallel::endCostSample( *aWorkGraph );
+        } );
+    }
 
 #ifdef GNU_SOURCE
     feenableexcept(except);
@@ -74,6 +74,9 @@
 #include "util/base/include/timer.h"
 #include "util/base/include/version.h"
 #include "util/base/include/util.h"
+#if GCAM_PARALLEL_ENABLED
+#include "parallel/include/parallel_check.hpp"
+#endif
 
 using namespace std;
 
@@ -85,7 +88,8 @@ ofstream outFile;
 // Declared outside Main to make global.
 Scenario* scenario; // model scenario info
 
-void parseArgs( unsigned int argc, char* argv[], string& confArg, string& logFacArg );
+void parseArgs( unsigned int argc, char* argv[], string& confArg, string& logFacArg,
+                bool& parallelCheckArg, string& parallelCheckYearsArg );
 void printUsageMessage( unsigned int argc, char* argv[] );
 
 //! Main program. 
@@ -94,8 +98,10 @@ int main( int argc, char *argv[] ) {
     // identify default file names for control input and logging controls
     string configurationArg = "configuration.xml";
     string loggerFactoryArg = "log_conf.xml";
+    bool parallelCheckArg = false;
+    string parallelCheckYearsArg;
     // Parse any command line arguments.  Can override defaults with command lone args
-    parseArgs( argc, argv, configurationArg, loggerFactoryArg );
+    parseArgs( argc, argv, configurationArg, loggerFactoryArg, parallelCheckArg, parallelCheckYearsArg );
 
     // Add OS dependent prefixes to the arguments.
     const string configurationFileName = configurationArg;
@@ -165,6 +171,17 @@ int main( int argc, char *argv[] ) {
     if( !success ){
         return 1;
     }
+    
+    // The command line switch to check the parallel calculations overrides
+    // the configuration.
+    if( parallelCheckArg ) {
+#if GCAM_PARALLEL_ENABLED
+        ParallelCheck::getInstance().enable( parallelCheckYearsArg );
+#else
+        mainLog.setLevel( ILogger::WARNING );
+        mainLog << "Ignoring --parallel-check since GCAM was built without parallel support." << endl;
+#endif
+    }
 
     // Create an empty exclusion list so that any type of IScenarioRunner can be
     // created.
@@ -211,9 +228,13 @@ int main( int argc, char *argv[] ) {
 * \param argv List of arguments.
 * \param confArg [out] Name of the configuration file.
 * \param logFacArg [out] Name of the log configuration file.
+* \param parallelCheckArg [out] Whether to check parallel calculations against serial ones.
+* \param parallelCheckYearsArg [out] The model years to check, empty for the configured years.
 * \todo Allow a space between the flags and the file names.
 */
-void parseArgs( unsigned int argc, char* argv[], string& confArg, string& logFacArg ) {
+void parseArgs( unsigned int argc, char* argv[], string& confArg, string& logFacArg,
+                bool& parallelCheckArg, string& parallelCheckYearsArg )
+{
     for( unsigned int i = 1; i < argc; ){
         string temp( argv[ i ] );
         if( temp == "-C" ) {
@@ -242,6 +263,15 @@ void parseArgs( unsigned int argc, char* argv[], string& confArg, string& logFac
             logFacArg = temp.substr( 2, temp.length() );
             ++i;
         }
+        else if( temp == "--parallel-check" ) {
+            parallelCheckArg = true;
+            ++i;
+        }
+        else if( temp.compare( 0, 17, "--parallel-check=" ) == 0 ) {
+            parallelCheckArg = true;
+            parallelCheckYearsArg = temp.substr( 17, temp.length() );
+            ++i;
+        }
         else if( temp == "--version" ) {
             cout << "GCAM version " << __ObjECTS_VER__ << " Revision: " << __REVISION_NUMBER__ << endl;
             exit( 0 );
@@ -264,7 +294,8 @@ void parseArgs( unsigned int argc, char* argv[], string& confArg, string& logFac
  * \param argv List of arguments.
  */
 void printUsageMessage( unsigned int argc, char* argv[] ) {
-    cout << "Usage: " << argv[ 0 ] << " [-CconfigurationFileName ][ -LloggerFactoryFileName ]" << endl;
+    cout << "Usage: " << argv[ 0 ] << " [-CconfigurationFileName ][ -LloggerFactoryFileName ]"
+         << "[ --parallel-check[=year1,year2,...] ]" << endl;
     cout << "OR" << endl;
     cout << "Usage: " << argv[ 0 ] << " --version" << endl;
     cout << "OR" << endl;
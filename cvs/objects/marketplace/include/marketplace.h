@@ -137,8 +137,8 @@ class Marketplace: public IVisitable, private boost::noncopyable
     friend class SolverLibrary;
     friend class MarketDependencyFinder;
     friend class LogEDFun;
-#if DEBUG_STATE
     friend class ManageStateVariables;
+#if DEBUG_STATE
     friend class Value;
 #endif
 public:
@@ -225,6 +225,11 @@ protected:
     
     //! Flag indicating whether the next call to world->calc() will be part of a partial derivative calculation 
     static bool mIsDerivativeCalc;
+    
+    //! Flag indicating whether the activities of a single partial derivative calculation
+    //! may be run by several threads at once and must therefore lock markets as they
+    //! update them.
+    static bool mIsParallelDerivativeCalc;
 };
 
 #endif
@@ -352,7 +352,7 @@ void Market::nullDemand() {
 */
 void Market::addToDemand( const double demandIn ) {
 #if GCAM_PARALLEL_ENABLED
-    if( !Marketplace::mIsDerivativeCalc ) {
+    if( !Marketplace::mIsDerivativeCalc || Marketplace::mIsParallelDerivativeCalc ) {
         Mutex::scoped_lock writeLock( mDemandMutex );
         kahanSum(mDemand, mDemandCorrection, demandIn);
     }
@@ -441,7 +441,7 @@ double Market::getSupply() const {
 */
 void Market::addToSupply( const double supplyIn ) {
 #if GCAM_PARALLEL_ENABLED
-    if( !Marketplace::mIsDerivativeCalc ) {
+    if( !Marketplace::mIsDerivativeCalc || Marketplace::mIsParallelDerivativeCalc ) {
         Mutex::scoped_lock writeLock( mSupplyMutex );
         kahanSum(mSupply, mSupplyCorrection, supplyIn);
     }
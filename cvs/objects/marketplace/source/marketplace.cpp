@@ -45,6 +45,7 @@
 
 #if GCAM_PARALLEL_ENABLED
 #include <tbb/parallel_for.h>
+#include "parallel/include/execution_resources.hpp"
 #endif
 
 #include "marketplace/include/marketplace.h"
@@ -70,6 +71,7 @@ using namespace std;
 extern Scenario* scenario;
 const double Marketplace::NO_MARKET_PRICE = util::getLargeNumber();
 bool Marketplace::mIsDerivativeCalc = false;
+bool Marketplace::mIsParallelDerivativeCalc = false;
 
 /*! \brief Default constructor 
 *
@@ -427,11 +429,13 @@ void Marketplace::unsetMarketToSolve ( const string& goodName, const string& reg
 */
 void Marketplace::nullSuppliesAndDemands( const int period ) {
 #if GCAM_PARALLEL_ENABLED
-    tbb::parallel_for( tbb::blocked_range<int>( 0, mMarkets.size() ), [this, period]( const tbb::blocked_range<int>& aRange) {
-        for( int marketIndex = aRange.begin(); marketIndex != aRange.end(); ++marketIndex ) {
-            this->mMarkets[ marketIndex ]->getMarket( period )->nullDemand();
-            this->mMarkets[ marketIndex ]->getMarket( period )->nullSupply();
-        }
+    ExecutionResources::getInstance().execute( ExecutionResources::MARKETPLACE, [this, period] {
+        tbb::parallel_for( tbb::blocked_range<int>( 0, mMarkets.size() ), [this, period]( const tbb::blocked_range<int>& aRange) {
+            for( int marketIndex = aRange.begin(); marketIndex != aRange.end(); ++marketIndex ) {
+                this->mMarkets[ marketIndex ]->getMarket( period )->nullDemand();
+                this->mMarkets[ marketIndex ]->getMarket( period )->nullSupply();
+            }
+        });
     });
 #else
     for ( unsigned int i = 0; i < mMarkets.size(); i++ ) {
@@ -918,7 +922,9 @@ std::vector<double> Marketplace::fullstate( int period ) const
 
 //! Check the input vector (previously returned from fullstate)
 //! against the current market state. 
-//! \details Errors will be logged to the ostream, if it is provided.
+//! \details Errors will be logged to the ostream, if it is provided,
+//! once for each market that has a discrepancy along with the distance
+//! in ulp of each of its price, demand, and supply.
 //! tol indicates how loose the comparison should be.  The default is
 //! 0ulp, meaning that all values should be bitwise identical.  This
 //! is appropriate when testing whether a "restore" operation restores
@@ -928,19 +934,20 @@ bool Marketplace::checkstate(int period, const std::vector<double> &ostate, std:
 {
   bool ok = true;
   std::vector<double> cstate(fullstate( period ));
-  for(unsigned i=0; i<ostate.size(); ++i) {
-      if(!dblcmp(ostate[i],cstate[i], tol)) {
+  // the state is in strides of 3: price, demand, and supply for each market
+  for(unsigned j=0; j+2<ostate.size(); j+=3) {
+    if(!dblcmp(ostate[j],cstate[j], tol) || !dblcmp(ostate[j+1],cstate[j+1], tol) ||
+       !dblcmp(ostate[j+2],cstate[j+2], tol))
+    {
       ok = false;
       if( log ) {
-        int imkt = i/3;
-        int j = imkt*3;         // index of price for this market
-                                // (irrespective of whether it was p,
-                                // s, or d that triggered the
-                                // discrepancy)
-        (*log) << "Market discrepancy: " << mMarkets[imkt]->getName()
-               << "\nPrice:  " << ostate[j] << "\t" << cstate[j];
-        (*log) << "\nDemand: " << ostate[j+1] << "\t" << cstate[j+1];
-        (*log) << "\nSupply: " << ostate[j+2] << "\t" << cstate[j+2] << "\n";
+        (*log) << "Market discrepancy: " << mMarkets[j/3]->getName()
+               << "\nPrice:  " << ostate[j] << "\t" << cstate[j]
+               << "\t" << dblulpdist(ostate[j],cstate[j]) << " ulp";
+        (*log) << "\nDemand: " << ostate[j+1] << "\t" << cstate[j+1]
+               << "\t" << dblulpdist(ostate[j+1],cstate[j+1]) << " ulp";
+        (*log) << "\nSupply: " << ostate[j+2] << "\t" << cstate[j+2]
+               << "\t" << dblulpdist(ostate[j+2],cstate[j+2]) << " ulp\n";
       }
     }
   }
@@ -0,0 +1,136 @@
+#ifndef _EXECUTION_RESOURCES_HPP_
+#define _EXECUTION_RESOURCES_HPP_
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "util/base/include/definitions.h"
+
+#if GCAM_PARALLEL_ENABLED
+
+/*
+* LEGAL NOTICE
+* This computer software was prepared by Battelle Memorial Institute,
+* hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+* with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+* CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+* LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+* sentence must appear on any copies of this computer software.
+* 
+* EXPORT CONTROL
+* User agrees that the Software will not be shipped, transferred or
+* exported into any country or used in any manner prohibited by the
+* United States Export Administration Act or any other applicable
+* export laws, restrictions or regulations (collectively the "Export Laws").
+* Export of the Software may require some form of license or other
+* authority from the U.S. Government, and failure to obtain such
+* export control license may result in criminal liability under
+* U.S. laws. In addition, if the Software is identified as export controlled
+* items under the Export Laws, User represents and warrants that User
+* is not a citizen, or otherwise located within, an embargoed nation
+* (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+*     and that User is not otherwise prohibited
+* under the Export Laws from receiving the Software.
+* 
+* Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+* Distributed as open-source under the terms of the Educational Community 
+* License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+* 
+* For further details, see: http://www.globalchange.umd.edu/models/gcam/
+*
+*/
+
+/*!
+ * \file execution_resources.hpp
+ * \ingroup Objects
+ * \brief ExecutionResources class header file.
+ */
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <boost/core/noncopyable.hpp>
+
+#include <tbb/task_arena.h>
+#include <tbb/global_control.h>
+
+class CorePinningObserver;
+
+/*!
+ * \brief The single owner of the threads GCAM uses for parallel calculations.
+ * \details Each phase of the model which runs in parallel executes in a named
+ *          task arena owned by this class rather than creating its own arena
+ *          or using the implicit global one.  All arenas draw from the one TBB
+ *          thread pool limited by "max-parallelism" so phases which are nested,
+ *          such as a world calc flow graph within a Jacobian column, neither
+ *          oversubscribe nor leave threads reserved and idle.  The following
+ *          may be set in the Ints section of the configuration:
+ *            - max-parallelism: The total number of threads, -1 to use all cores.
+ *            - parallelism-jacobian, parallelism-world-calc, parallelism-marketplace:
+ *              The maximum number of threads to use in that phase, -1 to use
+ *              max-parallelism.
+ *            - numa-node: Restrict all arenas to the cores of this NUMA node,
+ *              -1 to not restrict.
+ *            - pin-threads-first-core: Pin each thread to its own core starting
+ *              at this core index and continuing for max-parallelism cores, -1
+ *              to let the OS schedule threads.  Giving two GCAM instances on the
+ *              same node disjoint core ranges keeps them from contending.
+ *
+ *          The instance is created the first time it is requested and lives for
+ *          the remainder of the run since arenas are expensive to recreate.
+ */
+class ExecutionResources : private boost::noncopyable {
+public:
+    //! The phases of the model calculation which run in their own arena.
+    enum Phase {
+        //! The column level parallelism in fdjac including any partial flow graphs.
+        JACOBIAN,
+        
+        //! The global flow graph for a full World::calc.
+        WORLD_CALC,
+        
+        //! Loops over all markets in the Marketplace.
+        MARKETPLACE,
+        
+        //! Marker for the number of phases, not a valid phase.
+        END
+    };
+    
+    static ExecutionResources& getInstance();
+    
+    ~ExecutionResources();
+    
+    tbb::task_arena& getArena( const Phase aPhase );
+    
+    int getMaxParallelism() const;
+    
+    /*!
+     * \brief Run the given function in the arena for the given phase and wait
+     *        for it to complete.
+     * \param aPhase The phase the work belongs to.
+     * \param aFunction The function to run.
+     */
+    template<typename FunctionType>
+    void execute( const Phase aPhase, const FunctionType& aFunction ) {
+        getArena( aPhase ).execute( aFunction );
+    }
+    
+    static std::string getPhaseName( const Phase aPhase );
+    
+private:
+    ExecutionResources();
+    
+    //! Limits the total number of threads in the TBB thread pool.
+    std::unique_ptr<tbb::global_control> mParallelismConfig;
+    
+    //! The arena for each Phase.
+    std::vector<std::unique_ptr<tbb::task_arena> > mArenas;
+    
+    //! Observers which pin threads to cores as they enter each arena, empty if
+    //! pinning is disabled.
+    std::vector<std::unique_ptr<CorePinningObserver> > mPinningObservers;
+};
+
+#endif // GCAM_PARALLEL_ENABLED
+
+#endif // _EXECUTION_RESOURCES_HPP_
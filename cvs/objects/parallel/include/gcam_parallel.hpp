@@ -39,10 +39,10 @@
 
 #include <vector>
 #include <set>
+#include <iosfwd>
 
 /* TBB headers */
 #include <tbb/flow_graph.h>
-#include <tbb/global_control.h>
 
 // Forward declare when possible
 class IActivity;
@@ -70,8 +70,38 @@ private:
     //! need to keep track of it explicitly
     std::vector<tbb::flow::continue_node<tbb::flow::continue_msg>*> mTBBVertices;
     
-    static tbb::global_control* mParallelismConfig;
-
+    //! Flag indicating this graph only contains the activities affected by
+    //! a single market and will be run as part of a partial derivative calculation.
+    bool mIsPartialGraph;
+    
+    //! The state slot a partial graph must calculate in.  All of the threads
+    //! which pick up vertices from this graph will share the slot of the thread
+    //! which started the calculation.
+    double* mStateSlot;
+    
+    //! The ID of the thread pool the tasks of this graph are currently bound
+    //! to.  A graph is bound to the arena it was last reset in so we need to
+    //! know when to rebind it to the arena it should run in.
+    int mThreadPoolID;
+    
+    //! The activities in each vertex of the global graph in calculation order.
+    //! Note this is empty for partial graphs.
+    std::vector<std::vector<IActivity*> > mGrains;
+    
+    //! For each vertex of the global graph, the vertices which depend on it.
+    std::vector<std::vector<int> > mGrainOutEdges;
+    
+    //! The time spent calculating each vertex summed over the evaluations
+    //! sampled for the cost model.
+    std::vector<double> mGrainCalcTime;
+    
+    //! The number of evaluations which still need to be timed before the
+    //! vertices can be prioritized.
+    int mNumEvalsToSample;
+    
+    //! The model period the cost model was last sampled in.
+    int mCostModelPeriod;
+    
 public:
     
     ~GcamFlowGraph();
@@ -87,6 +117,28 @@ public:
     static void makeTBBFlowGraph( const MarketDependencyFinder& aDependencyFinder,
                                   GcamFlowGraph& aTBBGraph,
                                   const std::vector<IActivity*>& aPartialCalcList );
+    
+    static int transitiveReduction( std::vector<std::vector<int> >& aOutEdges );
+    
+    static void coarsenFlowGraph( const std::vector<IActivity*>& aOrdering,
+                                  const std::vector<std::vector<int> >& aOutEdges,
+                                  const int aGrainSize,
+                                  std::vector<std::vector<int> >& aGrains );
+
+    static void beginCostSample( GcamFlowGraph& aTBBGraph, const int aPeriod );
+    
+    static void endCostSample( GcamFlowGraph& aTBBGraph );
+
+private:
+    static void buildTBBVertices( GcamFlowGraph& aTBBGraph,
+                                  const std::vector<unsigned int>& aPriorities );
+    
+    static void prioritizeCriticalPath( GcamFlowGraph& aTBBGraph );
+    
+    static void printFlowGraph( std::ostream& aOut,
+                                const std::vector<IActivity*>& aOrdering,
+                                const std::vector<std::vector<int> >& aGrains,
+                                const std::vector<std::set<int> >& aGrainOutEdges );
 };
 
   
@@ -0,0 +1,178 @@
+#ifndef _PARALLEL_CHECK_HPP_
+#define _PARALLEL_CHECK_HPP_
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "util/base/include/definitions.h"
+
+#if GCAM_PARALLEL_ENABLED
+
+/*
+* LEGAL NOTICE
+* This computer software was prepared by Battelle Memorial Institute,
+* hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+* with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+* CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+* LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+* sentence must appear on any copies of this computer software.
+* 
+* EXPORT CONTROL
+* User agrees that the Software will not be shipped, transferred or
+* exported into any country or used in any manner prohibited by the
+* United States Export Administration Act or any other applicable
+* export laws, restrictions or regulations (collectively the "Export Laws").
+* Export of the Software may require some form of license or other
+* authority from the U.S. Government, and failure to obtain such
+* export control license may result in criminal liability under
+* U.S. laws. In addition, if the Software is identified as export controlled
+* items under the Export Laws, User represents and warrants that User
+* is not a citizen, or otherwise located within, an embargoed nation
+* (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+*     and that User is not otherwise prohibited
+* under the Export Laws from receiving the Software.
+* 
+* Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+* Distributed as open-source under the terms of the Educational Community 
+* License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+* 
+* For further details, see: http://www.globalchange.umd.edu/models/gcam/
+*
+*/
+
+/*!
+ * \file parallel_check.hpp
+ * \ingroup Objects
+ * \brief ParallelCheck class header file.
+ */
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <boost/core/noncopyable.hpp>
+
+#include "solution/util/include/ublas-helpers.hpp"
+
+class World;
+class Marketplace;
+
+/*!
+ * \brief Checks that the parallel calculations reproduce the serial ones and
+ *        measures the speedup they achieve.
+ * \details When enabled, for each checked period the initial World::calc is
+ *          run both serially and with the global flow graph and the resulting
+ *          market prices, supplies, and demands are compared.  The first few
+ *          Jacobians of the period also have their partial derivative columns
+ *          recalculated serially, one column at a time, and compared to the
+ *          ones calculated in parallel which may have been grouped by their
+ *          Jacobian structure.  Every delta state copy made for a partial
+ *          derivative is verified against the full copy as well.  Any
+ *          mismatches are logged to the main log along with their distance in
+ *          ulp and a summary of the speedups is written at the end of the run
+ *          so that a new thread count or grain size can be vetted before it is
+ *          used in production.
+ *
+ *          The check may be turned on with the --parallel-check command line
+ *          switch or with the following configuration options:
+ *            - Bools parallel-check: Whether to enable the check.
+ *            - Strings parallel-check-years: A comma separated list of model
+ *              years to check, empty to check all periods.
+ *            - Ints parallel-check-repeats: The number of times to repeat each
+ *              world calc when timing it, the fastest is reported.
+ *            - Ints parallel-check-jacobians: The number of Jacobians to check
+ *              in each checked period.
+ *            - Ints parallel-check-ulp: The number of ulp by which a serial and
+ *              parallel value may differ and still be considered a match.
+ *
+ *          Note that checked periods calculate the model several extra times
+ *          and so the run will be significantly slower.
+ */
+class ParallelCheck : private boost::noncopyable {
+public:
+    static ParallelCheck& getInstance();
+    
+    void enable( const std::string& aYears );
+    
+    bool beginPeriod( const int aPeriod );
+    
+    bool isCheckingPeriod() const;
+    
+    void checkWorldCalc( World* aWorld, Marketplace* aMarketplace, const int aPeriod );
+    
+    bool shouldCheckJacobian();
+    
+    void checkJacobian( const UBMATRIX& aParallelJ, const UBMATRIX& aSerialJ,
+                        const std::list<int>& aCols, const double aParallelTime,
+                        const double aSerialTime );
+    
+    void writeSummary() const;
+    
+private:
+    ParallelCheck();
+    
+    void parseYears( const std::string& aYears );
+    
+    //! The results of checking a single period.
+    struct PeriodResult {
+        PeriodResult();
+        
+        //! The fastest time for a serial world calc in seconds.
+        double mSerialTime;
+        
+        //! The fastest time for a parallel world calc in seconds.
+        double mParallelTime;
+        
+        //! The number of markets which did not match.
+        int mNumMismatchedMarkets;
+        
+        //! The largest distance in ulp between a serial and parallel market value.
+        int64_t mMaxMarketULP;
+        
+        //! The number of Jacobians checked.
+        int mNumJacobians;
+        
+        //! The number of partial derivative columns checked.
+        int mNumColumns;
+        
+        //! The number of Jacobian entries which did not match.
+        int mNumMismatchedEntries;
+        
+        //! The largest distance in ulp between a serial and parallel Jacobian entry.
+        int64_t mMaxJacobianULP;
+        
+        //! The total time spent calculating the checked Jacobians serially.
+        double mJacobianSerialTime;
+        
+        //! The total time spent calculating the checked Jacobians in parallel.
+        double mJacobianParallelTime;
+    };
+    
+    //! Whether the check is enabled at all.
+    bool mIsEnabled;
+    
+    //! The model years to check, if empty all periods are checked.
+    std::set<int> mYears;
+    
+    //! The number of times to repeat a world calc to time it.
+    int mNumRepeats;
+    
+    //! The number of Jacobians to check per period.
+    int mNumJacobiansPerPeriod;
+    
+    //! The tolerance in ulp for two values to be considered equal.
+    int64_t mTolerance;
+    
+    //! The period currently being checked, -1 if the current period is not checked.
+    int mCurrentPeriod;
+    
+    //! The number of Jacobians which remain to be checked in mCurrentPeriod.
+    int mNumJacobiansRemaining;
+    
+    //! The results of each period checked so far.
+    std::map<int, PeriodResult> mResults;
+};
+
+#endif // GCAM_PARALLEL_ENABLED
+
+#endif // _PARALLEL_CHECK_HPP_
@@ -0,0 +1,225 @@
+/*
+* LEGAL NOTICE
+* This computer software was prepared by Battelle Memorial Institute,
+* hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+* with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+* CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+* LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+* sentence must appear on any copies of this computer software.
+* 
+* EXPORT CONTROL
+* User agrees that the Software will not be shipped, transferred or
+* exported into any country or used in any manner prohibited by the
+* United States Export Administration Act or any other applicable
+* export laws, restrictions or regulations (collectively the "Export Laws").
+* Export of the Software may require some form of license or other
+* authority from the U.S. Government, and failure to obtain such
+* export control license may result in criminal liability under
+* U.S. laws. In addition, if the Software is identified as export controlled
+* items under the Export Laws, User represents and warrants that User
+* is not a citizen, or otherwise located within, an embargoed nation
+* (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+*     and that User is not otherwise prohibited
+* under the Export Laws from receiving the Software.
+* 
+* Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+* Distributed as open-source under the terms of the Educational Community 
+* License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+* 
+* For further details, see: http://www.globalchange.umd.edu/models/gcam/
+*
+*/
+
+/*!
+ * \file execution_resources.cpp
+ * \ingroup Objects
+ * \brief ExecutionResources class source file.
+ */
+
+#include "util/base/include/definitions.h"
+
+#if GCAM_PARALLEL_ENABLED
+
+#include <cassert>
+#include <atomic>
+#include <algorithm>
+#include <tbb/info.h>
+#include <tbb/task_scheduler_observer.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "parallel/include/execution_resources.hpp"
+#include "util/base/include/configuration.h"
+#include "util/logger/include/ilogger.h"
+
+using namespace std;
+
+/*!
+ * \brief Pins each thread that enters an arena to its own core.
+ * \details A thread is assigned the next core in the range the first time it
+ *          enters any observed arena and keeps that core for the rest of the run
+ *          so that it stays close to the memory it has touched.
+ */
+class CorePinningObserver : public tbb::task_scheduler_observer {
+public:
+    CorePinningObserver( tbb::task_arena& aArena, const int aFirstCore, const int aNumCores )
+    :tbb::task_scheduler_observer( aArena ), mFirstCore( aFirstCore ), mNumCores( aNumCores )
+    {
+        observe( true );
+    }
+    
+    virtual ~CorePinningObserver() {
+        observe( false );
+    }
+    
+    virtual void on_scheduler_entry( bool ) {
+        thread_local bool isPinned = false;
+        if( isPinned ) {
+            return;
+        }
+        isPinned = true;
+        const int core = mFirstCore + ( sNextCore++ % mNumCores );
+#if defined(__linux__)
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        CPU_SET( core, &cpuSet );
+        if( pthread_setaffinity_np( pthread_self(), sizeof( cpu_set_t ), &cpuSet ) != 0 ) {
+            ILogger& mainLog = ILogger::getLogger( "main_log" );
+            mainLog.setLevel( ILogger::WARNING );
+            mainLog << "Failed to pin a thread to core " << core << endl;
+        }
+#endif
+    }
+    
+private:
+    //! The first core in the range threads may be pinned to.
+    const int mFirstCore;
+    
+    //! The number of cores in the range threads may be pinned to.
+    const int mNumCores;
+    
+    //! The offset of the next core to assign which is shared by all observers
+    //! so that a thread is never pinned to the same core as another.
+    static atomic<int> sNextCore;
+};
+
+atomic<int> CorePinningObserver::sNextCore( 0 );
+
+/*!
+ * \brief Get the singleton instance of the ExecutionResources.
+ * \details The first call will read the configuration and create all of the
+ *          arenas so it must not happen before the Configuration is parsed.
+ * \return The ExecutionResources.
+ */
+ExecutionResources& ExecutionResources::getInstance() {
+    static ExecutionResources EXECUTION_RESOURCES;
+    return EXECUTION_RESOURCES;
+}
+
+/*!
+ * \brief Constructor which sets up the thread pool and arenas from the configuration.
+ */
+ExecutionResources::ExecutionResources() {
+    const Configuration* conf = Configuration::getInstance();
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    
+    // find the NUMA node to restrict to if any, note this is only available if
+    // TBB was able to load its hwloc based tbbbind library
+    const int numaNode = conf->getInt( "numa-node", -1, false );
+    tbb::numa_node_id numaID = tbb::task_arena::automatic;
+    if( numaNode >= 0 ) {
+        const vector<tbb::numa_node_id> numaNodes = tbb::info::numa_nodes();
+        if( numaNode < static_cast<int>( numaNodes.size() ) && numaNodes[ numaNode ] >= 0 ) {
+            numaID = numaNodes[ numaNode ];
+        }
+        else {
+            mainLog.setLevel( ILogger::WARNING );
+            mainLog << "NUMA node " << numaNode << " is not available, " << numaNodes.size()
+                    << " detected.  Arenas will not be restricted to a NUMA node." << endl;
+        }
+    }
+    
+    int maxParallelism = conf->getInt( "max-parallelism", -1 );
+    if( maxParallelism <= 0 ) {
+        maxParallelism = tbb::info::default_concurrency( numaID );
+    }
+    mParallelismConfig.reset( new tbb::global_control( tbb::global_control::max_allowed_parallelism, maxParallelism ) );
+    
+    const int firstCore = conf->getInt( "pin-threads-first-core", -1, false );
+    
+    mainLog.setLevel( ILogger::NOTICE );
+    mainLog << "Using up to " << maxParallelism << " threads";
+    if( numaID != tbb::task_arena::automatic ) {
+        mainLog << " on NUMA node " << numaNode;
+    }
+    if( firstCore >= 0 ) {
+        mainLog << " pinned to cores " << firstCore << " - " << ( firstCore + maxParallelism - 1 );
+    }
+    mainLog << endl;
+    
+    for( int phase = 0; phase < END; ++phase ) {
+        const string phaseName = getPhaseName( static_cast<Phase>( phase ) );
+        int concurrency = conf->getInt( "parallelism-" + phaseName, -1, false );
+        if( concurrency <= 0 || concurrency > maxParallelism ) {
+            concurrency = maxParallelism;
+        }
+        tbb::task_arena::constraints arenaConstraints( numaID, concurrency );
+        mArenas.emplace_back( new tbb::task_arena( arenaConstraints ) );
+        mArenas.back()->initialize();
+        if( firstCore >= 0 ) {
+            mPinningObservers.emplace_back( new CorePinningObserver( *mArenas.back(), firstCore, maxParallelism ) );
+        }
+        mainLog << "  " << phaseName << ": " << concurrency << " threads" << endl;
+    }
+}
+
+//! Destructor
+ExecutionResources::~ExecutionResources() {
+    // stop observing before the arenas go away
+    mPinningObservers.clear();
+    mArenas.clear();
+}
+
+/*!
+ * \brief Get the task arena all parallel work for the given phase must run in.
+ * \param aPhase The phase to get the arena for.
+ * \return The arena for that phase.
+ */
+tbb::task_arena& ExecutionResources::getArena( const Phase aPhase ) {
+    /*!
+     * \pre aPhase is a valid Phase.
+     */
+    assert( aPhase < END );
+    
+    return *mArenas[ aPhase ];
+}
+
+/*!
+ * \brief Get the total number of threads which may be used across all phases.
+ * \return The maximum parallelism.
+ */
+int ExecutionResources::getMaxParallelism() const {
+    return tbb::global_control::active_value( tbb::global_control::max_allowed_parallelism );
+}
+
+/*!
+ * \brief Get the name of a phase which is used to configure it.
+ * \param aPhase The phase to get the name of.
+ * \return The name of the phase.
+ */
+string ExecutionResources::getPhaseName( const Phase aPhase ) {
+    switch( aPhase ) {
+        case JACOBIAN:
+            return "jacobian";
+        case WORLD_CALC:
+            return "world-calc";
+        case MARKETPLACE:
+            return "marketplace";
+        default:
+            return "unknown";
+    }
+}
+
+#endif // GCAM_PARALLEL_ENABLED
@@ -36,7 +36,11 @@
 #include <cassert>
 #include <vector>
 #include <list>
-#include <Eigen/SparseCore>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <memory>
+#include <tbb/tick_count.h>
 /* gcam headers */
 #include "parallel/include/gcam_parallel.hpp"
 #include "util/base/include/configuration.h"
@@ -46,7 +50,11 @@
 #include "util/logger/include/ilogger.h"
 #include "util/base/include/timer.h"
 #include "util/base/include/auto_file.h"
+#include "util/base/include/manage_state_variables.hpp"
+#include "util/base/include/activity_profiler.h"
+#include "parallel/include/execution_resources.hpp"
 /* more graph analysis headers */
+#include "parallel/include/bitvector.hpp"
 #include "parallel/include/clanid.hpp"
 #include "parallel/include/graph-parse.hpp"
 #include "parallel/include/grain-collect.hpp"
@@ -55,25 +63,20 @@
 using namespace std;
 
 int GcamFlowGraph::mPeriod = 0;
-tbb::global_control* GcamFlowGraph::mParallelismConfig = 0;
 
 /*
  * \brief Default constructor.
- * \details We lookup the "max-parallelism", aka number of cores to use, from the
- *          configuration so we can initialize TBB with it.
+ * \details Ensures the ExecutionResources have been set up so that TBB is limited
+ *          to the configured "max-parallelism" before any graph is run.
  */
-GcamFlowGraph::GcamFlowGraph() : mTBBFlowGraph(), mHead( mTBBFlowGraph )
+GcamFlowGraph::GcamFlowGraph() : mTBBFlowGraph(), mHead( mTBBFlowGraph ), mIsPartialGraph( false ),
+mStateSlot( 0 ), mThreadPoolID( -1 ), mNumEvalsToSample( 0 ), mCostModelPeriod( -1 )
 {
-    const int maxParallelism = Configuration::getInstance()->getInt( "max-parallelism", -1 );
-    if( maxParallelism > 0 && !mParallelismConfig ) {
-        mParallelismConfig = new tbb::global_control( tbb::global_control::max_allowed_parallelism, maxParallelism );
-    }
+    ExecutionResources::getInstance();
 }
 
 //! Destrcutor
 GcamFlowGraph::~GcamFlowGraph() {
-    delete mParallelismConfig;
-    mParallelismConfig = 0;
     for(auto vert : mTBBVertices) {
         delete vert;
     }
@@ -104,82 +107,512 @@ GcamFlowGraph::~GcamFlowGraph() {
 void GcamParallel::makeTBBFlowGraph( const MarketDependencyFinder& aDependencyFinder,
                                      GcamFlowGraph& aTBBGraph )
 {
-    using tbb::flow::continue_node;
-    using tbb::flow::continue_msg;
-    
-    tbb::flow::graph& tbbFlowGraph = aTBBGraph.mTBBFlowGraph;
-    tbb::flow::broadcast_node<tbb::flow::continue_msg>& head = aTBBGraph.mHead;
-    
     ILogger& pgLog = ILogger::getLogger( "parallel-grain-log" );
     pgLog.setLevel( ILogger::DEBUG );
     
-    // first read the information out of the dependency finder into an
-    // adjacency matrix for easy as we are going to have to take multiple
-    // passes to create the TBB structures required
+    // first read the information out of the dependency finder into adjacency
+    // lists as we are going to have to take multiple passes to create the TBB
+    // structures required.  Activities are indexed by their position in the
+    // global ordering which is a valid topological order for the graph.
     vector<IActivity*> globalOrdering = aDependencyFinder.getOrdering();
-    vector<MarketDependencyFinder::CalcVertex*> calcVertexList( globalOrdering.size(), 0 );
-    vector<bool> isSourceNode( globalOrdering.size(), true );
-    using TripletType = Eigen::Triplet<bool>;
-    list<TripletType> adjTriplets;
-    
+    map<IActivity*, int> orderIndex;
+    for( size_t i = 0; i < globalOrdering.size(); ++i ) {
+        orderIndex[ globalOrdering[ i ] ] = i;
+    }
+    vector<vector<int> > outEdges( globalOrdering.size() );
     for( MarketDependencyFinder::DependencyItem* item : aDependencyFinder.getDependencyItems() ) {
-        for( MarketDependencyFinder::CalcVertex* vertex : item->mPriceVertices ) {
-            calcVertexList[ vertex->mUID ] = vertex;
-            for( MarketDependencyFinder::CalcVertex* outEdge : vertex->mOutEdges ) {
-                isSourceNode[ outEdge->mUID ] = false;
-                adjTriplets.push_back(TripletType(vertex->mUID, outEdge->mUID, true));
+        for( auto vertexList : { &item->mPriceVertices, &item->mDemandVertices } ) {
+            for( MarketDependencyFinder::CalcVertex* vertex : *vertexList ) {
+                vector<int>& currOutEdges = outEdges[ orderIndex[ vertex->mCalcItem ] ];
+                for( MarketDependencyFinder::CalcVertex* outEdge : vertex->mOutEdges ) {
+                    currOutEdges.push_back( orderIndex[ outEdge->mCalcItem ] );
+                }
             }
         }
-        for( MarketDependencyFinder::CalcVertex* vertex : item->mDemandVertices ) {
-            calcVertexList[ vertex->mUID ] = vertex;
-            for( MarketDependencyFinder::CalcVertex* outEdge : vertex->mOutEdges ) {
-                isSourceNode[ outEdge->mUID ] = false;
-                adjTriplets.push_back(TripletType(vertex->mUID, outEdge->mUID, true));
+    }
+    int numEdges = 0;
+    for( vector<int>& currOutEdges : outEdges ) {
+        sort( currOutEdges.begin(), currOutEdges.end() );
+        currOutEdges.erase( unique( currOutEdges.begin(), currOutEdges.end() ), currOutEdges.end() );
+        numEdges += currOutEdges.size();
+    }
+    
+    // Remove redundant edges from the graph, every edge is a predecessor that
+    // TBB must count down on every model evaluation.
+    Timer& reduceTimer = TimerRegistry::getInstance().getTimer( "graph-reduce" );
+    reduceTimer.start();
+    const int numReducedEdges = numEdges - transitiveReduction( outEdges );
+    reduceTimer.stop();
+    pgLog << "Transitive reduction of " << globalOrdering.size() << " activities reduced the number of edges from "
+          << numEdges << " to " << numReducedEdges << endl;
+    reduceTimer.print( pgLog, "Transitive reduction time: " );
+    
+    // Roll up activities into grains which will be calculated serially by a
+    // single TBB vertex.  Many activities are very cheap to calculate so having
+    // a vertex for each would leave us dominated by scheduling overhead.
+    vector<vector<int> > grains;
+    const int grainSize = Configuration::getInstance()->getInt( "parallel-grain-size", 0, false );
+    if( grainSize > 1 ) {
+        Timer& coarsenTimer = TimerRegistry::getInstance().getTimer( "graph-coarsen" );
+        coarsenTimer.start();
+        coarsenFlowGraph( globalOrdering, outEdges, grainSize, grains );
+        coarsenTimer.stop();
+        pgLog << "Coarsened " << globalOrdering.size() << " activities into " << grains.size()
+              << " grains with a target grain size of " << grainSize << endl;
+        coarsenTimer.print( pgLog, "Graph coarsening time: " );
+    }
+    else {
+        grains.resize( globalOrdering.size() );
+        for( size_t i = 0; i < globalOrdering.size(); ++i ) {
+            grains[ i ].push_back( i );
+        }
+    }
+    
+    // find the edges between grains
+    vector<int> grainOf( globalOrdering.size() );
+    for( size_t grainIndex = 0; grainIndex < grains.size(); ++grainIndex ) {
+        for( int activityIndex : grains[ grainIndex ] ) {
+            grainOf[ activityIndex ] = grainIndex;
+        }
+    }
+    vector<set<int> > grainOutEdges( grains.size() );
+    vector<bool> isSourceNode( grains.size(), true );
+    for( size_t from = 0; from < outEdges.size(); ++from ) {
+        for( int to : outEdges[ from ] ) {
+            if( grainOf[ from ] != grainOf[ to ] ) {
+                grainOutEdges[ grainOf[ from ] ].insert( grainOf[ to ] );
+                isSourceNode[ grainOf[ to ] ] = false;
             }
         }
     }
     
-    // TODO: in principle doing a transitive reduction should give us a speed up
-    // running the model, however it seems to be rather computationaly expensive
-    // see if we can come up with a faster algorithm that scales well with a large
-    // number of vertices/edges.
-    Eigen::SparseMatrix<bool> adjMatrix( globalOrdering.size(), globalOrdering.size());
-    adjMatrix.setFromTriplets( adjTriplets.begin(), adjTriplets.end() );
+    // hang on to the grains so that we can rebuild the TBB vertices once we
+    // have a cost model to prioritize them with
+    aTBBGraph.mGrains.resize( grains.size() );
+    aTBBGraph.mGrainOutEdges.resize( grains.size() );
+    for( size_t k = 0; k < grains.size(); ++k ) {
+        for( int activityIndex : grains[ k ] ) {
+            aTBBGraph.mGrains[ k ].push_back( globalOrdering[ activityIndex ] );
+        }
+        for( int to : grainOutEdges[ k ] ) {
+            // regular dependency between grains
+            pgLog << globalOrdering[ grains[ k ].front() ]->getDescription() << " -> "
+                  << globalOrdering[ grains[ to ].front() ]->getDescription() << endl;
+            aTBBGraph.mGrainOutEdges[ k ].push_back( to );
+        }
+        // also include the "edge" from the head node to all grains that
+        // have no incoming dependencies
+        if(isSourceNode[k]) {
+            pgLog << " head -> " << globalOrdering[ grains[ k ].front() ]->getDescription() << endl;
+        }
+    }
+    aTBBGraph.mGrainCalcTime.assign( grains.size(), 0.0 );
+    buildTBBVertices( aTBBGraph, vector<unsigned int>() );
     
-    /*Eigen::SparseMatrix<bool> adjMatrixTransClosure = adjMatrix;
-    for (int k=0; k<adjMatrix.outerSize(); ++k) {
-        adjMatrixTransClosure = adjMatrix * adjMatrix;
+    AutoOutputFile flowGraphFile( "flow-graph", "gcam-flow-graph.dot" );
+    if( flowGraphFile.shouldWrite() ) {
+        printFlowGraph( *flowGraphFile, globalOrdering, grains, grainOutEdges );
     }
+}
+
+/*!
+ * \brief Create the TBB vertices and edges for the grains of the global flow graph.
+ * \details Any vertices which already exist are removed first so that this may
+ *          be called again to change the priorities.  While the graph is sampling
+ *          its cost model each vertex will also time its calculations.
+ * \param aTBBGraph The global flow graph which already has its grains set.
+ * \param aPriorities The TBB node priority for each grain.  When the ready vertices
+ *                    outnumber the threads, those with a larger priority are run
+ *                    first.  If empty no priorities are used.
+ */
+void GcamParallel::buildTBBVertices( GcamFlowGraph& aTBBGraph,
+                                     const vector<unsigned int>& aPriorities )
+{
+    using tbb::flow::continue_node;
+    using tbb::flow::continue_msg;
+    
+    tbb::flow::graph& tbbFlowGraph = aTBBGraph.mTBBFlowGraph;
+    tbb::flow::broadcast_node<tbb::flow::continue_msg>& head = aTBBGraph.mHead;
+    vector<continue_node<continue_msg>*>& tbbVert = aTBBGraph.mTBBVertices;
     
-    // transative reduction
-    adjMatrix = (adjMatrix - adjMatrixTransClosure).pruned();*/
+    // clear out any previous vertices including the edges from the head node
+    tbbFlowGraph.reset( tbb::flow::rf_clear_edges );
+    for( auto vert : tbbVert ) {
+        delete vert;
+    }
+    tbbVert.clear();
     
     // we have to take two passes, first to create each of the verticies which
     // apparently can not be copied so we hang on to them with a pointer
-    vector<continue_node<continue_msg>*>& tbbVert = aTBBGraph.mTBBVertices;
-    tbbVert.reserve( calcVertexList.size() );
-    for( MarketDependencyFinder::CalcVertex* vert : calcVertexList ) {
-        IActivity* activity = vert->mCalcItem;
-        tbbVert.push_back(new continue_node<continue_msg>(tbbFlowGraph, [activity](continue_msg) {
-            activity->calc(GcamFlowGraph::mPeriod);
-        }));
+    tbbVert.reserve( aTBBGraph.mGrains.size() );
+    GcamFlowGraph* graph = &aTBBGraph;
+    for( size_t k = 0; k < aTBBGraph.mGrains.size(); ++k ) {
+        const vector<IActivity*>& grainActivities = aTBBGraph.mGrains[ k ];
+        const tbb::flow::node_priority_t priority = aPriorities.empty() ? tbb::flow::no_priority : aPriorities[ k ];
+        tbbVert.push_back(new continue_node<continue_msg>(tbbFlowGraph, [graph, &grainActivities, k](continue_msg) {
+            if( graph->mNumEvalsToSample > 0 ) {
+                tbb::tick_count start = tbb::tick_count::now();
+                for( IActivity* activity : grainActivities ) {
+                    ActivityProfiler::calc(activity, GcamFlowGraph::mPeriod);
+                }
+                graph->mGrainCalcTime[ k ] += ( tbb::tick_count::now() - start ).seconds();
+            }
+            else {
+                for( IActivity* activity : grainActivities ) {
+                    ActivityProfiler::calc(activity, GcamFlowGraph::mPeriod);
+                }
+            }
+        }, priority));
     }
     // now create the edges
-    for (int k=0; k<adjMatrix.outerSize(); ++k) {
-        for (Eigen::SparseMatrix<bool>::InnerIterator it(adjMatrix,k); it; ++it) {
-            // regular dependency between activities
-            pgLog << calcVertexList[it.row()]->mCalcItem->getDescription() << " -> " << calcVertexList[it.col()]->mCalcItem->getDescription() << endl;
-            make_edge(*tbbVert[it.row()], *tbbVert[it.col()]);
+    vector<bool> isSourceNode( tbbVert.size(), true );
+    for( size_t k = 0; k < tbbVert.size(); ++k ) {
+        for( int to : aTBBGraph.mGrainOutEdges[ k ] ) {
+            make_edge(*tbbVert[k], *tbbVert[to]);
+            isSourceNode[ to ] = false;
         }
-        // also include the "edge" from the head node to all activities that
-        // have no incoming dependencies
-        if(isSourceNode[k]) {
-            pgLog << " head -> " << calcVertexList[k]->mCalcItem->getDescription() << endl;
+    }
+    for( size_t k = 0; k < tbbVert.size(); ++k ) {
+        if( isSourceNode[ k ] ) {
             make_edge(head, *tbbVert[k]);
         }
     }
 }
 
+/*!
+ * \brief Start timing the vertices of the global flow graph if the cost model
+ *        has not yet been sampled in the given period.
+ * \details The cost of each vertex is sampled over the first
+ *          "critical-path-sample-evals" full model evaluations of each period.
+ *          Setting that to zero or less disables the cost model.
+ * \param aTBBGraph The flow graph about to be run.
+ * \param aPeriod The model period being calculated.
+ */
+void GcamParallel::beginCostSample( GcamFlowGraph& aTBBGraph, const int aPeriod ) {
+    if( aTBBGraph.mIsPartialGraph || aTBBGraph.mCostModelPeriod == aPeriod ) {
+        return;
+    }
+    const static int numSampleEvals = Configuration::getInstance()->getInt( "critical-path-sample-evals", 0, false );
+    aTBBGraph.mCostModelPeriod = aPeriod;
+    aTBBGraph.mNumEvalsToSample = numSampleEvals;
+    aTBBGraph.mGrainCalcTime.assign( aTBBGraph.mGrains.size(), 0.0 );
+}
+
+/*!
+ * \brief Finish timing an evaluation of the global flow graph and once enough
+ *        evaluations have been sampled prioritize the critical path.
+ * \param aTBBGraph The flow graph which was just run.
+ */
+void GcamParallel::endCostSample( GcamFlowGraph& aTBBGraph ) {
+    if( aTBBGraph.mNumEvalsToSample > 0 && --aTBBGraph.mNumEvalsToSample == 0 ) {
+        prioritizeCriticalPath( aTBBGraph );
+    }
+}
+
+/*!
+ * \brief Prioritize the vertices of the global flow graph by the length of
+ *        the longest path from them to the end of the graph.
+ * \details Uses the sampled calculation times as the cost of each vertex to
+ *          calculate its bottom level, i.e. its own cost plus the largest bottom
+ *          level of the vertices that depend on it.  Running the ready vertex
+ *          with the largest bottom level first keeps the critical path moving
+ *          so that large vertices such as the land allocators do not get left
+ *          to the end of the evaluation.  The TBB vertices are then rebuilt with
+ *          their rank by bottom level as the priority.
+ * \param aTBBGraph The global flow graph which has finished sampling its costs.
+ */
+void GcamParallel::prioritizeCriticalPath( GcamFlowGraph& aTBBGraph ) {
+    const vector<vector<int> >& outEdges = aTBBGraph.mGrainOutEdges;
+    const int numGrains = outEdges.size();
+    
+    // find a topological order of the grains
+    vector<int> numInEdges( numGrains, 0 );
+    for( const vector<int>& currOutEdges : outEdges ) {
+        for( int to : currOutEdges ) {
+            ++numInEdges[ to ];
+        }
+    }
+    vector<int> order;
+    order.reserve( numGrains );
+    for( int k = 0; k < numGrains; ++k ) {
+        if( numInEdges[ k ] == 0 ) {
+            order.push_back( k );
+        }
+    }
+    for( size_t i = 0; i < order.size(); ++i ) {
+        for( int to : outEdges[ order[ i ] ] ) {
+            if( --numInEdges[ to ] == 0 ) {
+                order.push_back( to );
+            }
+        }
+    }
+    assert( order.size() == static_cast<size_t>( numGrains ) );
+    
+    // calculate the bottom levels in reverse topological order
+    vector<double> bottomLevel( numGrains, 0.0 );
+    double totalWork = 0.0;
+    double criticalPath = 0.0;
+    for( auto iter = order.rbegin(); iter != order.rend(); ++iter ) {
+        double maxSuccessor = 0.0;
+        for( int to : outEdges[ *iter ] ) {
+            maxSuccessor = max( maxSuccessor, bottomLevel[ to ] );
+        }
+        bottomLevel[ *iter ] = aTBBGraph.mGrainCalcTime[ *iter ] + maxSuccessor;
+        totalWork += aTBBGraph.mGrainCalcTime[ *iter ];
+        criticalPath = max( criticalPath, bottomLevel[ *iter ] );
+    }
+    
+    // use the rank so that priorities are distinct and never zero which TBB
+    // reserves for no priority
+    vector<int> rank( numGrains );
+    for( int k = 0; k < numGrains; ++k ) {
+        rank[ k ] = k;
+    }
+    stable_sort( rank.begin(), rank.end(), [&bottomLevel]( int aLHS, int aRHS ) {
+        return bottomLevel[ aLHS ] < bottomLevel[ aRHS ];
+    } );
+    vector<unsigned int> priorities( numGrains );
+    for( int i = 0; i < numGrains; ++i ) {
+        priorities[ rank[ i ] ] = i + 1;
+    }
+    buildTBBVertices( aTBBGraph, priorities );
+    
+    ILogger& pgLog = ILogger::getLogger( "parallel-grain-log" );
+    pgLog.setLevel( ILogger::DEBUG );
+    pgLog << "Period " << aTBBGraph.mCostModelPeriod << " critical path: " << criticalPath
+          << " seconds of " << totalWork << " seconds total sampled work" << endl;
+}
+
+/*!
+ * \brief Remove redundant edges from a directed acyclic graph.
+ * \details An edge u -> v is redundant if v can also be reached from u through
+ *          some other path.  Removing it does not change the order in which the
+ *          vertices may be calculated.  The vertices are visited in reverse
+ *          topological order while building up the set of vertices reachable
+ *          from each one as a bitvector.  The out edges of a vertex are considered
+ *          nearest first so that an edge is only kept if its target was not
+ *          already reachable through one of the edges kept before it.  The
+ *          reachable set of a vertex is released as soon as all of its
+ *          predecessors have been visited to keep the memory required in check.
+ * \param aOutEdges For each vertex, the vertices which depend on it.  Vertices
+ *                  must be indexed in a topological order so that all edges point
+ *                  to a larger index, any edge which points to a smaller index is
+ *                  an error in the ordering and is fatal.  Redundant edges are removed in place
+ *                  and the remaining edges will be sorted.
+ * \return The number of edges removed.
+ */
+int GcamParallel::transitiveReduction( vector<vector<int> >& aOutEdges )
+{
+    const int numVertices = aOutEdges.size();
+    vector<int> numInEdges( numVertices, 0 );
+    for( const vector<int>& currOutEdges : aOutEdges ) {
+        for( int to : currOutEdges ) {
+            ++numInEdges[ to ];
+        }
+    }
+    
+    vector<unique_ptr<bitvector> > reachable( numVertices );
+    vector<int> keptEdges;
+    int numRemoved = 0;
+    for( int from = numVertices - 1; from >= 0; --from ) {
+        vector<int>& currOutEdges = aOutEdges[ from ];
+        sort( currOutEdges.begin(), currOutEdges.end() );
+        unique_ptr<bitvector> currReachable( new bitvector( numVertices ) );
+        keptEdges.clear();
+        for( int to : currOutEdges ) {
+            if( to == from ) {
+                // an activity depending on itself imposes no ordering between
+                // activities so the edge is simply redundant
+                --numInEdges[ to ];
+                ++numRemoved;
+                continue;
+            }
+            if( to < from ) {
+                // an edge which points backward means the calculation
+                // order is wrong and dropping it would let dependent activities
+                // run concurrently
+                ILogger& mainLog = ILogger::getLogger( "main_log" );
+                mainLog.setLevel( ILogger::SEVERE );
+                mainLog << "Flow graph edge " << from << " -> " << to
+                        << " does not follow the calculation order." << endl;
+                abort();
+            }
+            if( !currReachable->get( to ) ) {
+                keptEdges.push_back( to );
+                currReachable->set( to );
+                currReachable->setunion( *reachable[ to ] );
+            }
+            else {
+                ++numRemoved;
+            }
+            if( --numInEdges[ to ] == 0 ) {
+                // all predecessors of to have been visited
+                reachable[ to ].reset();
+            }
+        }
+        currOutEdges = keptEdges;
+        if( numInEdges[ from ] > 0 ) {
+            reachable[ from ] = move( currReachable );
+        }
+    }
+    
+    return numRemoved;
+}
+
+/*!
+ * \brief Coarsen the activity graph into grains of activities which are
+ *        calculated serially by a single flow graph vertex.
+ * \details The graph is parsed into a tree of clans using graph_parse.  The clan tree is then walked by grain_collect which
+ *          rolls up linear chains and small independent clans into grains of
+ *          approximately aGrainSize activities while splitting up large
+ *          independent clans so that they may still run in parallel.  If for some
+ *          reason the grains can not be ordered we fall back to a grain for each
+ *          activity.
+ * \param aOrdering All activities in a valid calculation order.
+ * \param aOutEdges For each activity, indexed by its position in aOrdering, the
+ *                  indices of the activities which depend on it.  The edges must
+ *                  already be transitively reduced.
+ * \param aGrainSize The target number of activities in a grain.
+ * \param aGrains The grains as indices into aOrdering, each in calculation order.
+ *                The grains themselves are sorted by the position of their first
+ *                activity.
+ */
+void GcamParallel::coarsenFlowGraph( const vector<IActivity*>& aOrdering,
+                                     const vector<vector<int> >& aOutEdges,
+                                     const int aGrainSize,
+                                     vector<vector<int> >& aGrains )
+{
+    typedef digraph<IActivity*> FlowGraph;
+    typedef digraph<clanid<IActivity*> > ClanTree;
+    
+    ILogger& pgLog = ILogger::getLogger( "parallel-grain-log" );
+    pgLog.setLevel( ILogger::DEBUG );
+    
+    // note graph_parse requires the transitive reduction of the graph which
+    // the caller has already done for us
+    FlowGraph reducedGraph( aOrdering, "gcam" );
+    for( size_t i = 0; i < aOutEdges.size(); ++i ) {
+        for( int j : aOutEdges[ i ] ) {
+            reducedGraph.addedge( aOrdering[ i ], aOrdering[ j ] );
+        }
+    }
+    
+    ClanTree clanTree;
+    // primitive clans any larger than the grain size need to be broken down
+    // further otherwise they would end up as a single grain
+    graph_parse( reducedGraph, 0, clanTree, aGrainSize );
+    
+    // grains are collapsed into a single node which holds the activities it
+    // contains as a subgraph
+    FlowGraph grainGraph( reducedGraph );
+    grain_collect( clanTree, clanTree.nodelist().begin(), grainGraph, aGrainSize );
+    
+    map<IActivity*, int> orderIndex;
+    for( size_t i = 0; i < aOrdering.size(); ++i ) {
+        orderIndex[ aOrdering[ i ] ] = i;
+    }
+    aGrains.clear();
+    aGrains.reserve( grainGraph.nodelist().size() );
+    for( FlowGraph::nodelist_c_iter_t nodeIter = grainGraph.nodelist().begin(); nodeIter != grainGraph.nodelist().end(); ++nodeIter ) {
+        vector<int> grain;
+        if( (*nodeIter).second.subgraph ) {
+            const FlowGraph::nodelist_t& members = (*nodeIter).second.subgraph->nodelist();
+            for( FlowGraph::nodelist_c_iter_t memberIter = members.begin(); memberIter != members.end(); ++memberIter ) {
+                assert( orderIndex.find( (*memberIter).first ) != orderIndex.end() );
+                grain.push_back( orderIndex[ (*memberIter).first ] );
+            }
+        }
+        else {
+            assert( orderIndex.find( (*nodeIter).first ) != orderIndex.end() );
+            grain.push_back( orderIndex[ (*nodeIter).first ] );
+        }
+        // the global ordering is a valid calculation order for the activities
+        // within a grain too
+        sort( grain.begin(), grain.end() );
+        aGrains.push_back( grain );
+    }
+    // the node list is sorted by pointer so sort the grains to get a consistent
+    // result from run to run
+    sort( aGrains.begin(), aGrains.end() );
+    
+    // double check the grains can be ordered, otherwise calculating the grains
+    // serially would violate some dependency
+    vector<int> grainOf( aOrdering.size(), -1 );
+    for( size_t grainIndex = 0; grainIndex < aGrains.size(); ++grainIndex ) {
+        for( int activityIndex : aGrains[ grainIndex ] ) {
+            grainOf[ activityIndex ] = grainIndex;
+        }
+    }
+    bool isValid = find( grainOf.begin(), grainOf.end(), -1 ) == grainOf.end();
+    vector<set<int> > grainOutEdges( aGrains.size() );
+    vector<int> numInEdges( aGrains.size(), 0 );
+    for( size_t from = 0; isValid && from < aOutEdges.size(); ++from ) {
+        for( int to : aOutEdges[ from ] ) {
+            if( grainOf[ from ] != grainOf[ to ] && grainOutEdges[ grainOf[ from ] ].insert( grainOf[ to ] ).second ) {
+                ++numInEdges[ grainOf[ to ] ];
+            }
+        }
+    }
+    list<int> ready;
+    for( size_t grainIndex = 0; isValid && grainIndex < aGrains.size(); ++grainIndex ) {
+        if( numInEdges[ grainIndex ] == 0 ) {
+            ready.push_back( grainIndex );
+        }
+    }
+    size_t numSorted = 0;
+    while( !ready.empty() ) {
+        const int curr = ready.front();
+        ready.pop_front();
+        ++numSorted;
+        for( int next : grainOutEdges[ curr ] ) {
+            if( --numInEdges[ next ] == 0 ) {
+                ready.push_back( next );
+            }
+        }
+    }
+    
+    if( !isValid || numSorted != aGrains.size() ) {
+        ILogger& mainLog = ILogger::getLogger( "main_log" );
+        mainLog.setLevel( ILogger::WARNING );
+        mainLog << "Could not coarsen the flow graph into consistent grains, using a vertex for each activity." << endl;
+        pgLog << "Coarsening failed, using a vertex for each activity." << endl;
+        aGrains.resize( aOrdering.size() );
+        for( size_t i = 0; i < aOrdering.size(); ++i ) {
+            aGrains[ i ].assign( 1, i );
+        }
+    }
+}
+
+/*!
+ * \brief Write the flow graph in the graphviz dot format.
+ * \details Each vertex is a grain which is labeled by the first activity it
+ *          calculates and the number of activities it contains.
+ * \param aOut The stream to write to.
+ * \param aOrdering All activities in a valid calculation order.
+ * \param aGrains The grains as indices into aOrdering.
+ * \param aGrainOutEdges For each grain the grains which depend on it.
+ */
+void GcamParallel::printFlowGraph( ostream& aOut,
+                                   const vector<IActivity*>& aOrdering,
+                                   const vector<vector<int> >& aGrains,
+                                   const vector<set<int> >& aGrainOutEdges )
+{
+    aOut << "digraph gcam {" << endl;
+    for( size_t k = 0; k < aGrains.size(); ++k ) {
+        aOut << "\tg" << k << " [label=\"" << aOrdering[ aGrains[ k ].front() ]->getDescription();
+        if( aGrains[ k ].size() > 1 ) {
+            aOut << " (" << aGrains[ k ].size() << ")";
+        }
+        aOut << "\"];" << endl;
+    }
+    for( size_t k = 0; k < aGrains.size(); ++k ) {
+        for( int to : aGrainOutEdges[ k ] ) {
+            aOut << "\tg" << k << " -> g" << to << ";" << endl;
+        }
+    }
+    aOut << "}" << endl;
+}
+
 
 /*!
 * \brief Build the TBB a partial flow graph from the given dependency finder which
@@ -187,7 +620,12 @@ void GcamParallel::makeTBBFlowGraph( const MarketDependencyFinder& aDependencyFi
  *  in the partial graph.
 * \details This method is basically does the same thing as for the global graph but is a bit
  *     more complicated due to not being able to use UIDs so we have to resort to set
- *     looks which are slower. So we seperate it into it's own method.
+ *     looks which are slower. So we seperate it into it's own method.  Note the partial
+ *     calc list is closed under the out edges of the dependency graph so we do not lose
+ *     any ordering constraints by only keeping the edges between its members.  Vertices
+ *     of a partial graph will be run by several threads at once while they are all
+ *     working on the same partial derivative so each vertex will temporarily switch the
+ *     state slot of the thread running it to GcamFlowGraph::mStateSlot.
 * \param[in] aDependencyFinder Defines the activities and their relationships.
  * \param[in] aPartialCalcList A list representing the subset of vertices to include
  *     in this subgraph.
@@ -206,12 +644,70 @@ void GcamParallel::makeTBBFlowGraph( const MarketDependencyFinder& aDependencyFi
                                      GcamFlowGraph& aTBBGraph,
                                      const std::vector<IActivity*>& aPartialCalcList )
 {
-    // TODO:implement this.  We don't use it at the moment and to make sure
-    // it works it would be handy to actually test it with something.
-    ILogger& mainLog = ILogger::getLogger( "main_log" );
-    mainLog.setLevel( ILogger::ERROR );
-    mainLog << "TBB flow graphs for partial subgraphs are not yet implemented." << endl;
-    abort();
+    using tbb::flow::continue_node;
+    using tbb::flow::continue_msg;
+    
+    tbb::flow::graph& tbbFlowGraph = aTBBGraph.mTBBFlowGraph;
+    tbb::flow::broadcast_node<tbb::flow::continue_msg>& head = aTBBGraph.mHead;
+    aTBBGraph.mIsPartialGraph = true;
+    
+    // map the activities to include to their position in the partial calc list
+    // which we will use as the index into the TBB vertices
+    map<IActivity*, int> partialIndex;
+    for( size_t i = 0; i < aPartialCalcList.size(); ++i ) {
+        partialIndex[ aPartialCalcList[ i ] ] = i;
+    }
+    
+    // create each of the vertices, note the partial calc list is already in
+    // calculation order
+    vector<continue_node<continue_msg>*>& tbbVert = aTBBGraph.mTBBVertices;
+    tbbVert.reserve( aPartialCalcList.size() );
+    GcamFlowGraph* partialGraph = &aTBBGraph;
+    for( IActivity* activity : aPartialCalcList ) {
+        tbbVert.push_back(new continue_node<continue_msg>(tbbFlowGraph, [activity, partialGraph](continue_msg) {
+            double* prevState = ManageStateVariables::swapThreadState( partialGraph->mStateSlot );
+            ActivityProfiler::calc(activity, GcamFlowGraph::mPeriod);
+            ManageStateVariables::swapThreadState( prevState );
+        }));
+    }
+    
+    // now collect the edges only keeping those where both ends are in the partial
+    // calc list
+    vector<vector<int> > outEdges( aPartialCalcList.size() );
+    for( MarketDependencyFinder::DependencyItem* item : aDependencyFinder.getDependencyItems() ) {
+        for( auto vertexList : { &item->mPriceVertices, &item->mDemandVertices } ) {
+            for( MarketDependencyFinder::CalcVertex* vertex : *vertexList ) {
+                auto fromIter = partialIndex.find( vertex->mCalcItem );
+                if( fromIter == partialIndex.end() ) {
+                    continue;
+                }
+                for( MarketDependencyFinder::CalcVertex* outEdge : vertex->mOutEdges ) {
+                    auto toIter = partialIndex.find( outEdge->mCalcItem );
+                    if( toIter != partialIndex.end() ) {
+                        outEdges[ (*fromIter).second ].push_back( (*toIter).second );
+                    }
+                }
+            }
+        }
+    }
+    
+    // as with the global graph only create the edges which are not redundant
+    transitiveReduction( outEdges );
+    vector<bool> isSourceNode( aPartialCalcList.size(), true );
+    for( size_t from = 0; from < outEdges.size(); ++from ) {
+        for( int to : outEdges[ from ] ) {
+            isSourceNode[ to ] = false;
+            make_edge( *tbbVert[ from ], *tbbVert[ to ] );
+        }
+    }
+    
+    // include the "edge" from the head node to all activities that have no
+    // incoming dependencies from within the partial graph
+    for( size_t i = 0; i < isSourceNode.size(); ++i ) {
+        if( isSourceNode[ i ] ) {
+            make_edge( head, *tbbVert[ i ] );
+        }
+    }
 }
 
 #endif // GCAM_PARALLEL_ENABLED
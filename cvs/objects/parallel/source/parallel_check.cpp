@@ -0,0 +1,329 @@
+/*
+* LEGAL NOTICE
+* This computer software was prepared by Battelle Memorial Institute,
+* hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+* with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+* CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+* LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+* sentence must appear on any copies of this computer software.
+* 
+* EXPORT CONTROL
+* User agrees that the Software will not be shipped, transferred or
+* exported into any country or used in any manner prohibited by the
+* United States Export Administration Act or any other applicable
+* export laws, restrictions or regulations (collectively the "Export Laws").
+* Export of the Software may require some form of license or other
+* authority from the U.S. Government, and failure to obtain such
+* export control license may result in criminal liability under
+* U.S. laws. In addition, if the Software is identified as export controlled
+* items under the Export Laws, User represents and warrants that User
+* is not a citizen, or otherwise located within, an embargoed nation
+* (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+*     and that User is not otherwise prohibited
+* under the Export Laws from receiving the Software.
+* 
+* Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+* Distributed as open-source under the terms of the Educational Community 
+* License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+* 
+* For further details, see: http://www.globalchange.umd.edu/models/gcam/
+*
+*/
+
+/*!
+ * \file parallel_check.cpp
+ * \ingroup Objects
+ * \brief ParallelCheck class source file.
+ */
+
+#include "util/base/include/definitions.h"
+
+#if GCAM_PARALLEL_ENABLED
+
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <tbb/tick_count.h>
+
+#include "parallel/include/parallel_check.hpp"
+#include "containers/include/world.h"
+#include "marketplace/include/marketplace.h"
+#include "util/base/include/configuration.h"
+#include "util/base/include/model_time.h"
+#include "util/base/include/fltcmp.hpp"
+#include "util/logger/include/ilogger.h"
+
+using namespace std;
+
+//! Constructor
+ParallelCheck::PeriodResult::PeriodResult():
+mSerialTime( 0.0 ),
+mParallelTime( 0.0 ),
+mNumMismatchedMarkets( 0 ),
+mMaxMarketULP( 0 ),
+mNumJacobians( 0 ),
+mNumColumns( 0 ),
+mNumMismatchedEntries( 0 ),
+mMaxJacobianULP( 0 ),
+mJacobianSerialTime( 0.0 ),
+mJacobianParallelTime( 0.0 )
+{
+}
+
+/*!
+ * \brief Get the singleton instance of the ParallelCheck.
+ * \details The first call will read the configuration so it must not happen
+ *          before the Configuration is parsed.
+ * \return The ParallelCheck.
+ */
+ParallelCheck& ParallelCheck::getInstance() {
+    static ParallelCheck PARALLEL_CHECK;
+    return PARALLEL_CHECK;
+}
+
+/*!
+ * \brief Constructor which reads the check options from the configuration.
+ */
+ParallelCheck::ParallelCheck():
+mCurrentPeriod( -1 ),
+mNumJacobiansRemaining( 0 )
+{
+    const Configuration* conf = Configuration::getInstance();
+    mIsEnabled = conf->getBool( "parallel-check", false, false );
+    parseYears( conf->getString( "parallel-check-years", "", false ) );
+    mNumRepeats = max( conf->getInt( "parallel-check-repeats", 3, false ), 1 );
+    mNumJacobiansPerPeriod = max( conf->getInt( "parallel-check-jacobians", 1, false ), 0 );
+    mTolerance = max( conf->getInt( "parallel-check-ulp", static_cast<int>( DBL_CMP_LOOSE ), false ), 0 );
+}
+
+/*!
+ * \brief Enable the check regardless of the configuration.
+ * \details This is used by the command line switch.
+ * \param aYears A comma separated list of the model years to check, if empty
+ *               the years set in the configuration are used.
+ */
+void ParallelCheck::enable( const string& aYears ) {
+    mIsEnabled = true;
+    if( !aYears.empty() ) {
+        parseYears( aYears );
+    }
+}
+
+/*!
+ * \brief Parse a comma separated list of model years to check.
+ * \param aYears The list of years, empty or "all" to check all periods.
+ */
+void ParallelCheck::parseYears( const string& aYears ) {
+    mYears.clear();
+    if( aYears == "all" ) {
+        return;
+    }
+    istringstream yearStream( aYears );
+    string year;
+    while( getline( yearStream, year, ',' ) ) {
+        if( !year.empty() ) {
+            mYears.insert( atoi( year.c_str() ) );
+        }
+    }
+}
+
+/*!
+ * \brief Start a new period and determine if it should be checked.
+ * \details Jacobians will only be checked between a call to this method which
+ *          returns true and the next call.
+ * \param aPeriod The model period which is starting.
+ * \return True if the check is enabled and includes aPeriod.
+ */
+bool ParallelCheck::beginPeriod( const int aPeriod ) {
+    const bool shouldCheck = mIsEnabled && ( mYears.empty() ||
+        mYears.find( Modeltime::getInstance()->getper_to_yr( aPeriod ) ) != mYears.end() );
+    mCurrentPeriod = shouldCheck ? aPeriod : -1;
+    mNumJacobiansRemaining = shouldCheck ? mNumJacobiansPerPeriod : 0;
+    return shouldCheck;
+}
+
+/*!
+ * \brief Whether the period started by the last call to beginPeriod is checked.
+ * \return True if the current period is checked.
+ */
+bool ParallelCheck::isCheckingPeriod() const {
+    return mCurrentPeriod != -1;
+}
+
+/*!
+ * \brief Run the world calc both serially and in parallel and compare the results.
+ * \details Each variant is run mNumRepeats times and the fastest is recorded.
+ *          Markets are reset between each calculation and the parallel results
+ *          are left in the marketplace.
+ * \param aWorld The world to calculate.
+ * \param aMarketplace The marketplace to collect results from.
+ * \param aPeriod The model period.
+ */
+void ParallelCheck::checkWorldCalc( World* aWorld, Marketplace* aMarketplace, const int aPeriod ) {
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    PeriodResult& result = mResults[ aPeriod ];
+    
+    // get rid of transient bad data
+    aWorld->calc( aPeriod );
+    
+    vector<double> serialState;
+    vector<double> parallelState;
+    result.mSerialTime = numeric_limits<double>::max();
+    result.mParallelTime = numeric_limits<double>::max();
+    result.mNumMismatchedMarkets = 0;
+    result.mMaxMarketULP = 0;
+    for( int repeat = 0; repeat < mNumRepeats; ++repeat ) {
+        aMarketplace->nullSuppliesAndDemands( aPeriod );
+        tbb::tick_count startTime = tbb::tick_count::now();
+        aWorld->calc( aPeriod );
+        result.mSerialTime = min( result.mSerialTime, ( tbb::tick_count::now() - startTime ).seconds() );
+        if( repeat == 0 ) {
+            serialState = aMarketplace->fullstate( aPeriod );
+        }
+        
+        aMarketplace->nullSuppliesAndDemands( aPeriod );
+        startTime = tbb::tick_count::now();
+        aWorld->calc( aPeriod, aWorld->getGlobalFlowGraph() );
+        result.mParallelTime = min( result.mParallelTime, ( tbb::tick_count::now() - startTime ).seconds() );
+        if( repeat == 0 ) {
+            parallelState = aMarketplace->fullstate( aPeriod );
+        }
+    }
+    
+    // the state is in strides of 3: price, demand, and supply for each market
+    for( size_t i = 0; i + 2 < serialState.size(); i += 3 ) {
+        int64_t marketULP = 0;
+        for( size_t j = i; j < i + 3; ++j ) {
+            marketULP = max( marketULP, dblulpdist( serialState[ j ], parallelState[ j ] ) );
+        }
+        result.mMaxMarketULP = max( result.mMaxMarketULP, marketULP );
+        if( marketULP > mTolerance ) {
+            ++result.mNumMismatchedMarkets;
+        }
+    }
+    
+    if( result.mNumMismatchedMarkets > 0 ) {
+        // log the details of each mismatched market, note the marketplace
+        // currently holds the parallel results
+        mainLog.setLevel( ILogger::ERROR );
+        mainLog << "Parallel world calc failed to reproduce the serial results for "
+                << result.mNumMismatchedMarkets << " markets in period " << aPeriod << "." << endl;
+        aMarketplace->checkstate( aPeriod, serialState, &mainLog, static_cast<unsigned>( mTolerance ) );
+    }
+    
+    mainLog.setLevel( ILogger::NOTICE );
+    mainLog << "Parallel check period " << aPeriod << ": serial time: " << result.mSerialTime
+            << " parallel time: " << result.mParallelTime << " speedup: "
+            << result.mSerialTime / result.mParallelTime << " max ulp: " << result.mMaxMarketULP << endl;
+}
+
+/*!
+ * \brief Whether the Jacobian about to be calculated should be checked.
+ * \details Each call which returns true counts against the number of Jacobians
+ *          to check in the current period.
+ * \return True if the Jacobian should also be calculated serially and compared.
+ */
+bool ParallelCheck::shouldCheckJacobian() {
+    if( mCurrentPeriod == -1 || mNumJacobiansRemaining == 0 ) {
+        return false;
+    }
+    --mNumJacobiansRemaining;
+    return true;
+}
+
+/*!
+ * \brief Compare the partial derivative columns of a Jacobian calculated in
+ *        parallel to the same columns calculated serially.
+ * \param aParallelJ The Jacobian calculated in parallel.
+ * \param aSerialJ The Jacobian calculated serially.
+ * \param aCols The columns which were calculated.
+ * \param aParallelTime The time in seconds to calculate aParallelJ.
+ * \param aSerialTime The time in seconds to calculate aSerialJ.
+ */
+void ParallelCheck::checkJacobian( const UBMATRIX& aParallelJ, const UBMATRIX& aSerialJ,
+                                   const list<int>& aCols, const double aParallelTime,
+                                   const double aSerialTime )
+{
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    PeriodResult& result = mResults[ mCurrentPeriod ];
+    ++result.mNumJacobians;
+    result.mNumColumns += aCols.size();
+    result.mJacobianParallelTime += aParallelTime;
+    result.mJacobianSerialTime += aSerialTime;
+    
+    int numMismatched = 0;
+    for( int j : aCols ) {
+        for( int i = 0; i < aSerialJ.rows(); ++i ) {
+            const int64_t ulp = dblulpdist( aSerialJ( i, j ), aParallelJ( i, j ) );
+            result.mMaxJacobianULP = max( result.mMaxJacobianULP, ulp );
+            if( ulp > mTolerance ) {
+                if( numMismatched == 0 ) {
+                    mainLog.setLevel( ILogger::ERROR );
+                    mainLog << "Parallel partial derivatives failed to reproduce the serial results in period "
+                            << mCurrentPeriod << "." << endl;
+                }
+                ++numMismatched;
+                mainLog << "Jacobian discrepancy: row " << i << " column " << j << "\t"
+                        << aSerialJ( i, j ) << "\t" << aParallelJ( i, j ) << "\t" << ulp << " ulp" << endl;
+            }
+        }
+    }
+    result.mNumMismatchedEntries += numMismatched;
+    
+    mainLog.setLevel( ILogger::NOTICE );
+    mainLog << "Parallel check period " << mCurrentPeriod << " Jacobian: " << aCols.size()
+            << " columns serial time: " << aSerialTime << " parallel time: " << aParallelTime
+            << " speedup: " << aSerialTime / aParallelTime << endl;
+}
+
+/*!
+ * \brief Write a table of the results of each checked period and the overall
+ *        speedup statistics to the main log.
+ */
+void ParallelCheck::writeSummary() const {
+    if( mResults.empty() ) {
+        return;
+    }
+    
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    mainLog.setLevel( ILogger::WARNING );
+    mainLog << "Parallel check summary:" << endl;
+    mainLog << "period\tserial\tparallel\tspeedup\tmismatched markets\tmax ulp"
+            << "\tcolumns\tjacobian speedup\tmismatched entries\tmax ulp" << endl;
+    
+    double minSpeedup = numeric_limits<double>::max();
+    double maxSpeedup = 0.0;
+    double sumSpeedup = 0.0;
+    bool allMatched = true;
+    for( const auto& periodResult : mResults ) {
+        const PeriodResult& result = periodResult.second;
+        const double speedup = result.mSerialTime / result.mParallelTime;
+        minSpeedup = min( minSpeedup, speedup );
+        maxSpeedup = max( maxSpeedup, speedup );
+        sumSpeedup += speedup;
+        allMatched = allMatched && result.mNumMismatchedMarkets == 0 && result.mNumMismatchedEntries == 0;
+        mainLog << periodResult.first << "\t" << result.mSerialTime << "\t" << result.mParallelTime
+                << "\t" << speedup << "\t" << result.mNumMismatchedMarkets << "\t" << result.mMaxMarketULP
+                << "\t" << result.mNumColumns << "\t";
+        if( result.mNumJacobians > 0 ) {
+            mainLog << result.mJacobianSerialTime / result.mJacobianParallelTime;
+        }
+        else {
+            mainLog << "NA";
+        }
+        mainLog << "\t" << result.mNumMismatchedEntries << "\t" << result.mMaxJacobianULP << endl;
+    }
+    
+    mainLog << "World calc speedup min: " << minSpeedup << " mean: " << sumSpeedup / mResults.size()
+            << " max: " << maxSpeedup << endl;
+    if( allMatched ) {
+        mainLog << "Parallel results matched serial results within " << mTolerance
+                << " ulp in all checked periods." << endl;
+    }
+    else {
+        mainLog.setLevel( ILogger::ERROR );
+        mainLog << "Parallel results did not match serial results, see the main log for details." << endl;
+    }
+}
+
+#endif // GCAM_PARALLEL_ENABLED
@@ -0,0 +1,110 @@
+#ifndef BLOCK_BROYDEN_HPP_
+#define BLOCK_BROYDEN_HPP_
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+/*
+* LEGAL NOTICE
+* This computer software was prepared by Battelle Memorial Institute,
+* hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+* with the Department of Energy ( DOE ). NEITHER THE GOVERNMENT NOR THE
+* CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+* LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+* sentence must appear on any copies of this computer software.
+* 
+* EXPORT CONTROL
+* User agrees that the Software will not be shipped, transferred or
+* exported into any country or used in any manner prohibited by the
+* United States Export Administration Act or any other applicable
+* export laws, restrictions or regulations (collectively the "Export Laws").
+* Export of the Software may require some form of license or other
+* authority from the U.S. Government, and failure to obtain such
+* export control license may result in criminal liability under
+* U.S. laws. In addition, if the Software is identified as export controlled
+* items under the Export Laws, User represents and warrants that User
+* is not a citizen, or otherwise located within, an embargoed nation
+* (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+*     and that User is not otherwise prohibited
+* under the Export Laws from receiving the Software.
+* 
+* Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+* Distributed as open-source under the terms of the Educational Community 
+* License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+* 
+* For further details, see: http://www.globalchange.umd.edu/models/gcam/
+*
+*/
+
+/*!
+ * \file block_broyden.hpp
+ * \ingroup objects
+ * \brief Header file for the block Broyden solver component
+ */
+
+#include <string>
+#include <vector>
+#include "solution/solvers/include/logbroyden.hpp"
+
+class SolutionInfoSet;
+
+/*!
+ * \ingroup Objects
+ * \brief SolverComponent which decomposes the markets into blocks which can
+ *        be solved one after another with the Broyden algorithm.
+ *
+ * \details The excess demand of a market only depends on the prices of the
+ *          markets it is connected to through the activities which may change
+ *          it as found from the market dependency graph.  The strongly
+ *          connected components of this graph put the Jacobian into a block
+ *          triangular form: once the blocks upstream of a block are solved its
+ *          markets can be solved without disturbing them.  The blocks are
+ *          therefore solved in topological order, each with a LogBroyden solve
+ *          over just its markets, which gives smaller Jacobians to calculate
+ *          and factor.
+ *
+ *          Blocks which do not depend on each other, such as regional water
+ *          basins, share the same level in the topological order.  By default
+ *          all of the blocks at a level are solved together as one block
+ *          diagonal system so that their partial derivatives are calculated
+ *          in the same evaluations and they share each model evaluation.
+ *
+ *          The Jacobian structure is only known when the dependency graph has
+ *          every activity in the global ordering.  Otherwise this behaves
+ *          exactly as the LogBroyden solver component.
+ *
+ *          <b>XML specification for BlockBroyden</b>
+ *          - XML name: \c block-broyden-solver-component
+ *          - Contained by: UserConfigurableSolver
+ *          - Parsing inherited from class: LogBroyden
+ *          - Elements:
+ *              - \c group-independent-blocks bool BlockBroyden::mGroupIndependentBlocks
+ *                      Whether blocks at the same level are solved together.
+ */
+class BlockBroyden: public LogBroyden {
+public:
+    BlockBroyden();
+    virtual ~BlockBroyden();
+    static const std::string& getXMLNameStatic();
+    
+    // SolverComponent methods
+    virtual ReturnCode solve( SolutionInfoSet& aSolutionSet, const int aPeriod );
+    virtual const std::string& getXMLName() const;
+
+protected:
+    // Define data such that introspection utilities can process the data from this
+    // subclass together with the data members of the parent classes.
+    DEFINE_DATA_WITH_PARENT(
+        LogBroyden,
+        
+        //! Whether the blocks which do not depend on each other are solved
+        //! together as one block diagonal system rather than one at a time.
+        DEFINE_VARIABLE( SIMPLE, "group-independent-blocks", mGroupIndependentBlocks, bool )
+    )
+    
+    bool findBlocks( SolutionInfoSet& aSolutionSet, const int aPeriod,
+                     std::vector<std::vector<int> >& aBlocks ) const;
+};
+
+#endif  // BLOCK_BROYDEN_HPP_
@@ -77,10 +77,12 @@ public:
   LogBroyden(Marketplace *mktplc, World *world, CalcCounter *ccounter, int itmax=250,
              double ftol=1.0e-4) :
       SolverComponent(mktplc,world,ccounter), mMaxIter( itmax ), mFTOL( ftol ),
-      mLogPricep( true ), mMaxJacobainReuse( 100 ), mSolutionInfoFilter(0) {}
+      mLogPricep( true ), mMaxJacobainReuse( 100 ), mSparseDensityThreshold( 0.05 ),
+      mUseFactorUpdate( true ), mSolutionInfoFilter(0) {}
     LogBroyden() :
         SolverComponent(), mMaxIter( 250 ), mFTOL( 1.0e-4 ),
-        mLogPricep( true ), mMaxJacobainReuse( 100 ), mSolutionInfoFilter(0) {}
+        mLogPricep( true ), mMaxJacobainReuse( 100 ), mSparseDensityThreshold( 0.05 ),
+        mUseFactorUpdate( true ), mSolutionInfoFilter(0) {}
   virtual ~LogBroyden() {
       delete mSolutionInfoFilter;
   }
@@ -122,6 +124,15 @@ protected:
         //! which if set to zero implies this algorithm just collapse to a regular NR algorithm
         DEFINE_VARIABLE( SIMPLE, "max-jacobian-reuse", mMaxJacobainReuse, int ),
         
+        //! The largest fraction of non-zero entries in the Jacobian for which it
+        //! will be factored as a sparse matrix rather than a dense one.  A value
+        //! of zero or less disables the sparse factorization.
+        DEFINE_VARIABLE( SIMPLE, "sparse-density-threshold", mSparseDensityThreshold, double ),
+        
+        //! Whether the factorization of the Jacobian should be updated with each
+        //! secant update rather than being refactored every iteration.
+        DEFINE_VARIABLE( SIMPLE, "update-factorization", mUseFactorUpdate, bool ),
+        
         //! A filter which will be used to determine which SolutionInfos with solver component
         //! will work on.
         DEFINE_VARIABLE( SIMPLE | NOT_PARSABLE, "solution-info-filter", mSolutionInfoFilter, ISolutionInfoFilter* )
@@ -60,6 +60,7 @@ class World;
 // Need to forward declare the subclasses as well.
 class BisectAll;
 class LogBroyden;
+class BlockBroyden;
 class Preconditioner;
 
 /*! \brief An abstract class defining an interface to an independent component
@@ -102,7 +103,7 @@ protected:
         /* Declare all subclasses of SolverComponent to allow automatic traversal of the
          * hierarchy under introspection.
          */
-        DEFINE_SUBCLASS_FAMILY( SolverComponent, BisectAll, LogBroyden, Preconditioner )
+        DEFINE_SUBCLASS_FAMILY( SolverComponent, BisectAll, LogBroyden, BlockBroyden, Preconditioner )
     )
     
    Marketplace* marketplace; //<! The marketplace to solve. 
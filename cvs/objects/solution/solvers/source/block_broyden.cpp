@@ -0,0 +1,294 @@
+/*
+* LEGAL NOTICE
+* This computer software was prepared by Battelle Memorial Institute,
+* hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+* with the Department of Energy ( DOE ). NEITHER THE GOVERNMENT NOR THE
+* CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+* LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+* sentence must appear on any copies of this computer software.
+* 
+* EXPORT CONTROL
+* User agrees that the Software will not be shipped, transferred or
+* exported into any country or used in any manner prohibited by the
+* United States Export Administration Act or any other applicable
+* export laws, restrictions or regulations (collectively the "Export Laws").
+* Export of the Software may require some form of license or other
+* authority from the U.S. Government, and failure to obtain such
+* export control license may result in criminal liability under
+* U.S. laws. In addition, if the Software is identified as export controlled
+* items under the Export Laws, User represents and warrants that User
+* is not a citizen, or otherwise located within, an embargoed nation
+* (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+*     and that User is not otherwise prohibited
+* under the Export Laws from receiving the Software.
+* 
+* Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+* Distributed as open-source under the terms of the Educational Community 
+* License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+* 
+* For further details, see: http://www.globalchange.umd.edu/models/gcam/
+*
+*/
+
+
+/*! 
+* \file block_broyden.cpp
+* \ingroup objects
+* \brief BlockBroyden class (block triangular Broyden's method solver) source file
+*/
+
+
+#include "util/base/include/definitions.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+
+#include "solution/solvers/include/solver_component.h"
+#include "solution/solvers/include/block_broyden.hpp"
+#include "solution/util/include/solution_info_set.h"
+#include "solution/util/include/solution_info.h"
+#include "solution/util/include/isolution_info_filter.h"
+#include "solution/util/include/edfun.hpp"
+#include "util/logger/include/ilogger.h"
+
+using namespace std;
+
+namespace {
+    /*!
+     * \brief A filter which only accepts the SolutionInfos of the markets in
+     *        one block of the decomposition.
+     */
+    class BlockSolutionInfoFilter : public ISolutionInfoFilter {
+    public:
+        //! Add a market to the block.
+        void addMarket( const Market* aMarket ) {
+            mMarkets.insert( aMarket );
+        }
+        
+        virtual bool acceptSolutionInfo( const SolutionInfo& aSolutionInfo ) const {
+            return mMarkets.find( aSolutionInfo.getLinkedMarket() ) != mMarkets.end();
+        }
+        
+    private:
+        //! The markets in the block.
+        unordered_set<const Market*> mMarkets;
+    };
+}
+
+//! Default Constructor.
+BlockBroyden::BlockBroyden():
+mGroupIndependentBlocks( true )
+{
+}
+
+//! Destructor.
+BlockBroyden::~BlockBroyden() {
+}
+
+//! Get the name of the SolverComponent
+const string& BlockBroyden::getXMLNameStatic() {
+    const static string SOLVER_NAME = "block-broyden-solver-component";
+    return SOLVER_NAME;
+}
+
+//! Get the name of the SolverComponent
+const string& BlockBroyden::getXMLName() const {
+    return getXMLNameStatic();
+}
+
+/*!
+ * \brief Solve the markets block by block in topological order.
+ * \details Each block is solved with LogBroyden::solve after restricting the
+ *          solvable set to the markets in that block.  A failure to solve one
+ *          block does not stop the blocks downstream of it from being solved
+ *          as they will still make progress from their current prices.  Should
+ *          every block solve but an earlier block no longer be solved once the
+ *          later ones are, the structure missed a dependency and all of the
+ *          markets are solved together.
+ * \param aSolutionSet The set of SolutionInfo objects representing all markets.
+ * \param aPeriod Model time period.
+ * \return SUCCESS if every block solved, otherwise the code of the last block
+ *         which did not.
+ */
+SolverComponent::ReturnCode BlockBroyden::solve( SolutionInfoSet& aSolutionSet, const int aPeriod ) {
+    // If all markets are solved, then return with success code.
+    if( aSolutionSet.isAllSolved() ) {
+        return SUCCESS;
+    }
+    
+    aSolutionSet.updateSolvable( mSolutionInfoFilter );
+    vector<vector<int> > blocks;
+    if( aSolutionSet.getNumSolvable() == 0 || !findBlocks( aSolutionSet, aPeriod, blocks ) ||
+        blocks.size() < 2 )
+    {
+        // nothing to gain from the decomposition
+        return LogBroyden::solve( aSolutionSet, aPeriod );
+    }
+    
+    ILogger& solverLog = ILogger::getLogger( "solver_log" );
+    const vector<SolutionInfo> solvables = aSolutionSet.getSolvableSet();
+    ISolutionInfoFilter* solutionInfoFilter = mSolutionInfoFilter;
+    ReturnCode code = SUCCESS;
+    for( size_t blockIndex = 0; blockIndex < blocks.size(); ++blockIndex ) {
+        BlockSolutionInfoFilter blockFilter;
+        for( int i : blocks[ blockIndex ] ) {
+            blockFilter.addMarket( solvables[ i ].getLinkedMarket() );
+        }
+        solverLog.setLevel( ILogger::NOTICE );
+        solverLog << "Solving block " << blockIndex << " of " << blocks.size()
+                  << " with " << blocks[ blockIndex ].size() << " markets." << endl;
+        
+        // LogBroyden::solve selects its markets using the solution info filter
+        // so swap in the one for this block while it is solved.
+        mSolutionInfoFilter = &blockFilter;
+        ReturnCode blockCode = LogBroyden::solve( aSolutionSet, aPeriod );
+        mSolutionInfoFilter = solutionInfoFilter;
+        if( blockCode != SUCCESS ) {
+            code = blockCode;
+        }
+    }
+    aSolutionSet.updateSolvable( mSolutionInfoFilter );
+    
+    if( code == SUCCESS ) {
+        const vector<SolutionInfo> allSolvables = aSolutionSet.getSolvableSet();
+        if( !all_of( allSolvables.begin(), allSolvables.end(), []( const SolutionInfo& aSolutionInfo ) {
+                return aSolutionInfo.isSolved(); } ) )
+        {
+            solverLog.setLevel( ILogger::WARNING );
+            solverLog << "Solving later blocks disturbed earlier ones, " << getXMLName()
+                      << " will solve all markets together." << endl;
+            code = LogBroyden::solve( aSolutionSet, aPeriod );
+        }
+    }
+    
+    return code;
+}
+
+/*!
+ * \brief Decompose the solvable markets into the blocks to solve in order.
+ * \details Each market is connected to the markets whose excess demand changes
+ *          when its price does as reported by LogEDFun::partialRows, which is
+ *          the same structure fdjac groups columns by and is derived from the
+ *          market dependency graph.  The strongly connected components of this
+ *          graph are found with Tarjan's algorithm, which is done iteratively
+ *          as the graph may be large enough to overflow the stack if recursion
+ *          were used.  Tarjan's algorithm produces the components in reverse
+ *          topological order.  Each component is then assigned a level one
+ *          greater than that of any component it depends on so that components
+ *          at the same level are independent.
+ * \param aSolutionSet The set of SolutionInfo objects with the solvable set
+ *                     already updated.
+ * \param aPeriod Model time period.
+ * \param aBlocks The list to fill with the indices into the solvable set of
+ *                the markets in each block in the order they should be solved.
+ * \return Whether the Jacobian structure is known, if not the blocks are not set.
+ */
+bool BlockBroyden::findBlocks( SolutionInfoSet& aSolutionSet, const int aPeriod,
+                               vector<vector<int> >& aBlocks ) const
+{
+    LogEDFun F( aSolutionSet, world, marketplace, aPeriod, mLogPricep );
+    const int numMarkets = F.narg();
+    vector<vector<int> > edges( numMarkets );
+    for( int j = 0; j < numMarkets; ++j ) {
+        if( !F.partialRows( j, edges[ j ] ) ) {
+            ILogger& solverLog = ILogger::getLogger( "solver_log" );
+            solverLog.setLevel( ILogger::WARNING );
+            solverLog << "The Jacobian structure is not known, " << getXMLName()
+                      << " will solve all markets together." << endl;
+            return false;
+        }
+    }
+    
+    const int UNVISITED = -1;
+    vector<int> index( numMarkets, UNVISITED );
+    vector<int> lowLink( numMarkets, 0 );
+    vector<int> component( numMarkets, UNVISITED );
+    vector<bool> isOnStack( numMarkets, false );
+    vector<int> visitStack;
+    // the market being visited and the next of its edges to follow
+    vector<pair<int, size_t> > callStack;
+    vector<vector<int> > components;
+    int nextIndex = 0;
+    for( int root = 0; root < numMarkets; ++root ) {
+        if( index[ root ] != UNVISITED ) {
+            continue;
+        }
+        index[ root ] = lowLink[ root ] = nextIndex++;
+        visitStack.push_back( root );
+        isOnStack[ root ] = true;
+        callStack.push_back( make_pair( root, 0 ) );
+        while( !callStack.empty() ) {
+            const int v = callStack.back().first;
+            if( callStack.back().second < edges[ v ].size() ) {
+                const int w = edges[ v ][ callStack.back().second++ ];
+                if( index[ w ] == UNVISITED ) {
+                    index[ w ] = lowLink[ w ] = nextIndex++;
+                    visitStack.push_back( w );
+                    isOnStack[ w ] = true;
+                    callStack.push_back( make_pair( w, 0 ) );
+                }
+                else if( isOnStack[ w ] ) {
+                    lowLink[ v ] = min( lowLink[ v ], index[ w ] );
+                }
+            }
+            else {
+                callStack.pop_back();
+                if( !callStack.empty() ) {
+                    const int u = callStack.back().first;
+                    lowLink[ u ] = min( lowLink[ u ], lowLink[ v ] );
+                }
+                if( lowLink[ v ] == index[ v ] ) {
+                    // v is the root of a component made up of everything above
+                    // it on the stack
+                    components.push_back( vector<int>() );
+                    int w;
+                    do {
+                        w = visitStack.back();
+                        visitStack.pop_back();
+                        isOnStack[ w ] = false;
+                        component[ w ] = components.size() - 1;
+                        components.back().push_back( w );
+                    } while( w != v );
+                }
+            }
+        }
+    }
+    
+    // Components a component depends on come after it so going backwards the
+    // level of each component is final by the time it is reached.
+    vector<int> level( components.size(), 0 );
+    int numLevels = 0;
+    size_t largestBlock = 0;
+    aBlocks.clear();
+    for( int c = components.size() - 1; c >= 0; --c ) {
+        for( int j : components[ c ] ) {
+            for( int i : edges[ j ] ) {
+                if( component[ i ] != c ) {
+                    level[ component[ i ] ] = max( level[ component[ i ] ], level[ c ] + 1 );
+                }
+            }
+        }
+        numLevels = max( numLevels, level[ c ] + 1 );
+        largestBlock = max( largestBlock, components[ c ].size() );
+        if( !mGroupIndependentBlocks ) {
+            aBlocks.push_back( components[ c ] );
+        }
+    }
+    if( mGroupIndependentBlocks ) {
+        aBlocks.resize( numLevels );
+        for( int c = components.size() - 1; c >= 0; --c ) {
+            aBlocks[ level[ c ] ].insert( aBlocks[ level[ c ] ].end(), components[ c ].begin(), components[ c ].end() );
+        }
+    }
+    for( vector<int>& block : aBlocks ) {
+        sort( block.begin(), block.end() );
+    }
+    
+    ILogger& solverLog = ILogger::getLogger( "solver_log" );
+    solverLog.setLevel( ILogger::NOTICE );
+    solverLog << "Block decomposition of " << numMarkets << " markets: " << components.size()
+              << " blocks over " << numLevels << " levels, the largest block has "
+              << largestBlock << " markets." << endl;
+    return true;
+}
@@ -69,6 +69,9 @@
 
 #include <Eigen/LU>
 #include <Eigen/SVD>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseLU>
+#include <Eigen/OrderingMethods>
 
 #include "util/base/include/timer.h"
 
@@ -104,6 +107,139 @@ namespace {
       }
     }
   } 
+
+  /*!
+   * \brief A factorization of the Broyden Jacobian which is kept up to date
+   *        with the secant updates rather than refactored each iteration.
+   * \details The Jacobian is factored with either a dense or a sparse LU when
+   *          it is (re)set.  Each secant update B' = B + u v^T is then applied
+   *          in product form using the Sherman-Morrison formula:
+   *          B'^-1 y = B^-1 y - p (v^T B^-1 y) / sigma where p = B^-1 u and
+   *          sigma = 1 + v^T p.  A solve therefore costs O(n^2) plus O(n) per
+   *          update instead of the O(n^3) of a new factorization.  Sigma is the
+   *          ratio det(B') / det(B) so when it approaches zero the updated matrix
+   *          is becoming singular and it should be refactored from scratch.
+   */
+  class BroydenFactorization {
+  public:
+    BroydenFactorization():mType(NONE) {}
+
+    //! Whether there is a factorization to solve with.
+    bool isFactored() const {return mType != NONE;}
+
+    //! The number of secant updates applied since the last factorization.
+    size_t getNumUpdates() const {return mP.size();}
+
+    //! Discard the factorization, for instance when B has been recalculated.
+    void reset() {
+      mType = NONE;
+      mP.clear();
+      mV.clear();
+      mSigma.clear();
+    }
+
+    /*!
+     * \brief Factor B with a dense partial pivot LU.
+     * \return Whether B is non-singular.
+     */
+    bool factorDense(const UBMATRIX &B) {
+      reset();
+      mDenseLU.compute(B);
+      if(mDenseLU.determinant() == 0) {
+        return false;
+      }
+      mType = DENSE;
+      return true;
+    }
+
+    /*!
+     * \brief Factor B with a sparse LU using a COLAMD ordering to reduce the
+     *        fill in of the factors.
+     * \details The fill and the time taken are written to the given log.
+     * \return Whether the factorization succeeded, if not the matrix should be
+     *         considered singular.
+     */
+    bool factorSparse(const UBMATRIX &B, ILogger &aSolverLog) {
+      reset();
+      Timer sparseTimer;
+      sparseTimer.start();
+      Eigen::SparseMatrix<double> sparseB = B.sparseView();
+      mSparseLU.analyzePattern(sparseB);
+      mSparseLU.factorize(sparseB);
+      sparseTimer.stop();
+      if(mSparseLU.info() != Eigen::Success) {
+        aSolverLog << "Sparse LU failed: " << mSparseLU.lastErrorMessage() << "\n";
+        return false;
+      }
+      aSolverLog << "Sparse LU time: " << sparseTimer.getTotalTimeDifference()
+                 << " nnz(B): " << sparseB.nonZeros()
+                 << " nnz(L+U): " << (mSparseLU.nnzL() + mSparseLU.nnzU()) << "\n";
+      mType = SPARSE;
+      return true;
+    }
+
+    /*!
+     * \brief Solve B x = b with the current, updated, factorization.
+     * \pre isFactored()
+     */
+    void solve(const UBVECTOR &b, UBVECTOR &x) const {
+      if(mType == DENSE) {
+        x = mDenseLU.solve(b);
+      }
+      else {
+        x = mSparseLU.solve(b);
+      }
+      for(size_t k=0; k<mP.size(); ++k) {
+        x -= mP[k] * (mV[k].dot(x) / mSigma[k]);
+      }
+    }
+
+    /*!
+     * \brief Apply the secant update B' = B + u v^T to the factorization.
+     * \param u The update column vector.
+     * \param v The update row vector.
+     * \return Whether the update could be applied, if not the factorization has
+     *         been reset as the updated matrix is close to singular.
+     */
+    bool update(const UBVECTOR &u, const UBVECTOR &v) {
+      // relative to the size of the vectors sigma is effectively zero
+      const double SIGMA_TOL = 1.0e-8;
+      UBVECTOR p(u.size());
+      solve(u, p);
+      double sigma = 1.0 + v.dot(p);
+      if(!util::isValidNumber(sigma) || fabs(sigma) < SIGMA_TOL * std::max(1.0, v.norm() * p.norm())) {
+        reset();
+        return false;
+      }
+      mP.push_back(p);
+      mV.push_back(v);
+      mSigma.push_back(sigma);
+      return true;
+    }
+
+  private:
+    //! The type of factorization which was done.
+    enum {
+      NONE,
+      DENSE,
+      SPARSE
+    } mType;
+
+    //! The dense factorization if mType is DENSE.
+    Eigen::PartialPivLU<UBMATRIX> mDenseLU;
+
+    //! The sparse factorization if mType is SPARSE.
+    Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int> > mSparseLU;
+
+    //! The solutions p = B^-1 u of each update applied in order.
+    std::vector<UBVECTOR> mP;
+
+    //! The row vectors v of each update applied in order.
+    std::vector<UBVECTOR> mV;
+
+    //! The value 1 + v^T p of each update applied in order.
+    std::vector<double> mSigma;
+  };
 }
 
 int LogBroyden::mLastPer = 0;
@@ -340,6 +476,9 @@ int LogBroyden::bsolve(VecFVec &F, UBVECTOR &x, UBVECTOR &fx,
 {
   int nrow = B.rows(), ncol = B.cols();
   int ageB = 0;   // number of iterations since the last reset on B
+  // The factorization of B which is updated along with the secant updates on
+  // B and only refactored when B is reset or it becomes close to singular.
+  BroydenFactorization factorB;
   // svd decomposition elements (note nrow == ncol)
 
   ILogger &solverLog = ILogger::getLogger("solver_log");
@@ -494,12 +633,41 @@ int LogBroyden::bsolve(VecFVec &F, UBVECTOR &x, UBVECTOR &fx,
       }
 #endif
       
-      // start with partial pivot LU decomposition as it is so fast to execute and
-      // see if we need to fall back to an alternative if it doesn't "perform" well
-      Eigen::PartialPivLU<UBMATRIX> luPartialPiv(B);
-      dx = luPartialPiv.solve(-fx);
-      double dxmag = sqrt(dx.dot(dx));
-      if(luPartialPiv.determinant() == 0 || !util::isValidNumber(dxmag)) {
+      bool isSingular = false;
+      double dxmag = 0.0;
+      if(factorB.isFactored()) {
+          // B has only changed by secant updates since it was last factored
+          factorB.solve(-fx, dx);
+          dxmag = sqrt(dx.dot(dx));
+          solverLog << "Solved with " << factorB.getNumUpdates() << " rank-one updates\n";
+          if(!util::isValidNumber(dxmag)) {
+              solverLog << "Invalid step from updated factorization, refactoring\n";
+              factorB.reset();
+          }
+      }
+      if(!factorB.isFactored()) {
+          // A freshly calculated Jacobian is typically very sparse, in which case a
+          // sparse factorization is much cheaper.  Note the secant update fills in B
+          // so this will generally only apply right after a Jacobian reset.
+          const int SPARSE_MIN_SIZE = 100;
+          bool useSparse = false;
+          if(mSparseDensityThreshold > 0.0 && nrow >= SPARSE_MIN_SIZE) {
+              double density = static_cast<double>((B.array() != 0.0).count()) / (static_cast<double>(nrow) * ncol);
+              useSparse = density <= mSparseDensityThreshold;
+              solverLog << "Jacobian density: " << density << (useSparse ? ", using sparse LU" : "") << "\n";
+          }
+          // otherwise start with partial pivot LU decomposition as it is so fast to
+          // execute and see if we need to fall back to an alternative if it doesn't
+          // "perform" well
+          isSingular = useSparse ? !factorB.factorSparse(B, solverLog) : !factorB.factorDense(B);
+          if(!isSingular) {
+              factorB.solve(-fx, dx);
+              dxmag = sqrt(dx.dot(dx));
+          }
+      }
+      if(isSingular || !util::isValidNumber(dxmag)) {
+          // the SVD can not be updated so the next iteration will refactor
+          factorB.reset();
           // singular or badly messed up Jacobian, going to have to use SVD
           solverLog << "Doing SVD, old dxmag:  " << dxmag;
           Eigen::BDCSVD<UBMATRIX> svdSolver(B, Eigen::ComputeThinU | Eigen::ComputeThinV);
@@ -677,6 +845,12 @@ int LogBroyden::bsolve(VecFVec &F, UBVECTOR &x, UBVECTOR &fx,
         fxstep -= B * xstep;
       fxstep /= dx2;
         B += fxstep * xstep.transpose();
+        if(!mUseFactorUpdate) {
+            factorB.reset();
+        }
+        else if(factorB.isFactored() && !factorB.update(fxstep, xstep)) {
+            solverLog << "Secant update is close to singular, B will be refactored\n";
+        }
       ageB++;                // increment the age of B
         // when only a _few_ markets are left which remain unsolved we will switch
         // to use fresh partial derivatives for *just* the unsolved markets as we may
@@ -687,6 +861,8 @@ int LogBroyden::bsolve(VecFVec &F, UBVECTOR &x, UBVECTOR &fx,
         const int UNSOLVED_FULL_PARTIAL_THRESHOLD = 30;
         if((unsolved.size()*UNSOLVED_FULL_PARTIAL_THRESHOLD) < ncol) {
             fdjac(F, xnew, fxnew, B, unsolved, true);
+            // the recalculated columns are not a rank-one change
+            factorB.reset();
         }
     }
     else {
@@ -703,6 +879,7 @@ int LogBroyden::bsolve(VecFVec &F, UBVECTOR &x, UBVECTOR &fx,
         fdjac(F,xnew,B,allCols);
         neval += x.size();
         ageB = 0;
+        factorB.reset();
 
         // Log the results of the Jacobian reset
         for(int j=0; j<F.narg(); ++j) {
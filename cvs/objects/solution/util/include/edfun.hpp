@@ -42,11 +42,13 @@
  */
 
 #include <vector>
+#include <unordered_map>
 #include "solution/util/include/solution_info_set.h"
 #include "solution/util/include/functor.hpp"
 
 class Marketplace;
 class World;
+class IActivity;
 
 
 /*!
@@ -93,6 +95,15 @@ class LogEDFun : public VecFVec
                        //!required.
   int period;
   bool mLogPricep;               //!< Flag indicating whether inputs are prices or log-prices
+  bool mPartialParallel;         //!< Flag indicating whether partial derivatives are calculated with flow graphs
+  bool mHasStructure;            //!< Flag indicating whether partialRows has looked up the Jacobian structure
+  bool mIsStructureKnown;        //!< Flag indicating whether the Jacobian structure could be found
+
+  //! The indices of the solvable markets each activity may change.
+  std::unordered_map<const IActivity*, std::vector<int> > mActivityRows;
+
+  //! The position of each activity in the global calculation ordering.
+  std::unordered_map<const IActivity*, size_t> mActivityOrder;
 
   // diagnostic variables
   std::vector<double> mstate;
@@ -101,7 +112,11 @@ public:
   
   // basic vector function interface
   virtual void operator()(const UBVECTOR &x, UBVECTOR &fx, const int partj=-1);
+  virtual void operator()(const UBVECTOR &x, UBVECTOR &fx, const std::vector<int> &partcols);
   virtual void partial(int ip);
+  virtual void partial(const std::vector<int> &aIndices);
+  virtual bool partialRows(int ip, std::vector<int> &aRows);
+  virtual void partialParallel(bool aIsParallel);
   virtual double partialSize(int ip) const;
   void scaleInitInputs(UBVECTOR &ax);
   void setSlope(UBVECTOR &adx);
@@ -118,6 +133,11 @@ protected:
   UBVECTOR mfxscl;
   // supply correction slope to use for prices below the "lower bound"
   UBVECTOR slope;
+
+private:
+  bool findStructure();
+  void getPartialActivities(const std::vector<int> &aIndices, std::vector<IActivity*> &aActivities) const;
+  void packOutputs(const UBVECTOR &x, UBVECTOR &fx);
     
 };  
 
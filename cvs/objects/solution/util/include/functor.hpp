@@ -45,6 +45,7 @@
  */
 
 #include <iostream>
+#include <vector>
 #include "solution/util/include/ublas-helpers.hpp"
 
 /*!
@@ -75,6 +76,19 @@ public:
    *         state that is modified by a normal call.
    */
   virtual void operator()(const UBVECTOR &arg, UBVECTOR &rval, const int partj = -1) = 0;
+  /*!
+   * Paren operator for a partial derivative evaluation in which several
+   * elements of the input vector have changed at once.
+   *
+   * This is only used by routines like fdjac when partialRows has
+   * shown that the given elements affect disjoint sets of rows.  The
+   * default implementation does a full evaluation.
+   *
+   * @param[in] arg: argument vector
+   * @param[out] rval: return value vector
+   * @param[in] partcols: The indices of the elements of arg that have changed.
+   */
+  virtual void operator()(const UBVECTOR &arg, UBVECTOR &rval, const std::vector<int> &partcols) {(*this)(arg, rval, -1);}
   /*!
    * Returns the length of the argument vector required by the function
    */
@@ -97,6 +111,41 @@ public:
    * \param ip: The index of the element of the input vector that has changed.
    */
   virtual void partial(int ip) {}
+  /*!
+   * Indicates that the next call will be for a partial derivative
+   * evaluation in which all of the given elements of the input vector
+   * have changed.  The default implementation ignores this hint.
+   *
+   * \param aIndices: The indices of the elements of the input vector that have changed.
+   */
+  virtual void partial(const std::vector<int> &aIndices) {}
+  /*!
+   * Get the elements of the return vector which may change when only
+   * the given element of the input vector changes, i.e. the structure
+   * of a column of the Jacobian.
+   *
+   * A routine like fdjac can use this to evaluate several partial
+   * derivatives that do not share any rows at once.  The default
+   * implementation does not know the structure.
+   *
+   * \param ip: The index of the element of the input vector.
+   * \param aRows: The list to fill with the indices of the affected elements of the return vector.
+   * \return Whether the structure is known, if false aRows should be ignored.
+   */
+  virtual bool partialRows(int ip, std::vector<int> &aRows) {return false;}
+  /*!
+   * Indicates whether subsequent partial derivative evaluations should
+   * themselves be evaluated in parallel.
+   *
+   * A routine like fdjac may run several partial derivatives at once.
+   * When there are too few of them to keep all of the available
+   * threads busy it can use this hint to ask the function to spread
+   * each evaluation across several threads instead.  The default
+   * implementation ignores this hint.
+   *
+   * \param aIsParallel: Whether partial derivatives should be evaluated in parallel.
+   */
+  virtual void partialParallel(bool aIsParallel) {}
   /*!
    * Returns an implementation-defined estimate of the amount of work required to compute a partial derivative
    *
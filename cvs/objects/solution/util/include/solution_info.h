@@ -78,7 +78,7 @@ class SolutionInfo {
     }
 public:
 #if GCAM_PARALLEL_ENABLED
-    SolutionInfo( Market* linkedMarket, const std::vector<IActivity*>& aDependenicies, GcamFlowGraph* aFlowGraph );
+    SolutionInfo( Market* linkedMarket, const std::vector<IActivity*>& aDependenicies, const int aMarketNumber );
 #else
     SolutionInfo( Market* linkedMarket, const std::vector<IActivity*>& aDependenicies );
 #endif
@@ -129,6 +129,7 @@ public:
     bool hasBisected() const;
     const std::vector<const objects::Atom*>& getContainedRegions() const;
     const std::vector<IActivity*>& getDependencies() const;
+    const Market* getLinkedMarket() const;
 
     double getLowerBoundSupplyPrice() const;
     double getUpperBoundSupplyPrice() const;
@@ -177,8 +178,12 @@ private:
 
 #if GCAM_PARALLEL_ENABLED
     //! A pointer weak pointer to a flow graph which can be used recalculate if this
-    // solution info adjusts it's price.
-    GcamFlowGraph* mFlowGraph;
+    // solution info adjusts it's price.  Note this is only looked up the first
+    // time it is needed.
+    mutable GcamFlowGraph* mFlowGraph;
+    
+    //! The market number of the linked market which is needed to look up mFlowGraph.
+    int mMarketNumber;
 #endif
     
     //! Market specific solution tolerance
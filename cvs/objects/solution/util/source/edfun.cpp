@@ -34,11 +34,13 @@
 #include <math.h>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
 
 #include "util/base/include/definitions.h"
 #include "solution/util/include/edfun.hpp"
 #include "containers/include/world.h"
 #include "marketplace/include/marketplace.h"
+#include "containers/include/market_dependency_finder.h"
 #include "util/base/include/util.h"
 #include "util/logger/include/ilogger.h"
 #include "containers/include/scenario.h"
@@ -59,6 +61,9 @@ LogEDFun::LogEDFun(SolutionInfoSet &sisin,
     solnset(sisin),
     world(w), mktplc(m), period(per),
     mLogPricep(aLogPricep),
+    mPartialParallel(false),
+    mHasStructure(false),
+    mIsStructureKnown(false),
     slope(UBVECTOR::Constant(mkts.size(), 1.0))
 {
     na=nr=mkts.size();
@@ -126,10 +131,11 @@ void LogEDFun::partial(int ip)
     Timer& edfunAnResetTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EDFUN_AN_RESET );
     edfunAnResetTimer.start();
     if(ip >= 0) {
-        // We are about to perform partial derviatives so snap back *all* state
+        // We are about to perform partial derviatives so snap back state
         // including prices/supplies/demands to a "base" state before we perform
-        // this partial derivative
-        scenario->mManageStateVars->copyState();
+        // this partial derivative.  Only the state the affected activities, or
+        // those of the previous partial derivative, may change needs to be reset.
+        scenario->mManageStateVars->copyState( mkts[ip].getDependencies() );
     }
     else if(ip == -1 ) {
         // We are calculating a full model run so ensure the partial derivative
@@ -141,12 +147,148 @@ void LogEDFun::partial(int ip)
 }
 
 
+/*!
+ * \brief Set whether partial derivatives should be evaluated using the flow graph
+ *        of the affected activities.
+ * \details This is only meaningful when GCAM_PARALLEL_ENABLED.  When set the
+ *          activities of a partial derivative may be calculated by several threads
+ *          at once so the marketplace must also lock markets as they get updated.
+ * \param aIsParallel Whether to use flow graphs for partial derivatives.
+ */
+void LogEDFun::partialParallel(bool aIsParallel)
+{
+#if GCAM_PARALLEL_ENABLED
+    mPartialParallel = aIsParallel;
+    mktplc->mIsParallelDerivativeCalc = aIsParallel;
+#endif
+}
+
+
 double LogEDFun::partialSize(int ip) const
 {
   return double(mkts[ip].getDependencies().size()) / double(world->getGlobalOrderingSize());
 }
 
 
+/*!
+ * \brief Reset the state before a partial derivative calculation in which the
+ *        prices of several markets change at once.
+ * \param aIndices The indices of the markets whose price will change.
+ */
+void LogEDFun::partial(const std::vector<int> &aIndices)
+{
+    if(aIndices.size() == 1) {
+        partial(aIndices.front());
+        return;
+    }
+    Timer& edfunAnResetTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EDFUN_AN_RESET );
+    edfunAnResetTimer.start();
+    std::vector<IActivity*> affectedNodes;
+    getPartialActivities(aIndices, affectedNodes);
+    scenario->mManageStateVars->copyState( affectedNodes );
+    edfunAnResetTimer.stop();
+}
+
+
+/*!
+ * \brief Get the markets whose outputs may change when the price of the given
+ *        market changes.
+ * \details The structure is derived from the dependency graph: a market is
+ *          affected if any of the activities which depend on the given market
+ *          may change it as reported by
+ *          MarketDependencyFinder::getActivityMarkets.  The market itself is
+ *          always included as its price is an input to its own output.
+ * \param ip The index of the market whose price changes.
+ * \param aRows The list to fill with the indices of the affected markets.
+ * \return Whether the structure is known.
+ * \warning This should not be called concurrently with itself.
+ */
+bool LogEDFun::partialRows(int ip, std::vector<int> &aRows)
+{
+    if(!mHasStructure) {
+        mHasStructure = true;
+        mIsStructureKnown = findStructure();
+    }
+    if(!mIsStructureKnown) {
+        return false;
+    }
+
+    aRows.clear();
+    aRows.push_back(ip);
+    for(IActivity* activity : mkts[ip].getDependencies()) {
+        auto activityRows = mActivityRows.find(activity);
+        if(activityRows == mActivityRows.end()) {
+            // not in the global ordering so we can not know what it writes
+            return false;
+        }
+        aRows.insert(aRows.end(), (*activityRows).second.begin(), (*activityRows).second.end());
+    }
+    std::sort(aRows.begin(), aRows.end());
+    aRows.erase(std::unique(aRows.begin(), aRows.end()), aRows.end());
+    return true;
+}
+
+
+/*!
+ * \brief Find the solvable markets each activity may change and the position of
+ *        each activity in the global ordering.
+ * \return Whether the dependency graph has every activity in the global ordering.
+ */
+bool LogEDFun::findStructure()
+{
+    std::unordered_map<const IActivity*, std::vector<const Market*> > activityMarkets;
+    mktplc->getDependencyFinder()->getActivityMarkets(period, activityMarkets);
+
+    // map the solvable markets to their index
+    std::unordered_map<const Market*, int> marketIndex;
+    for(size_t i=0; i<mkts.size(); ++i) {
+        marketIndex[mkts[i].getLinkedMarket()] = i;
+    }
+
+    const std::vector<IActivity*>& ordering = world->getGlobalOrdering();
+    for(size_t order=0; order<ordering.size(); ++order) {
+        auto markets = activityMarkets.find(ordering[order]);
+        if(markets == activityMarkets.end()) {
+            mActivityRows.clear();
+            mActivityOrder.clear();
+            return false;
+        }
+        mActivityOrder[ordering[order]] = order;
+        std::vector<int>& activityRows = mActivityRows[ordering[order]];
+        for(const Market* market : (*markets).second) {
+            auto index = marketIndex.find(market);
+            if(index != marketIndex.end()) {
+                activityRows.push_back((*index).second);
+            }
+        }
+        std::sort(activityRows.begin(), activityRows.end());
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Get the activities to recalculate when the prices of all of the given
+ *        markets change.
+ * \param aIndices The indices of the markets whose price changes.
+ * \param aActivities The list to fill with the union of the dependencies of
+ *                    each market in the global calculation order.
+ * \pre partialRows has found the structure.
+ */
+void LogEDFun::getPartialActivities(const std::vector<int> &aIndices, std::vector<IActivity*> &aActivities) const
+{
+    aActivities.clear();
+    for(int j : aIndices) {
+        const std::vector<IActivity*>& deps = mkts[j].getDependencies();
+        aActivities.insert(aActivities.end(), deps.begin(), deps.end());
+    }
+    std::sort(aActivities.begin(), aActivities.end(), [this](const IActivity* aLHS, const IActivity* aRHS) {
+        return (*mActivityOrder.find(aLHS)).second < (*mActivityOrder.find(aRHS)).second;
+    });
+    aActivities.erase(std::unique(aActivities.begin(), aActivities.end()), aActivities.end());
+}
+
+
 /*!
  * \brief Set the slope to use for the negative correction supply which
  *        is applied when prices are below the lower bound of supply behavior.
@@ -305,10 +447,21 @@ void LogEDFun::operator()(const UBVECTOR &ax, UBVECTOR &fx, const int partj)
     edfunPreTimer.stop();
     Timer& evalPartTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EVAL_PART );
     evalPartTimer.start();
-    // Note even when running with GCAM_PARALLEL_ENABLED we still run in serial
+    // Note even when running with GCAM_PARALLEL_ENABLED we typically run in serial
     // mode for partial derivatives.  This is because the loop over each partial
-    // derivative to run is a parallel_for.
+    // derivative to run is a parallel_for.  However when there are too few
+    // partial derivatives left to keep all threads busy fdjac will ask us to
+    // use the flow graph of the affected nodes instead.
+#if GCAM_PARALLEL_ENABLED
+    if(mPartialParallel) {
+        world->calc(period, mkts[partj].getFlowGraph(), &affectedNodes);
+    }
+    else {
+        world->calc(period, affectedNodes);
+    }
+#else
     world->calc(period, affectedNodes);
+#endif
     evalPartTimer.stop();
 
     if(mdiagnostic) {
@@ -330,7 +483,86 @@ void LogEDFun::operator()(const UBVECTOR &ax, UBVECTOR &fx, const int partj)
    * 3 Collect the outputs from the solutionInfo objects and repack them in the
    *   output vector
    ****/
+  packOutputs(x, fx);
   
+  edfunPostTimer.stop();
+
+  edfunMiscTimer.stop();
+}
+
+/*!
+ * \brief Evaluate a partial derivative calculation in which the prices of several
+ *        markets have changed at once.
+ * \details The markets must not share any rows as reported by partialRows so
+ *          that each affected output can be attributed to just one of them.
+ *          The union of the activities affected by each market is recalculated
+ *          in the global calculation order.
+ * \param ax The (scaled) inputs.
+ * \param fx The output vector to fill.
+ * \param partcols The indices of the markets whose price has changed.
+ */
+void LogEDFun::operator()(const UBVECTOR &ax, UBVECTOR &fx, const std::vector<int> &partcols)
+{
+  if(partcols.size() == 1) {
+    (*this)(ax, fx, partcols.front());
+    return;
+  }
+  assert(ax.size() == mkts.size());
+  assert(fx.size() == mkts.size());
+
+  Timer& edfunMiscTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EDFUN_MISC );
+  Timer& edfunPreTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EDFUN_PRE );
+  edfunMiscTimer.start();
+  edfunPreTimer.start();
+
+  UBVECTOR x(ax.size());
+  for(unsigned int i=0; i<x.size(); ++i)
+      x[i] = ax[i]*mxscl[i];
+
+  mktplc->mIsDerivativeCalc = true;
+  if(mLogPricep) {
+    for(size_t i=0; i<x.size(); ++i) {
+      if(x[i] > ARGMAX)
+        mkts[i].setPrice(PMAX);
+      else
+        mkts[i].setPrice(exp(x[i])); // input vector = log(price)
+    }
+  }
+  else {
+    // As in the single partial derivative case only the prices of the changed
+    // markets need to be set.
+    for(int j : partcols) {
+      mkts[j].setPrice(x[j]);
+    }
+  }
+
+  std::vector<IActivity*> affectedNodes;
+  getPartialActivities(partcols, affectedNodes);
+  edfunMiscTimer.stop();
+  edfunPreTimer.stop();
+  Timer& evalPartTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EVAL_PART );
+  evalPartTimer.start();
+  // There is no flow graph for a combination of markets so these are always
+  // calculated serially.
+  world->calc(period, affectedNodes);
+  evalPartTimer.stop();
+
+  edfunMiscTimer.start();
+  Timer& edfunPostTimer = TimerRegistry::getInstance().getTimer( TimerRegistry::EDFUN_POST );
+  edfunPostTimer.start();
+  packOutputs(x, fx);
+  edfunPostTimer.stop();
+  edfunMiscTimer.stop();
+}
+
+/*!
+ * \brief Collect the outputs from the solutionInfo objects and repack them in
+ *        the output vector.
+ * \param x The unscaled inputs the model was just evaluated at.
+ * \param fx The output vector to fill.
+ */
+void LogEDFun::packOutputs(const UBVECTOR &x, UBVECTOR &fx)
+{
   // at this point we've recalculated all the supplies and demands.
   // Retrieve them, calculate output according to market type, and
   // store them in fx
@@ -397,9 +629,4 @@ void LogEDFun::operator()(const UBVECTOR &ax, UBVECTOR &fx, const int partj)
   // Do the scaling for fx
   for(unsigned i=0; i<fx.size(); ++i)
       fx[i] *= mfxscl[i];
-  
-  edfunPostTimer.stop();
-
-  edfunMiscTimer.stop();
 }
-
@@ -30,16 +30,23 @@
 *
 */
 
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include "solution/util/include/fdjac.hpp"
 
 #if GCAM_PARALLEL_ENABLED
 #include <tbb/task_group.h>
 #include <tbb/parallel_for_each.h>
+#include <tbb/tick_count.h>
+#include "parallel/include/parallel_check.hpp"
 #endif
 
 #include "util/base/include/timer.h"
 #include "containers/include/scenario.h"
 #include "util/base/include/manage_state_variables.hpp"
+#include "util/base/include/configuration.h"
+#include "util/logger/include/ilogger.h"
 
 extern Scenario* scenario;
 
@@ -80,6 +87,151 @@ void jacol(VecFVec &F, const UBVECTOR &x,
   }
 }
 
+namespace {
+    /*!
+     * A set of structurally orthogonal Jacobian columns, i.e. columns which
+     * do not have any rows in common, that can be calculated together.
+     */
+    struct ColumnGroup {
+        //! The columns in this group.
+        std::vector<int> mCols;
+        
+        //! The rows which may be non-zero in each column of mCols.
+        std::vector<std::vector<int> > mRows;
+    };
+}
+
+/*!
+ * Compute several structurally orthogonal columns of a Jacobian matrix
+ * with a single evaluation of F.  Each column is perturbed by its own
+ * step and since no two columns share a row the change in each row can
+ * be attributed to just one of them.  Rows outside of a column's
+ * structure are set to zero.  Should a row outside of the structure of
+ * every column in the group change anyway the structure is wrong, so
+ * this is reported and each column is calculated on its own instead.
+ * Note a missing row which some other column in the group does have
+ * can not be detected this way, ParallelCheck compares to the columns
+ * calculated one at a time to catch those.
+ */
+static void jacolGroup(VecFVec &F, const UBVECTOR &x,
+                       const UBVECTOR &fx, const ColumnGroup &group,
+                       UBMATRIX &J) {
+  const double heps = 1.0e-6;
+  const double TINY = 1.0e-6;
+  UBVECTOR xx(x); // temporary, so we can respect the const on x
+  UBVECTOR fxx(fx.size());        // hold the values of F(xx)
+  std::vector<double> h(group.mCols.size());
+  
+  for(size_t k=0; k<group.mCols.size(); ++k) {
+    const int j = group.mCols[k];
+    double t = xx[j];
+    xx[j] = t+heps*(fabs(t)+TINY);
+    h[k] = xx[j]-t; // reduce roundoff error as in jacol
+  }
+  F.partial(group.mCols);
+  F(xx, fxx, group.mCols);
+  
+  std::vector<bool> isInStructure(fxx.size(), false);
+  for(const std::vector<int>& rows : group.mRows) {
+    for(int i : rows) {
+      isInStructure[i] = true;
+    }
+  }
+  for(size_t i=0; i<fxx.size(); ++i) {
+    if(!isInStructure[i] && fxx[i] != fx[i]) {
+      // only report the first time as this may be called from many threads
+      static std::atomic<bool> hasWarned(false);
+      if(!hasWarned.exchange(true)) {
+        ILogger& solverLog = ILogger::getLogger( "solver_log" );
+        solverLog.setLevel( ILogger::WARNING );
+        solverLog << "fdjac: row " << i << " changed outside of the Jacobian structure of columns";
+        for(int j : group.mCols) {
+          solverLog << " " << j;
+        }
+        solverLog << ", calculating grouped columns one at a time where this happens." << std::endl;
+      }
+      for(int j : group.mCols) {
+        jacol(F, x, fx, j, J, true, 0/*diagnostic*/);
+      }
+      return;
+    }
+  }
+  
+  for(size_t k=0; k<group.mCols.size(); ++k) {
+    const int j = group.mCols[k];
+    double hinv = 1.0/h[k];
+    for(size_t i=0; i<fxx.size(); ++i) {
+      J(i,j) = 0.0;
+    }
+    for(int i : group.mRows[k]) {
+      J(i,j) = (fxx[i] - fx[i]) * hinv;
+    }
+  }
+}
+
+/*!
+ * Partition the given Jacobian columns into groups of structurally
+ * orthogonal columns using the greedy Curtis-Powell-Reid coloring with
+ * the columns taken in order of decreasing number of rows.  When F can
+ * not provide the structure of every column each column is put in a
+ * group of its own.
+ * \param[in] F: The function to get the Jacobian structure from.
+ * \param[in] cols: The columns to partition.
+ * \param[out] groups: The groups of columns to calculate together.
+ */
+static void colorColumns(VecFVec &F, const std::list<int>& cols,
+                         std::vector<ColumnGroup>& groups) {
+  groups.clear();
+  std::vector<std::vector<int> > colRows(cols.size());
+  std::vector<int> colOrder(cols.begin(), cols.end());
+  bool isKnown = cols.size() > 1;
+  for(size_t k=0; isKnown && k<colOrder.size(); ++k) {
+    isKnown = F.partialRows(colOrder[k], colRows[k]);
+  }
+  if(!isKnown) {
+    for(int j : cols) {
+      ColumnGroup group;
+      group.mCols.push_back(j);
+      group.mRows.push_back(std::vector<int>());
+      groups.push_back(group);
+    }
+    return;
+  }
+  
+  std::vector<size_t> order(colOrder.size());
+  for(size_t k=0; k<order.size(); ++k) {
+    order[k] = k;
+  }
+  std::stable_sort(order.begin(), order.end(), [&colRows](size_t aLHS, size_t aRHS) {
+    return colRows[aLHS].size() > colRows[aRHS].size();
+  });
+  
+  // the groups, i.e. colors, which already use each row
+  std::vector<std::vector<int> > rowGroups(F.nrtn());
+  // marks the groups which conflict with the current column
+  std::vector<size_t> isConflict;
+  for(size_t k : order) {
+    for(int i : colRows[k]) {
+      for(int g : rowGroups[i]) {
+        isConflict[g] = k+1;
+      }
+    }
+    size_t g = 0;
+    while(g < groups.size() && isConflict[g] == k+1) {
+      ++g;
+    }
+    if(g == groups.size()) {
+      groups.push_back(ColumnGroup());
+      isConflict.push_back(0);
+    }
+    groups[g].mCols.push_back(colOrder[k]);
+    groups[g].mRows.push_back(colRows[k]);
+    for(int i : colRows[k]) {
+      rowGroups[i].push_back(g);
+    }
+  }
+}
+
 /*!
  * Compute the Jacobian of a vector function F at point x.
  * \tparam FTYPE: The floating point type of the input and output vectors
@@ -107,21 +259,76 @@ void fdjac(VecFVec &F, const UBVECTOR &x,
   jacTimer.start();
     if(usepartial) { scenario->getManageStateVariables()->setPartialDeriv(true); }
   
+    // Columns which do not share any rows can be calculated with a single
+    // model evaluation.  This requires partial derivatives so that only the
+    // activities affected by the perturbed columns are recalculated.
+    const static bool colorJacobian = Configuration::getInstance()->getBool( "color-jacobian", true, false );
+    std::vector<ColumnGroup> groups;
+    if(usepartial && colorJacobian && !diagnostic) {
+        colorColumns(F, cols, groups);
+        ILogger& solverLog = ILogger::getLogger( "solver_log" );
+        solverLog.setLevel( ILogger::DEBUG );
+        solverLog << "fdjac: " << cols.size() << " columns in " << groups.size() << " evaluations" << std::endl;
+    }
+    else {
+        for(int j : cols) {
+            ColumnGroup group;
+            group.mCols.push_back(j);
+            groups.push_back(group);
+        }
+    }
+  
 #if !GCAM_PARALLEL_ENABLED
-  for(int j : cols) {
-    jacol(F, x, fx, j, J, usepartial, diagnostic);
+  for(const ColumnGroup& group : groups) {
+    if(group.mCols.size() == 1) {
+      jacol(F, x, fx, group.mCols.front(), J, usepartial, diagnostic);
+    }
+    else {
+      jacolGroup(F, x, fx, group, J);
+    }
   }
 #else
     tbb::task_arena& threadPool = scenario->getManageStateVariables()->mThreadPool;
+    // When there are fewer columns than threads the column level parallelism
+    // alone will leave threads idle so we also ask F to evaluate each partial
+    // derivative with the flow graph of the affected activities.
+    const static int columnThreshold = Configuration::getInstance()->getInt( "partial-graph-column-threshold", -1, false );
+    const int threshold = columnThreshold < 0 ? threadPool.max_concurrency() : columnThreshold;
+    const bool usePartialGraph = usepartial && static_cast<int>( groups.size() ) < threshold;
+    F.partialParallel(usePartialGraph);
+    tbb::tick_count startTime = tbb::tick_count::now();
     tbb::task_group tg;
     threadPool.execute([&](){
         tg.run([&](){
-            tbb::parallel_for_each( cols, [&]( int j ) {
-                jacol(F, x, fx, j, J, usepartial, 0/*diagnostic*/);
+            tbb::parallel_for_each( groups, [&]( const ColumnGroup& group ) {
+                if(group.mCols.size() == 1) {
+                    jacol(F, x, fx, group.mCols.front(), J, usepartial, 0/*diagnostic*/);
+                }
+                else {
+                    jacolGroup(F, x, fx, group, J);
+                }
             });
         });
     });
     threadPool.execute([&tg](){ tg.wait(); });
+    const double parallelTime = (tbb::tick_count::now() - startTime).seconds();
+    F.partialParallel(false);
+    
+    // If requested recalculate the partial derivatives serially to check that
+    // the parallel calculation reproduced them.  The columns are calculated one
+    // at a time, without grouping, so this also catches errors in the Jacobian
+    // structure used to group them.  Delta state copies are verified in checked
+    // periods so these match a full copy of the state as well.
+    ParallelCheck& parallelCheck = ParallelCheck::getInstance();
+    if(usepartial && parallelCheck.shouldCheckJacobian()) {
+        UBMATRIX serialJ(J);
+        startTime = tbb::tick_count::now();
+        for(int j : cols) {
+            jacol(F, x, fx, j, serialJ, usepartial, 0/*diagnostic*/);
+        }
+        parallelCheck.checkJacobian(J, serialJ, cols, parallelTime,
+                                    (tbb::tick_count::now() - startTime).seconds());
+    }
 #endif
     if(usepartial) { F.partial(-1); }
 
@@ -48,12 +48,19 @@
 #include "marketplace/include/market.h"
 #include "util/logger/include/ilogger.h"
 #include "containers/include/info.h"
+#if GCAM_PARALLEL_ENABLED
+#include "containers/include/scenario.h"
+#include "marketplace/include/marketplace.h"
+#include "containers/include/market_dependency_finder.h"
+
+extern Scenario* scenario;
+#endif
 
 using namespace std;
 
 //! Constructor
 #if GCAM_PARALLEL_ENABLED
-SolutionInfo::SolutionInfo( Market* aLinkedMarket, const vector<IActivity*>& aDependencies, GcamFlowGraph* aFlowGraph )
+SolutionInfo::SolutionInfo( Market* aLinkedMarket, const vector<IActivity*>& aDependencies, const int aMarketNumber )
 #else
 SolutionInfo::SolutionInfo( Market* aLinkedMarket, const vector<IActivity*>& aDependencies )
 #endif
@@ -67,7 +74,8 @@ EDL( 0 ),
 EDR( 0 ),
 mDependencies( const_cast<vector<IActivity*>&>( aDependencies ) ),
 #if GCAM_PARALLEL_ENABLED
-mFlowGraph( aFlowGraph ),
+mFlowGraph( 0 ),
+mMarketNumber( aMarketNumber ),
 #endif
 mSolutionTolerance( 0 ),
 mSolutionFloor( 0 ),
@@ -631,6 +639,14 @@ const vector<IActivity*>& SolutionInfo::getDependencies() const {
     return mDependencies;
 }
 
+/*!
+ * \brief Get the market this solution info is associated with.
+ * \return The linked market.
+ */
+const Market* SolutionInfo::getLinkedMarket() const {
+    return linkedMarket;
+}
+
 /*!
  * \brief Get the market info from the associated market.
  * \return The appropriate market info object.
@@ -643,9 +659,16 @@ const IInfo* SolutionInfo::getMarketInfo() const {
 /*
  * \brief Get a flow graph with the items which are affected by changing the price
  *        of this solution info.
+ * \details The flow graph is built the first time it is requested.  Generating
+ *          a graph for every market up front does not typically get paid back
+ *          since they are only used when there are too few partial derivatives
+ *          left to calculate to keep all of the threads busy.
  * \return A flow graph to recalculate when this solution info's price changes.
  */
 GcamFlowGraph* SolutionInfo::getFlowGraph() const {
+    if( !mFlowGraph ) {
+        mFlowGraph = scenario->getMarketplace()->getDependencyFinder()->getFlowGraph( mMarketNumber );
+    }
     return mFlowGraph;
 }
 #endif
@@ -100,12 +100,9 @@ void SolutionInfoSet::init( const unsigned int aPeriod, const double aDefaultSol
         const int marketNumber = iter - marketsToSolve.begin();
         const vector<IActivity*> partialList = isSolvable ? depFinder->getOrdering( marketNumber ) : vector<IActivity*>();
 #if GCAM_PARALLEL_ENABLED
-        // TODO: As it turns out the extra time generating these graphs does not typically
-        // get paid back in terms of time saved while calculating partial derivatives.  At
-        // least in a single scenario run.  We need to come up with some methodology to figure
-        // out when it is beneficial to do this or not until then we are not generating any.
-        SolutionInfo currInfo( *iter, partialList, 
-               /*isSolvable ? depFinder->getFlowGraph( marketNumber ) :*/ 0 );
+        // Note the flow graph for partial derivatives will only be generated if
+        // it is actually needed.
+        SolutionInfo currInfo( *iter, partialList, marketNumber );
 #else
         SolutionInfo currInfo( *iter, partialList );
 #endif
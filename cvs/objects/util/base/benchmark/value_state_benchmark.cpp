@@ -0,0 +1,179 @@
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ *
+ */
+
+
+
+/*!
+ * \file value_state_benchmark.cpp
+ * \ingroup util
+ * \brief Micro-benchmark of the state slot lookup used by Value.
+ * \details Compares accessing STATE Values through the thread local cached
+ *          slot (Value::getCentralValue) against looking up the slot through
+ *          tbb::enumerable_thread_specific::local() on every access which is
+ *          what Value did previously.  Each access is one read and one write
+ *          of a Value whose state IDs are scattered over the state array.
+ *
+ *          This is built standalone (see the value_benchmark target in
+ *          build/linux/Makefile) and so does not link against libgcam.  It
+ *          only compiles util/base/source/value.cpp which holds the out of
+ *          line parts of Value.
+ *
+ *          Usage: value_benchmark.exe [num-states] [num-repeats]
+ */
+
+#include <iostream>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include "util/base/include/value.h"
+
+using namespace std;
+
+#if !GCAM_PARALLEL_ENABLED
+
+int main( int argc, char* argv[] ) {
+    cout << "The state slot lookup is only relevant when GCAM_PARALLEL_ENABLED." << endl;
+    return 0;
+}
+
+#else
+
+/*!
+ * \brief Sets up STATE Values over a state array and times accessing them.
+ * \details Value grants this class access to its internals in order to set
+ *          up the STATE Values and to time the previous lookup directly.
+ */
+class ValueStateBenchmark {
+public:
+    ValueStateBenchmark( const uint32_t aNumStates );
+    ~ValueStateBenchmark();
+
+    double timeThreadLocalAccess( const int aNumRepeats );
+    double timeEnumerableThreadSpecificAccess( const int aNumRepeats );
+
+    //! A checksum over the state data to keep the compiler from removing the work.
+    double getChecksum() const;
+
+private:
+    //! The central state data which all mValues refer to.
+    vector<double> mStateData;
+
+    //! STATE Values with their IDs shuffled so accesses are scattered.
+    vector<Value> mValues;
+};
+
+ValueStateBenchmark::ValueStateBenchmark( const uint32_t aNumStates ):
+mStateData( aNumStates, 1.0 ),
+mValues( aNumStates )
+{
+    vector<uint32_t> ids( aNumStates );
+    iota( ids.begin(), ids.end(), 0 );
+    shuffle( ids.begin(), ids.end(), mt19937( 42 ) );
+    for( uint32_t i = 0; i < aNumStates; ++i ) {
+        mValues[ i ].mBits = Value::STATE_COPY_MASK | ids[ i ];
+    }
+    Value::sCentralValue = Value::CentralValueType( &mStateData[ 0 ] );
+    ++Value::sCentralValueEpoch;
+}
+
+ValueStateBenchmark::~ValueStateBenchmark() {
+    Value::sCentralValue.clear();
+    ++Value::sCentralValueEpoch;
+}
+
+/*!
+ * \brief Time accessing state through Value which uses the thread local cached slot.
+ * \param aNumRepeats The number of sweeps over all of the values.
+ * \return The average time per access in nanoseconds.
+ */
+double ValueStateBenchmark::timeThreadLocalAccess( const int aNumRepeats ) {
+    auto start = chrono::steady_clock::now();
+    for( int repeat = 0; repeat < aNumRepeats; ++repeat ) {
+        for( Value& value : mValues ) {
+            value += 1.0;
+        }
+    }
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / ( static_cast<double>( aNumRepeats ) * mValues.size() );
+}
+
+/*!
+ * \brief Time accessing state by looking up the slot with
+ *        tbb::enumerable_thread_specific::local() for each read and write.
+ * \param aNumRepeats The number of sweeps over all of the values.
+ * \return The average time per access in nanoseconds.
+ */
+double ValueStateBenchmark::timeEnumerableThreadSpecificAccess( const int aNumRepeats ) {
+    auto start = chrono::steady_clock::now();
+    for( int repeat = 0; repeat < aNumRepeats; ++repeat ) {
+        for( const Value& value : mValues ) {
+            const uint64_t id = Value::ID_MASK & value.mBits;
+            const double curr = Value::sCentralValue.local()[ id ];
+            Value::sCentralValue.local()[ id ] = curr + 1.0;
+        }
+    }
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / ( static_cast<double>( aNumRepeats ) * mValues.size() );
+}
+
+double ValueStateBenchmark::getChecksum() const {
+    return accumulate( mStateData.begin(), mStateData.end(), 0.0 );
+}
+
+int main( int argc, char* argv[] ) {
+    const uint32_t numStates = argc > 1 ? static_cast<uint32_t>( atol( argv[ 1 ] ) ) : 1 << 16;
+    const int numRepeats = argc > 2 ? atoi( argv[ 2 ] ) : 1000;
+    if( numStates == 0 || numRepeats <= 0 ) {
+        cerr << "Usage: " << argv[ 0 ] << " [num-states] [num-repeats]" << endl;
+        return 1;
+    }
+
+    ValueStateBenchmark states( numStates );
+    // warm up both paths before timing
+    states.timeEnumerableThreadSpecificAccess( 1 );
+    states.timeThreadLocalAccess( 1 );
+
+    const double etsTime = states.timeEnumerableThreadSpecificAccess( numRepeats );
+    const double threadLocalTime = states.timeThreadLocalAccess( numRepeats );
+
+    cout << "States: " << numStates << ", repeats: " << numRepeats << endl;
+    cout << "enumerable_thread_specific::local(): " << etsTime << " ns/access" << endl;
+    cout << "thread local cached slot:            " << threadLocalTime << " ns/access" << endl;
+    cout << "Checksum: " << states.getChecksum() << endl;
+    return 0;
+}
+
+#endif
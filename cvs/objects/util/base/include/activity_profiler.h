@@ -0,0 +1,156 @@
+#ifndef _ACTIVITY_PROFILER_H_
+#define _ACTIVITY_PROFILER_H_
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ *
+ */
+
+
+/*!
+ * \file activity_profiler.h
+ * \ingroup util
+ * \brief ActivityProfiler class header file.
+ */
+
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+#include <boost/core/noncopyable.hpp>
+
+#include "util/base/include/definitions.h"
+#include "containers/include/iactivity.h"
+
+#if GCAM_PARALLEL_ENABLED
+#include <atomic>
+#include <tbb/enumerable_thread_specific.h>
+#endif
+
+/*!
+ * \brief An opt-in profiler which records every call to IActivity::calc.
+ * \details When either the "activity-profile" or "activity-profile-collapsed"
+ *          output file is enabled in the configuration each activity calc made
+ *          through ActivityProfiler::calc is timed along with the thread it ran
+ *          on and the model period.  At the end of the run the individual calls
+ *          are written as Chrome trace-event JSON (viewable in chrome://tracing
+ *          or Perfetto) and the total time by period and activity is written in
+ *          the collapsed-stack format used by flame graph tools.
+ *
+ *          Each thread records into its own buffer so profiling does not
+ *          introduce any synchronization into the model calculation.  Every call
+ *          is included in the collapsed totals however each thread only keeps
+ *          its first "activity-profile-max-events" calls for the trace so that
+ *          long runs do not exhaust memory.
+ */
+class ActivityProfiler : private boost::noncopyable {
+public:
+    static ActivityProfiler& getInstance();
+
+    /*!
+     * \brief Calculate the given activity, recording the call if profiling is
+     *        enabled.
+     * \details This is the method all model calculations should use to call
+     *          IActivity::calc and is inlined so that there is only the cost of
+     *          a flag check when profiling is disabled.
+     * \param aActivity The activity to calculate.
+     * \param aPeriod The model period to calculate.
+     */
+    static inline void calc( IActivity* aActivity, const int aPeriod ) {
+        if( !sIsEnabled ) {
+            aActivity->calc( aPeriod );
+        }
+        else {
+            getInstance().profiledCalc( aActivity, aPeriod );
+        }
+    }
+
+    void writeProfile() const;
+
+private:
+    ActivityProfiler();
+
+    void profiledCalc( IActivity* aActivity, const int aPeriod );
+
+    typedef std::chrono::steady_clock Clock;
+
+    //! A single timed call to IActivity::calc.
+    struct CalcEvent {
+        //! The activity which was calculated.
+        const IActivity* mActivity;
+
+        //! The model period calculated.
+        int mPeriod;
+
+        //! The start of the call in microseconds since the profiler was created.
+        double mStart;
+
+        //! The duration of the call in microseconds.
+        double mDuration;
+    };
+
+    //! The calls recorded by a single thread.
+    struct ThreadProfile {
+        ThreadProfile();
+
+        //! A unique identifier for the thread to use in the trace.
+        int mThreadID;
+
+        //! The individual calls kept for the trace.
+        std::vector<CalcEvent> mEvents;
+
+        //! The total time in microseconds spent in each activity by period.
+        std::vector<std::unordered_map<const IActivity*, double> > mTotalTime;
+    };
+
+    //! A flag for if profiling is enabled which is checked on every calc.
+    static bool sIsEnabled;
+
+    //! The time the profiler was created which is used as the origin of the trace.
+    const Clock::time_point mStartTime;
+
+    //! The maximum number of calls each thread will keep for the trace.
+    size_t mMaxEventsPerThread;
+
+#if GCAM_PARALLEL_ENABLED
+    //! The next identifier to assign to a thread.
+    static std::atomic<int> sNextThreadID;
+
+    //! The calls recorded by each thread.
+    tbb::enumerable_thread_specific<ThreadProfile> mThreadProfiles;
+#else
+    //! The calls recorded by the one and only thread.
+    ThreadProfile mThreadProfile;
+#endif
+};
+
+#endif // _ACTIVITY_PROFILER_H_
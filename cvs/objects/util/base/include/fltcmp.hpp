@@ -37,6 +37,28 @@
 *
 */
 
+/*!
+ * \brief The distance between two doubles in "units in the last place" (ulp)
+ *
+ * Adjacent doubles are 1 ulp apart, identical doubles are 0 ulp apart.
+ * This is the measure used by dblcmp and is useful on its own to report
+ * how far apart two values which should agree actually are.
+ */
+inline int64_t dblulpdist(double x, double y)
+{
+  const int64_t moffset = int64_t(1)<<63;
+  union {int64_t i; double f;} x1,x2;
+  x1.f = x;
+  x2.f = y;
+  
+  if(x1.i < 0)
+    x1.i = moffset-x1.i;
+  if(x2.i < 0)
+    x2.i = moffset-x2.i;
+
+  return std::abs(x1.i-x2.i);
+}
+
 /*!
  * \brief Compare two doubles for approximate equality
  *
@@ -60,23 +82,7 @@
  */
 inline bool dblcmp(double x, double y, int64_t tol=5)
 {
-  const int64_t moffset = int64_t(1)<<63;
-  union {int64_t i; double f;} x1,x2;
-  x1.f = x;
-  x2.f = y;
-  
-  if(x1.i < 0)
-    x1.i = moffset-x1.i;
-  if(x2.i < 0)
-    x2.i = moffset-x2.i;
-
-  int64_t diff = std::abs(x1.i-x2.i);
-
-  if(diff <= tol)
-    return true;
-  else
-    return false;
-  
+  return dblulpdist(x, y) <= tol;
 }
 
 /*! \brief "loose" tolerance for dblcmp
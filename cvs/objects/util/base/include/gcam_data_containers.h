@@ -205,6 +205,7 @@
 #include "solution/solvers/include/solver_component.h"
 #include "solution/solvers/include/bisect_all.h"
 #include "solution/solvers/include/logbroyden.hpp"
+#include "solution/solvers/include/block_broyden.hpp"
 #include "solution/solvers/include/preconditioner.hpp"
 #include "util/base/include/data_definition_util.h"
 #include "util/base/include/fixed_interpolation_function.h"
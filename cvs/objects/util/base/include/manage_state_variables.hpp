@@ -44,11 +44,18 @@
  */
 
 #include <cassert>
-#include <forward_list>
+#include <atomic>
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include "util/base/include/definitions.h"
+#include "util/base/include/restart_file.h"
 
 class Value;
+class IActivity;
+class ITechnology;
+class Market;
+class NationalAccount;
 
 #if GCAM_PARALLEL_ENABLED
 #include <tbb/task_arena.h>
@@ -75,16 +82,31 @@ public:
     ManageStateVariables( const int aPeriod );
     ~ManageStateVariables();
     
+    static void invalidateStateCache();
+    
     void copyState();
     
+    void copyState( const std::vector<IActivity*>& aActivities );
+    
+    void recordActivityState( const std::vector<IActivity*>& aActivities, const int aPeriod );
+    
     void setPartialDeriv( const bool aIsPartialDeriv );
     
 #if GCAM_PARALLEL_ENABLED
-    //! A tbb task arena which is the closest tbb comes to a thread pool which we
+    //! The tbb task arena which is the closest tbb comes to a thread pool which we
     //! will insist parallel calculations use so that we can ensure that we have
     //! appropriately sized and allocated a slot in mStateData for each thread to
-    //! have as "scratch" space for it's computations.
-    tbb::task_arena mThreadPool;
+    //! have as "scratch" space for it's computations.  This is the Jacobian arena
+    //! shared through ExecutionResources.
+    tbb::task_arena& mThreadPool;
+    
+    //! A unique ID for mThreadPool which can be used by flow graphs to detect
+    //! that they were last run in a different thread pool.
+    const int mThreadPoolID;
+    
+    static double* getThreadState();
+    
+    static double* swapThreadState( double* aState );
 #endif
     
 private:
@@ -95,9 +117,52 @@ private:
     //! "scratch" space is copied over by the "base" state.  Without GCAM_PARALLEL_ENABLED
     //! only a single "scratch" state will be allocated, when it is enabled there
     //! will be as many as the max_concurrency the thread pool allows on the system
-    //! running the code.
+    //! running the code.  Each "scratch" state is only allocated when the thread
+    //! it is assigned to first uses it so that it is local to that thread's NUMA
+    //! node, until then it is null.
     double** mStateData;
     
+    //! A list of [begin, end) ranges of state IDs.
+    typedef std::vector<std::pair<uint32_t, uint32_t> > StateRanges;
+    
+    //! Whether copyState may only copy the state written by the activities of a
+    //! partial derivative rather than the full state.  This gets turned off if
+    //! a verified copy finds state the recorded writes missed.
+    std::atomic<bool> mUseDeltaCopy;
+    
+    //! Whether copyState should check each delta copy against the "base" state
+    //! which is done when DEBUG_STATE or when the period is being checked by
+    //! ParallelCheck.
+    bool mVerifyDeltaCopy;
+    
+    //! Whether state IDs should be reassigned so that the state each activity
+    //! writes is contiguous.
+    bool mClusterState;
+    
+    //! The current ID of each state value in the order they were collected, empty
+    //! if the IDs have not been reassigned by clusterState.
+    std::vector<uint32_t> mStateOrder;
+    
+    //! The ranges of state IDs written by each activity when it is calculated
+    //! as recorded by recordActivityState.
+    std::unordered_map<const IActivity*, StateRanges> mActivityStateRanges;
+    
+    //! The ranges of state IDs that belong to markets.  These are always copied
+    //! since the solver sets prices directly, outside of any activity.
+    StateRanges mMarketStateRanges;
+    
+    //! A counter which is incremented each time the "base" state may be changed
+    //! so that we can tell if a "scratch" state is still in sync with it.
+    uint64_t mBaseGeneration;
+    
+    //! The mBaseGeneration each "scratch" state was last fully copied from, or
+    //! INVALID_GENERATION if it has since been written in an unknown way.
+    std::vector<uint64_t> mSlotGeneration;
+    
+    //! The state ranges of the activities last calculated in each "scratch" state
+    //! which therefore must be copied again before the next partial derivative.
+    std::vector<std::vector<const StateRanges*> > mSlotDirtyRanges;
+    
     //! The period this state was collected for.
     int mPeriodToCollect;
     
@@ -113,43 +178,165 @@ private:
     //! be changed during World.calc( mPeriodToCollect ).
     uint64_t mNumCollected;
     
+    //! A hash of the structure of the model the state was collected from which
+    //! is stored with restart files to ensure they match the current scenario.
+    uint64_t mSchemaHash;
+    
+    //! A key which identifies each state value by its path in the model in the
+    //! order the state was collected.  These are stored with restart files so
+    //! that state can be matched by key when the structure has changed.
+    std::vector<uint64_t> mStateKeys;
+    
     //! The list of individual Values flagged as STATE that could possibly be
-    //! changed during World.calc( mPeriodToCollect ).  We store them in a list
-    //! since searching via GCAMFusion is a relatively expensive operation and we
-    //! will need to take three passes at them:
+    //! changed during World.calc( mPeriodToCollect ) in the order they were
+    //! collected.  We will need to take three passes at them:
     //! - Figure out how many we have so what we can allocate enough memory for mStateData.
     //! - Copy the actual data from each Value to initialize the "base" state.
     //! - When we are done with this period copy the "base" state back into each Value.
-    std::forward_list<Value*> mStateValues;
+    std::vector<Value*> mStateValues;
+    
+    //! The subset of mStateValues which belong to a Market.
+    std::vector<Value*> mMarketStateValues;
+    
+    /*!
+     * \brief The location of a Data flagged as STATE along with the containers
+     *        that determine whether its Values are active in a given period.
+     */
+    struct StateLocation {
+        //! The types of Data which may be flagged as STATE.
+        enum DataType {
+            SINGLE,
+            PERIOD_VECTOR,
+            TECH_VINTAGE_VECTOR,
+            YEAR_VECTOR
+        };
+        
+        //! The type of mData.
+        DataType mType;
+        
+        //! The Data which is a Value or one of the vectors of Value.
+        void* mData;
+        
+        //! The Technology the Data is in, if any.
+        const ITechnology* mTechnology;
+        
+        //! The Market the Data is in, if any.
+        const Market* mMarket;
+        
+        //! The NationalAccount the Data is in, if any.
+        const NationalAccount* mNationalAccount;
+        
+        //! The index of the container the Data is in into StateCache::mContainerKeys.
+        uint32_t mContainer;
+    };
+    
+    /*!
+     * \brief All of the Data flagged as STATE in the model.
+     * \details Searching via GCAMFusion is a relatively expensive operation and
+     *          the Data it finds do not depend on the period, only which Values are
+     *          active does.  So the search is only done when the structure of the
+     *          model may have changed and each period just checks which of the
+     *          found Data are active.
+     *
+     *          The cache holds raw pointers into the model so it is only valid for
+     *          as long as no container which holds, or may come to hold, Data
+     *          flagged as STATE is created, deleted or moved.  Anything which
+     *          does so must call invalidateStateCache.  As a cheap check the
+     *          number of market containers is recorded and the search is redone
+     *          should it change.  When DEBUG_STATE is set, or assertions are
+     *          enabled, collectState searches the model again each period to
+     *          verify the cache.
+     */
+    struct StateCache {
+        //! Whether the cache is up to date with the structure of the model.
+        bool mIsValid = false;
+        
+        //! The number of market containers in the marketplace when the search
+        //! was done.
+        size_t mNumMarkets = 0;
+        
+        //! Every Data flagged as STATE in the order they were found.
+        std::vector<StateLocation> mLocations;
+        
+        //! A key generated from the path to each container which has Data flagged
+        //! as STATE, or that has containers that do.
+        std::vector<uint64_t> mContainerKeys;
+    };
+    
+    //! The Data flagged as STATE found by the last search.
+    static StateCache sStateCache;
     
     void collectState();
     
+    static void findState();
+    
+    static bool isStateCacheCurrent();
+    
+    bool isActive( const StateLocation& aLocation ) const;
+    
+    static int getThreadSlotIndex();
+    
+    void copyRanges( double* aState, const StateRanges& aRanges ) const;
+    
+    bool verifyDeltaCopy( double* aState );
+    
+    void clusterState( std::vector<std::vector<uint32_t> >& aActivityWrites );
+    
     void resetState();
     
     std::string getRestartFileName() const;
     
+    std::string getRestartInputFileName() const;
+    
+    std::string getLegacyRestartFileName() const;
+    
     void loadRestartFile();
     
+    void loadRestartFileByKey( const RestartFile& aRestartFile, const RestartFile::Section& aSection );
+    
+    void loadLegacyRestartFile();
+    
     void saveRestartFile();
     
     /*!
      * \brief A helper struct to provide a call back to GCAMFusion as it searches
      *        for data flagged STATE.
-     * \details In addition to handling the processData call back we also are
-     *          interested in the push/pop filter steps, particularly for Technology
-     *          and MarketContainer to avoid collecting Data in a Technology or
-     *          Market that is going to be inactive during mPeriodToCollect.
+     * \details Each Data found is added to sStateCache.  In addition to handling
+     *          the processData call back we also are interested in the push/pop
+     *          filter steps, particularly for Technology and MarketContainer so we
+     *          can later avoid collecting Data in a Technology or Market that is
+     *          going to be inactive during a period.  The push/pop filter steps are
+     *          also used to keep track of the path to each Data so that a key which
+     *          identifies it can be generated.
      */
     struct DoCollect {
-        //! A reference to the containing class where each collected state data
-        //! will be added.
-        ManageStateVariables* mParentClass;
-        
-        //! A state variable while processing GCAMFusion which when set indicates
-        //! we are in a Technology or MarketContainer that is inactive in the
-        //! current period.  This flag gets reset when the corresponding popFilterStep
-        //! is found.
-        bool mIgnoreCurrValue = false;
+        //! The Technology GCAMFusion is currently in, if any.
+        const ITechnology* mCurrTechnology = 0;
+        
+        //! The Market GCAMFusion is currently in, if any.
+        const Market* mCurrMarket = 0;
+        
+        //! The NationalAccount GCAMFusion is currently in, if any.
+        const NationalAccount* mCurrNationalAccount = 0;
+        
+        //! A container on the path GCAMFusion has taken to the current data.
+        struct PathEntry {
+            //! The index of the container into StateCache::mContainerKeys.
+            uint32_t mContainer;
+            
+            //! The number of containers found directly in this container.
+            uint64_t mNumChildren;
+        };
+        
+        //! The containers GCAMFusion is currently in starting from the Scenario.
+        std::vector<PathEntry> mPath;
+        
+        void addStateLocation( const StateLocation::DataType aType, void* aData );
+        
+        template<typename ContainerType>
+        void pushPath( const ContainerType* aContainer );
+        
+        void popPath();
         
         // Templated callbacks for GCAMFusion
         template<typename DataType>
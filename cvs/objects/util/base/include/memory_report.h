@@ -0,0 +1,173 @@
+#ifndef _MEMORY_REPORT_H_
+#define _MEMORY_REPORT_H_
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ *
+ */
+
+
+
+/*!
+ * \file memory_report.h
+ * \ingroup util
+ * \brief MemoryReport class header file.
+ */
+
+#include <string>
+#include <map>
+#include <vector>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
+#include <iosfwd>
+#include <boost/core/noncopyable.hpp>
+
+#include "util/base/include/definitions.h"
+
+class Scenario;
+
+/*!
+ * \brief Accounts for the memory used by the model by class and by the type of
+ *        Data which uses it.
+ * \details GCAMFusion is used to walk every CONTAINER in the model starting at the
+ *          Scenario.  For each container the declared Data members are sized by
+ *          their own size plus any heap memory they own, such as the arrays of a
+ *          PeriodVector, YearVector or TechVintageVector, the characters of a
+ *          std::string or the nodes of a std::map.  These bytes are attributed to
+ *          the actual class of the container as well as to the type of the Data.
+ *          Each class also gets an inclusive total which adds the bytes of all of
+ *          the containers nested within it, giving a hierarchical view of where
+ *          the memory goes.  The XML retained by XMLParseHelper to defer parsing
+ *          until completeInit is reported separately.
+ *
+ *          The totals only include the Data declared with DEFINE_DATA, so members
+ *          not declared that way, virtual table pointers, padding and the overhead
+ *          of the allocator are not counted and the totals should be considered a
+ *          lower bound.  Note the inclusive total of a class which can be nested
+ *          within itself, such as a LandNode, counts the nested instances again.
+ */
+class MemoryReport : private boost::noncopyable {
+public:
+    MemoryReport();
+    
+    void calcFootprint( Scenario* aScenario );
+    
+    void printCSV( std::ostream& aOut ) const;
+    
+    uint64_t getTotalBytes() const;
+    
+private:
+    //! The number and total size of some kind of Data.
+    struct Totals {
+        //! The number of Data members.
+        uint64_t mCount = 0;
+        
+        //! The total bytes used by those members.
+        uint64_t mBytes = 0;
+    };
+    
+    //! The memory attributed to a single model class.
+    struct ClassTotals {
+        //! The number of instances of the class.
+        uint64_t mInstances = 0;
+        
+        //! The bytes of Data declared directly in instances of the class.
+        uint64_t mSelfBytes = 0;
+        
+        //! The bytes of instances of the class including all nested containers.
+        uint64_t mInclusiveBytes = 0;
+        
+        //! The self bytes broken down by type of Data.
+        std::map<std::string, Totals> mByType;
+    };
+    
+    //! Memory by model class.
+    std::unordered_map<std::type_index, ClassTotals> mClassTotals;
+    
+    //! Memory by type of Data across all classes.
+    std::map<std::string, Totals> mTypeTotals;
+    
+    //! The bytes of XML retained by XMLParseHelper.
+    uint64_t mStoredXMLBytes;
+    
+    //! The total bytes accounted for.
+    uint64_t mTotalBytes;
+    
+    /*!
+     * \brief The GCAMFusion callback which keeps track of the container currently
+     *        being visited and sizes the Data in each container as it is entered.
+     * \details Only the push and pop filter steps are needed as the Data of each
+     *          container is expanded and sized directly when it is entered.
+     */
+    struct DoAccount {
+        //! A container which is currently being visited.
+        struct Frame {
+            //! The totals for the class of the container.
+            ClassTotals* mClass;
+            
+            //! The bytes of the container including nested containers visited so far.
+            uint64_t mBytes;
+            
+            //! If this container, or a parent of it, has been visited before in
+            //! which case it has already been counted.
+            bool mIsDuplicate;
+        };
+        
+        DoAccount( MemoryReport& aReport );
+        
+        //! The report to add totals to.
+        MemoryReport& mReport;
+        
+        //! The stack of containers from the Scenario to the current container.
+        std::vector<Frame> mStack;
+        
+        //! All containers visited so far, which avoids double counting a container
+        //! which is referenced from more than one place.
+        std::unordered_set<const void*> mVisited;
+        
+        void pushContainer( const std::type_index& aType, const void* aContainer );
+        void popContainer();
+        void addData( const char* aType, const uint64_t aBytes );
+        
+        template<typename DataVectorType>
+        void processDataVector( DataVectorType aDataVector );
+        
+        template<typename DataType>
+        void pushFilterStep( const DataType& aData );
+        template<typename DataType>
+        void popFilterStep( const DataType& aData );
+    };
+};
+
+#endif // _MEMORY_REPORT_H_
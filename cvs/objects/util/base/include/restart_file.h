@@ -0,0 +1,262 @@
+#ifndef _RESTART_FILE_H_
+#define _RESTART_FILE_H_
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ *
+ */
+
+
+/*!
+ * \file restart_file.h
+ * \ingroup util
+ * \brief RestartFile class header file.
+ */
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/core/noncopyable.hpp>
+
+#include "util/base/include/definitions.h"
+
+/*!
+ * \brief Reads and writes the restart file which holds the solved state of the
+ *        model for any number of periods.
+ * \details A restart file starts with two copies of a fixed size header which
+ *          identifies the format and version, the revision of the model which
+ *          wrote it, and the location of a table of sections.  Each section holds
+ *          the state of a single period along with a hash of the structure of the
+ *          state it was collected from, the number of values, how they were
+ *          stored, and a checksum of the stored data.  The keys of the state only
+ *          depend on that structure so they are stored once for each hash rather
+ *          than once for each period.  The data of each section starts on a page
+ *          boundary so that uncompressed state can be mapped straight into memory
+ *          rather than read.
+ *
+ *          Sections are stored either uncompressed or with a simple lossless XOR
+ *          delta encoding which works well since neighboring state values tend to
+ *          share their sign, exponent and leading mantissa bits.
+ *
+ *          Sections are appended when they are written and only once the space of
+ *          replaced sections grows too large is the file rewritten to a temporary
+ *          file which is renamed over it.  An append writes the new data and
+ *          section table after the end of the file and only then overwrites the
+ *          older of the two header copies.  Each header has a sequence number and
+ *          a checksum so a reader uses the newest intact copy, thus if writing the
+ *          header is interrupted the file still reads as it was before the
+ *          append.  The appended data is synced to disk before the header is
+ *          written so that the header can not reach the disk ahead of the data
+ *          it refers to.  Existing section data is never modified so any
+ *          mappings stay valid.
+ */
+class RestartFile : private boost::noncopyable {
+public:
+    //! The ways in which the data of a section may be stored.
+    enum Compression {
+        //! The raw values.
+        NONE = 0,
+        
+        //! Each value XORed with the previous one with the zero bytes dropped.
+        XOR_DELTA = 1
+    };
+    
+    //! The kinds of data a section may hold.
+    enum SectionKind {
+        //! The state values of a period in the order they were collected.
+        STATE_VALUES = 0,
+        
+        //! A key which identifies each state value by its path in the model.
+        STATE_KEYS = 1
+    };
+    
+    /*!
+     * \brief An entry in the section table.
+     * \note The layout of this struct is the on disk format.
+     */
+    struct Section {
+        //! The model period of the data.
+        int32_t mPeriod;
+        
+        //! The SectionKind of the data.
+        uint32_t mKind;
+        
+        //! The Compression used to store the data.
+        uint32_t mCompression;
+        
+        //! Unused, kept zero.
+        uint32_t mReserved;
+        
+        //! A hash of the structure of the model the data was collected from.
+        uint64_t mSchemaHash;
+        
+        //! The number of values in the data.
+        uint64_t mNumValues;
+        
+        //! The offset of the stored data from the start of the file.
+        uint64_t mOffset;
+        
+        //! The number of bytes used to store the data.
+        uint64_t mStoredSize;
+        
+        //! A checksum of the stored data.
+        uint64_t mChecksum;
+        
+        //! Unused, kept zero.
+        uint64_t mReserved2;
+    };
+    
+    //! The data of a section to be written.
+    struct SectionData {
+        //! The kind of data.
+        SectionKind mKind;
+        
+        //! The data which must be an array of 64 bit values.
+        const void* mData;
+        
+        //! The number of values in mData.
+        uint64_t mNumValues;
+    };
+    
+    explicit RestartFile( const std::string& aFileName );
+    ~RestartFile();
+    
+    bool isValid() const;
+    
+    uint64_t getModelHash() const;
+    
+    const Section* findSection( const int aPeriod, const SectionKind aKind ) const;
+    
+    const Section* findSchemaSection( const uint64_t aSchemaHash, const SectionKind aKind ) const;
+    
+    bool readSection( const Section& aSection, void* aValues ) const;
+    
+    double* mapSection( const Section& aSection ) const;
+    
+    static bool writeSections( const std::string& aFileName, const int aPeriod, const uint64_t aSchemaHash,
+                               const std::vector<SectionData>& aSections, const bool aCompress );
+    
+    static uint64_t getCurrentModelHash();
+    
+    static uint64_t hashBytes( const void* aData, const size_t aSize, const uint64_t aHash = INITIAL_HASH );
+    
+    static uint64_t combineHash( const uint64_t aHash, const uint64_t aValue );
+    
+    //! The hash of no data.
+    static const uint64_t INITIAL_HASH = 14695981039346656037ULL;
+    
+private:
+    /*!
+     * \brief The header at the start of every restart file.
+     * \note The layout of this struct is the on disk format.
+     */
+    struct Header {
+        //! Identifies the file as a restart file.
+        char mMagic[ 8 ];
+        
+        //! The version of the format.
+        uint32_t mVersion;
+        
+        //! The number of entries in the section table.
+        uint32_t mNumSections;
+        
+        //! A hash of the revision of the model which wrote the file.
+        uint64_t mModelHash;
+        
+        //! The offset of the section table from the start of the file.
+        uint64_t mTableOffset;
+        
+        //! A checksum of the section table.
+        uint64_t mTableChecksum;
+        
+        //! Incremented each time the header is written, the header is stored
+        //! in the copy given by mSequence % NUM_HEADERS.
+        uint64_t mSequence;
+        
+        //! A checksum of all of the fields above.
+        uint64_t mHeaderChecksum;
+        
+        //! Unused, kept zero.
+        uint64_t mReserved;
+    };
+    
+    //! The number of copies of the header at the start of the file.
+    static const int NUM_HEADERS = 2;
+    
+    //! The name of the file.
+    std::string mFileName;
+    
+    //! The open file descriptor which is kept to map sections, or -1.
+    int mFD;
+    
+    //! The contents of the file, either mapped or read into mBuffer.
+    const char* mData;
+    
+    //! The size of the file in bytes.
+    size_t mSize;
+    
+    //! The contents of the file when it could not be mapped.
+    std::vector<char> mBuffer;
+    
+    //! The header read from the file.
+    Header mHeader;
+    
+    //! The section table read from the file.
+    std::vector<Section> mSections;
+    
+    bool isValidRange( const uint64_t aOffset, const uint64_t aSize ) const;
+    
+    void open();
+    
+    void close();
+    
+    static bool writeFile( const std::string& aFileName, std::vector<std::pair<Section, const char*> >& aSections );
+    
+    static bool appendSections( const std::string& aFileName, const uint64_t aFileSize,
+                                const uint64_t aPrevSequence,
+                                const std::vector<std::pair<Section, const char*> >& aSections,
+                                std::vector<std::pair<Section, const char*> >& aNewSections );
+    
+    static Header createHeader( const std::vector<Section>& aTable, const uint64_t aTableOffset,
+                                const uint64_t aSequence );
+    
+    static bool syncFile( const std::string& aFileName );
+    
+    static uint64_t hashHeader( const Header& aHeader );
+    
+    static void encode( const double* aValues, const uint64_t aNumValues, std::vector<char>& aOutput );
+    
+    static bool decode( const char* aData, const uint64_t aSize, double* aValues, const uint64_t aNumValues );
+};
+
+#endif // _RESTART_FILE_H_
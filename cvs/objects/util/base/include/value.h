@@ -46,6 +46,7 @@
 */
 // Should only include these in debug.
 #include <cassert>
+#include <vector>
 #include "util/base/include/util.h"
 #include "util/base/include/definitions.h"
 
@@ -70,6 +71,8 @@
 
 class Value {
     friend class ManageStateVariables;
+    //! The micro-benchmark in util/base/benchmark sets up STATE Values directly.
+    friend class ValueStateBenchmark;
     /*!
      * \brief Output stream operator to print a Value.
      * \details Output stream operators allow classes to be printed using the <<
@@ -179,10 +182,39 @@ private:
     //! is true.  Note we make this field static so that we can quickly swap state
     //! between a "base" state or some "scratch" value from a central location.
     static CentralValueType sCentralValue;
+    
+#if GCAM_PARALLEL_ENABLED
+    //! The calling thread's slot from sCentralValue cached in a plain thread local
+    //! so that accessing state does not need to go through the much slower lookup
+    //! of tbb::enumerable_thread_specific::local().
+    static inline thread_local double* sThreadCentralValue = 0;
+    
+    //! The sCentralValueEpoch at which sThreadCentralValue was last bound.
+    static inline thread_local uint64_t sThreadCentralValueEpoch = 0;
+    
+    //! Incremented each time sCentralValue is reassigned so that each thread knows
+    //! to re-bind sThreadCentralValue.  Note this is only changed when no
+    //! parallel calculations are running.
+    static inline uint64_t sCentralValueEpoch = 1;
+    
+    static double* bindThreadCentralValue();
+    static double* bindThreadCentralValueForWrite( const uint32_t aStateID );
+#endif
+    
+    static double* getCentralValue();
     //! A static reference into the "base" state of ManageStateVariables::mStateData
     //! mostly for convenience.
     static double* sBaseCentralValue;
     
+#if GCAM_PARALLEL_ENABLED
+    //! When set the ID of every STATE value that gets set is appended to this
+    //! list so that ManageStateVariables can learn which state each activity
+    //! writes.  It is only ever set while recording from a single thread.
+    //! Note this is only checked by the out of line bindThreadCentralValueForWrite
+    //! so that the normal path to set state does not pay for it.
+    static std::vector<uint32_t>* sStateWriteLog;
+#endif
+    
 #if DEBUG_STATE
     void doStateCheck() const;
 #endif
@@ -261,6 +293,21 @@ inline void Value::init( const double aNewValue ){
     }
 }
 
+/*!
+ * \brief Get the state slot the calling thread should use to look up STATE values.
+ * \details When GCAM_PARALLEL_ENABLED the slot is cached in a plain thread local
+ *          which only needs to be re-bound from sCentralValue when it has been
+ *          reassigned since the last time this thread looked.
+ * \return The state slot for the calling thread.
+ */
+inline double* Value::getCentralValue() {
+#if !GCAM_PARALLEL_ENABLED
+    return sCentralValue;
+#else
+    return sThreadCentralValueEpoch == sCentralValueEpoch ? sThreadCentralValue : bindThreadCentralValue();
+#endif
+}
+
 /*!
  * \brief An accessor method to get at the actual data held in this class.
  * \details This method will appropriately get the value locally or the centrally
@@ -269,11 +316,7 @@ inline void Value::init( const double aNewValue ){
  */
 inline double Value::getInternal() const {
     return (mBits & STATE_COPY_MASK) == STATE_COPY_MASK ?
-#if !GCAM_PARALLEL_ENABLED
-        sCentralValue[ID_MASK & mBits]
-#else
-        sCentralValue.local()[ID_MASK & mBits]
-#endif
+        getCentralValue()[ID_MASK & mBits]
         : convertToDouble(mBits);
 }
 
@@ -287,9 +330,12 @@ inline double Value::getInternal() const {
 inline void Value::setInternal(double const aDblValue) {
     if((mBits & STATE_COPY_MASK) == STATE_COPY_MASK) {
 #if !GCAM_PARALLEL_ENABLED
-        sCentralValue[ID_MASK & mBits] = aDblValue;
+        getCentralValue()[ID_MASK & mBits] = aDblValue;
 #else
-        sCentralValue.local()[ID_MASK & mBits] = aDblValue;
+        // Same as getCentralValue() except that the slow path is told which state
+        // is being set so that it may be recorded.
+        (sThreadCentralValueEpoch == sCentralValueEpoch ? sThreadCentralValue :
+            bindThreadCentralValueForWrite(static_cast<uint32_t>(ID_MASK & mBits)))[ID_MASK & mBits] = aDblValue;
 #endif
     }
     else {
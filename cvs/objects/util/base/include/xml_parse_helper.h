@@ -195,12 +195,14 @@ struct XMLParseHelper {
         char* nameC = memoryPool.allocate_string(aNode->name(), aNode->name_size());
         char* valueC = memoryPool.allocate_string(aNode->value(), aNode->value_size());
         rapidxml::xml_node<char>* copy = memoryPool.allocate_node(aNode->type(), nameC, valueC, aNode->name_size(), aNode->value_size());
+        getStoreXMLSizeRef() += sizeof(rapidxml::xml_node<char>) + aNode->name_size() + aNode->value_size();
         // copy attributes
         for(rapidxml::xml_attribute<char> *attr = aNode->first_attribute(); attr; attr = attr->next_attribute()) {
             char* nameC = memoryPool.allocate_string(attr->name(), attr->name_size());
             char* valueC = memoryPool.allocate_string(attr->value(), attr->value_size());
             rapidxml::xml_attribute<char>* attrCopy = memoryPool.allocate_attribute(nameC, valueC, attr->name_size(), attr->value_size());
             copy->append_attribute(attrCopy);
+            getStoreXMLSizeRef() += sizeof(rapidxml::xml_attribute<char>) + attr->name_size() + attr->value_size();
         }
         // recursively copy all element child nodes
         for(rapidxml::xml_node<char>* child = aNode->first_node(); child; child = child->next_sibling()) {
@@ -212,6 +214,15 @@ struct XMLParseHelper {
         return copy;
     }
     
+    /*!
+     * \brief Get the number of bytes of XML which have been copied into the "store xml"
+     *        memory pool by deepClone and not yet released by cleanupParser.
+     * \return The bytes of the copied nodes, attributes and their strings.
+     */
+    static size_t getStoreXMLSize() {
+        return getStoreXMLSizeRef();
+    }
+    
 private:
     /*!
      * \brief Get a reference to a memory pool which will be kept around long enough such that it
@@ -224,6 +235,15 @@ private:
         static rapidxml::memory_pool<char> GLOBAL_MEM_POOL;
         return GLOBAL_MEM_POOL;
     }
+    
+    /*!
+     * \brief Get a reference to the count of bytes copied into the "store xml" memory pool.
+     * \return A reference to the count which is reset during cleanupParser.
+     */
+    static size_t& getStoreXMLSizeRef() {
+        static size_t STORE_XML_SIZE = 0;
+        return STORE_XML_SIZE;
+    }
 };
 
 /*!
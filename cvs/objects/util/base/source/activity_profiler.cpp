@@ -0,0 +1,236 @@
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ *
+ */
+
+
+/*!
+ * \file activity_profiler.cpp
+ * \ingroup util
+ * \brief ActivityProfiler class source file.
+ */
+
+#include "util/base/include/definitions.h"
+#include <map>
+#include <algorithm>
+
+#include "util/base/include/activity_profiler.h"
+#include "util/base/include/configuration.h"
+#include "util/base/include/auto_file.h"
+#include "util/base/include/model_time.h"
+#include "containers/include/scenario.h"
+#include "util/logger/include/ilogger.h"
+
+using namespace std;
+
+extern Scenario* scenario;
+
+bool ActivityProfiler::sIsEnabled = false;
+
+#if GCAM_PARALLEL_ENABLED
+std::atomic<int> ActivityProfiler::sNextThreadID( 0 );
+#endif
+
+/*!
+ * \brief Constructor which checks the configuration to see if profiling is enabled.
+ */
+ActivityProfiler::ActivityProfiler():mStartTime( Clock::now() )
+{
+    const Configuration* conf = Configuration::getInstance();
+    sIsEnabled = conf->shouldWriteFile( "activity-profile", false ) ||
+        conf->shouldWriteFile( "activity-profile-collapsed", false );
+    mMaxEventsPerThread = max( conf->getInt( "activity-profile-max-events", 1000000, false ), 0 );
+}
+
+/*!
+ * \brief Get the singleton instance of the ActivityProfiler.
+ * \details The first call will check the configuration to enable profiling
+ *          so this should be called before the model calculations begin.
+ * \return The ActivityProfiler.
+ */
+ActivityProfiler& ActivityProfiler::getInstance() {
+    static ActivityProfiler ACTIVITY_PROFILER;
+    return ACTIVITY_PROFILER;
+}
+
+//! Constructor
+ActivityProfiler::ThreadProfile::ThreadProfile():
+#if GCAM_PARALLEL_ENABLED
+mThreadID( sNextThreadID++ )
+#else
+mThreadID( 0 )
+#endif
+{
+}
+
+/*!
+ * \brief Calculate the given activity and record the time it took in the profile
+ *        of the current thread.
+ * \param aActivity The activity to calculate.
+ * \param aPeriod The model period to calculate.
+ */
+void ActivityProfiler::profiledCalc( IActivity* aActivity, const int aPeriod ) {
+#if GCAM_PARALLEL_ENABLED
+    ThreadProfile& profile = mThreadProfiles.local();
+#else
+    ThreadProfile& profile = mThreadProfile;
+#endif
+    const Clock::time_point start = Clock::now();
+    aActivity->calc( aPeriod );
+    const Clock::time_point end = Clock::now();
+
+    CalcEvent event;
+    event.mActivity = aActivity;
+    event.mPeriod = aPeriod;
+    event.mStart = chrono::duration<double, micro>( start - mStartTime ).count();
+    event.mDuration = chrono::duration<double, micro>( end - start ).count();
+
+    if( profile.mEvents.size() < mMaxEventsPerThread ) {
+        profile.mEvents.push_back( event );
+    }
+    if( profile.mTotalTime.size() <= static_cast<size_t>( aPeriod ) ) {
+        profile.mTotalTime.resize( aPeriod + 1 );
+    }
+    profile.mTotalTime[ aPeriod ][ aActivity ] += event.mDuration;
+}
+
+/*!
+ * \brief Escape a string so that it may be written as a JSON string value.
+ * \param aStr The string to escape.
+ * \return The escaped string.
+ */
+static string escapeJSON( const string& aStr ) {
+    string ret;
+    ret.reserve( aStr.size() );
+    for( char c : aStr ) {
+        if( c == '"' || c == '\\' ) {
+            ret += '\\';
+            ret += c;
+        }
+        else if( static_cast<unsigned char>( c ) < 0x20 ) {
+            ret += ' ';
+        }
+        else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+/*!
+ * \brief Write the recorded activity calcs to the enabled profile files.
+ * \details The Chrome trace is written to "activity-profile" with one complete
+ *          event per call, using the thread identifier as the tid and the
+ *          model year as an argument.  The collapsed stacks are written to
+ *          "activity-profile-collapsed" with one line per period and activity of
+ *          the form "World::calc;<year>;<activity> <microseconds>" which can be
+ *          given directly to flamegraph.pl.  Activity descriptions are looked up
+ *          here so they must still be valid, i.e. this should be called before
+ *          the World is destroyed.
+ */
+void ActivityProfiler::writeProfile() const {
+    if( !sIsEnabled ) {
+        return;
+    }
+
+    const Configuration* conf = Configuration::getInstance();
+    const Modeltime* modeltime = scenario->getModeltime();
+    map<const IActivity*, string> descriptions;
+    auto getDescription = [&descriptions]( const IActivity* aActivity ) -> const string& {
+        auto iter = descriptions.find( aActivity );
+        if( iter == descriptions.end() ) {
+            iter = descriptions.insert( make_pair( aActivity, aActivity->getDescription() ) ).first;
+        }
+        return iter->second;
+    };
+
+#if GCAM_PARALLEL_ENABLED
+    vector<const ThreadProfile*> profiles;
+    for( const ThreadProfile& profile : mThreadProfiles ) {
+        profiles.push_back( &profile );
+    }
+#else
+    vector<const ThreadProfile*> profiles( 1, &mThreadProfile );
+#endif
+
+    size_t numEvents = 0;
+    AutoOutputFile traceFile( "activity-profile", "activity-profile.json",
+                              conf->shouldWriteFile( "activity-profile", false ) );
+    if( traceFile.shouldWrite() ) {
+        *traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool isFirst = true;
+        for( const ThreadProfile* profile : profiles ) {
+            for( const CalcEvent& event : profile->mEvents ) {
+                *traceFile << ( isFirst ? "\n" : ",\n" )
+                           << "{\"name\":\"" << escapeJSON( getDescription( event.mActivity ) )
+                           << "\",\"cat\":\"calc\",\"ph\":\"X\",\"pid\":0,\"tid\":" << profile->mThreadID
+                           << ",\"ts\":" << event.mStart << ",\"dur\":" << event.mDuration
+                           << ",\"args\":{\"period\":" << event.mPeriod
+                           << ",\"year\":" << modeltime->getper_to_yr( event.mPeriod ) << "}}";
+                isFirst = false;
+                ++numEvents;
+            }
+        }
+        *traceFile << "\n]}" << endl;
+    }
+
+    AutoOutputFile collapsedFile( "activity-profile-collapsed", "activity-profile-collapsed.txt",
+                                  conf->shouldWriteFile( "activity-profile-collapsed", false ) );
+    if( collapsedFile.shouldWrite() ) {
+        // sum the totals across threads and order by period then description so
+        // the output is the same regardless of which threads did the work
+        vector<map<string, double> > totals;
+        for( const ThreadProfile* profile : profiles ) {
+            if( totals.size() < profile->mTotalTime.size() ) {
+                totals.resize( profile->mTotalTime.size() );
+            }
+            for( size_t period = 0; period < profile->mTotalTime.size(); ++period ) {
+                for( auto activityTime : profile->mTotalTime[ period ] ) {
+                    totals[ period ][ getDescription( activityTime.first ) ] += activityTime.second;
+                }
+            }
+        }
+        for( size_t period = 0; period < totals.size(); ++period ) {
+            const int year = modeltime->getper_to_yr( period );
+            for( auto activityTime : totals[ period ] ) {
+                // semicolons separate frames so they can not appear in a frame name
+                string frame = activityTime.first;
+                replace( frame.begin(), frame.end(), ';', ',' );
+                *collapsedFile << "World::calc;" << year << ";" << frame << " "
+                               << static_cast<long long>( activityTime.second + 0.5 ) << endl;
+            }
+        }
+    }
+
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    mainLog.setLevel( ILogger::NOTICE );
+    mainLog << "Activity profile written for " << profiles.size() << " threads with "
+            << numEvents << " trace events." << endl;
+}
@@ -38,8 +38,15 @@
  * \author Pralit Patel
  */
 
+#include <cassert>
 #include <cstring>
 #include <fstream>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 #include "util/base/include/manage_state_variables.hpp"
 #include "util/base/include/value.h"
@@ -48,21 +55,21 @@
 #include "util/base/include/configuration.h"
 #include "util/base/include/gcam_fusion.hpp"
 #include "util/base/include/gcam_data_containers.h"
+#include "containers/include/iactivity.h"
+#include "marketplace/include/marketplace.h"
 
 #if GCAM_PARALLEL_ENABLED
-#include <tbb/concurrent_queue.h>
+#include <mutex>
 #include <tbb/global_control.h>
+#include "parallel/include/execution_resources.hpp"
+#include "parallel/include/parallel_check.hpp"
 #endif
 
 using namespace std;
 
 extern Scenario* scenario;
 
-// Note we must static initialize static class member variables in a cpp file and
-// since Value is header only and these particular fields are just as related to
-// ManageStateVariables it seems appropriate to initialize them to NULL here.
-Value::CentralValueType Value::sCentralValue( (double*)0 );
-double* Value::sBaseCentralValue( 0 );
+ManageStateVariables::StateCache ManageStateVariables::sStateCache;
 
 #if GCAM_PARALLEL_ENABLED
 #define NUM_STATES tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism)+1
@@ -70,33 +77,168 @@ double* Value::sBaseCentralValue( 0 );
 #define NUM_STATES 2
 #endif
 
+/*!
+ * \brief Allocate the memory for one state slot.
+ * \details Where possible fresh pages are mapped directly from the OS rather than
+ *          reusing memory from the allocator which another thread may have already
+ *          touched.  The pages are then zeroed by the calling thread so that under
+ *          the default first touch policy they are placed on the NUMA node of the
+ *          thread which will use them.
+ * \param aNumValues The number of state values the slot must hold.
+ * \return The newly allocated state slot.
+ * \sa freeStateSlot
+ */
+static double* allocateStateSlot( const uint64_t aNumValues ) {
+    const size_t size = max( aNumValues, uint64_t( 1 ) ) * sizeof( double );
+#if !defined(_WIN32)
+    void* slot = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( slot == MAP_FAILED ) {
+        ILogger& mainLog = ILogger::getLogger( "main_log" );
+        mainLog.setLevel( ILogger::SEVERE );
+        mainLog << "Failed to allocate a state slot of " << size << " bytes." << endl;
+        abort();
+    }
+#else
+    void* slot = new double[ max( aNumValues, uint64_t( 1 ) ) ];
+#endif
+    memset( slot, 0, size );
+    return static_cast<double*>( slot );
+}
+
+/*!
+ * \brief Release the memory of a state slot.
+ * \param aSlot The state slot to release, may be null.
+ * \param aNumValues The number of state values the slot was allocated for.
+ * \sa allocateStateSlot
+ */
+static void freeStateSlot( double* aSlot, const uint64_t aNumValues ) {
+    if( !aSlot ) {
+        return;
+    }
+#if !defined(_WIN32)
+    munmap( aSlot, max( aNumValues, uint64_t( 1 ) ) * sizeof( double ) );
+#else
+    delete[] aSlot;
+#endif
+}
+
+//! The generation of a "scratch" state whose contents are not known to match
+//! the "base" state other than in its dirty ranges.
+static const uint64_t INVALID_GENERATION = numeric_limits<uint64_t>::max();
+
 #if GCAM_PARALLEL_ENABLED
+//! Guards the bookkeeping of which state slots have been assigned to threads.
+static mutex sThreadStateSlotMutex;
+
+//! The next never assigned slot index, note 0 is always the "base" state.
+static int sNextThreadStateSlot = 1;
+
+//! Slots whose thread has exited and which may be assigned to a new thread.
+static vector<int> sFreeThreadStateSlots;
+
+//! Slots whose thread has exited but which Value::sCentralValue may still hold
+//! for that thread, they become free once Value::sCentralValue is reset.
+static vector<int> sReleasedThreadStateSlots;
+
+//! The generation of the slot assignment which is incremented each time the
+//! ManageStateVariables is rebuilt so that all threads get reassigned.
+static uint64_t sThreadStateSlotGeneration = 0;
+
+/*!
+ * \brief The state slot assigned to a thread which is returned for reuse when
+ *        the thread exits.
+ */
+struct ThreadStateSlot {
+    //! The index into ManageStateVariables::mStateData or -1 if the thread
+    //! has not yet been assigned one.
+    int mSlot = -1;
+    
+    //! The sThreadStateSlotGeneration mSlot was assigned in.
+    uint64_t mGeneration = 0;
+    
+    ~ThreadStateSlot() {
+        lock_guard<mutex> lock( sThreadStateSlotMutex );
+        if( mSlot != -1 && mGeneration == sThreadStateSlotGeneration ) {
+            sReleasedThreadStateSlots.push_back( mSlot );
+        }
+    }
+};
+
+//! The slot assigned to the current thread.
+static thread_local ThreadStateSlot sThreadStateSlot;
+
+/*!
+ * \brief Get the slot assigned to the calling thread, assigning one first if
+ *        it has none in the current generation.
+ * \return The index into ManageStateVariables::mStateData for the calling thread.
+ */
+static int assignThreadStateSlot() {
+    lock_guard<mutex> lock( sThreadStateSlotMutex );
+    if( sThreadStateSlot.mSlot == -1 || sThreadStateSlot.mGeneration != sThreadStateSlotGeneration ) {
+        if( !sFreeThreadStateSlots.empty() ) {
+            sThreadStateSlot.mSlot = sFreeThreadStateSlots.back();
+            sFreeThreadStateSlots.pop_back();
+        }
+        else {
+            sThreadStateSlot.mSlot = sNextThreadStateSlot++;
+        }
+        sThreadStateSlot.mGeneration = sThreadStateSlotGeneration;
+    }
+    return sThreadStateSlot.mSlot;
+}
+
+/*!
+ * \brief Make the slots of threads which have exited available to new threads.
+ * \details This may only be called as Value::sCentralValue is being reset since
+ *          a new thread could otherwise find the slot of an exited thread
+ *          still stored for it if the thread ID was recycled.
+ */
+static void recycleThreadStateSlots() {
+    lock_guard<mutex> lock( sThreadStateSlotMutex );
+    sFreeThreadStateSlots.insert( sFreeThreadStateSlots.end(), sReleasedThreadStateSlots.begin(),
+                                  sReleasedThreadStateSlots.end() );
+    sReleasedThreadStateSlots.clear();
+}
+
+/*!
+ * \brief Forget all slot assignments so that threads get assigned again
+ *        starting from the first slot.
+ */
+static void resetThreadStateSlots() {
+    lock_guard<mutex> lock( sThreadStateSlotMutex );
+    ++sThreadStateSlotGeneration;
+    sNextThreadStateSlot = 1;
+    sFreeThreadStateSlots.clear();
+    sReleasedThreadStateSlots.clear();
+}
+
 /*!
  * \brief A helper functor to assign a state slot in ManageStateVariables::mStateData
  *        to each worker thread in ManageStateVariables::mThreadPool.  This functor
  *        will get called the first time a new thread accesses the thread local
  *        storage Value::sCentralValue that provides access to mStateData by thread
  *        from with in the Value class.
+ * \details Each thread keeps the same slot index for as long as it lives and
+ *          this ManageStateVariables exists so that it keeps calculating in the
+ *          same slot.  The slot is returned for reuse when the thread exits so
+ *          that a pool which retires and creates threads does not run out of
+ *          slots.  The memory for the slot is only allocated once the thread
+ *          which owns it first needs it so that it resides on that thread's
+ *          NUMA node.
  */
 struct AssignThreadStateFun {
     //! A reference to ManageStateVariables::mStateData.
     double** mArr;
     
-    //! The maximum number of states that have been allocated in mStateData.
-    const int mMaxStates;
+    //! The maximum number of states that may be allocated in mStateData.
+    int mMaxStates;
     
-    //! A thread safe queue that will have as values each index into mStateData
-    //! and as each new thread consumes it's next value implies that thread gets
-    //! assigned that state slot.
-    tbb::concurrent_queue<int> mThreadStateIndex;
+    //! The number of values each state slot must hold.
+    uint64_t mNumValues;
     
     //! Constructor
-    AssignThreadStateFun( double** aArr, const int aMaxStates ):mArr( aArr ), mMaxStates( aMaxStates ) {
-        // initialize the state index slots starting from 1 as 0 is always the
-        // "base" state.
-        for( int i = 1; i < mMaxStates; ++i ) {
-            mThreadStateIndex.push( i );
-        }
+    AssignThreadStateFun( double** aArr, const int aMaxStates, const uint64_t aNumValues )
+    :mArr( aArr ), mMaxStates( aMaxStates ), mNumValues( aNumValues ) {
     }
     
     /*!
@@ -107,21 +249,45 @@ struct AssignThreadStateFun {
      * \return The unique slot of state that this thread can be guaranteed to use
      *         free from interference from any other thread.
      */
-    double* operator()() {
-        int nextState;
-        bool gotState = mThreadStateIndex.try_pop( nextState );
-        if( !gotState ) {
+    double* operator()() const {
+        const int slotIndex = assignThreadStateSlot();
+        if( slotIndex >= mMaxStates ) {
             ILogger& mainLog = ILogger::getLogger( "main_log" );
             mainLog.setLevel( ILogger::SEVERE );
             mainLog << "Failed to get an unused state to assign to a worker thread." << endl;
             abort();
         }
         
-        return mArr[ nextState ];
+        // only this thread may use this slot so there is no race to allocate it
+        double*& slot = mArr[ slotIndex ];
+        if( !slot ) {
+            slot = allocateStateSlot( mNumValues );
+        }
+        return slot;
     }
 };
 #endif
 
+/*!
+ * \brief Convert a list of state IDs into a sorted list of contiguous ranges.
+ * \param aStateIDs The state IDs which may be unsorted and contain duplicates,
+ *                  they will be sorted in place.
+ * \return The [begin, end) ranges which cover exactly aStateIDs.
+ */
+static vector<pair<uint32_t, uint32_t> > toStateRanges( vector<uint32_t>& aStateIDs ) {
+    sort( aStateIDs.begin(), aStateIDs.end() );
+    vector<pair<uint32_t, uint32_t> > ranges;
+    for( auto stateID : aStateIDs ) {
+        if( !ranges.empty() && stateID <= ranges.back().second ) {
+            ranges.back().second = max( ranges.back().second, stateID + 1 );
+        }
+        else {
+            ranges.push_back( make_pair( stateID, stateID + 1 ) );
+        }
+    }
+    return ranges;
+}
+
 /*!
  * \brief Constructor which calls collectState() to begin the process to find all
  *        state data during the given model period and allocate memory to hold
@@ -132,14 +298,45 @@ ManageStateVariables::ManageStateVariables( const int aPeriod ):
 #if !GCAM_PARALLEL_ENABLED
 mStateData( new double*[ NUM_STATES ] ),
 #else
-mThreadPool(),
+mThreadPool( ExecutionResources::getInstance().getArena( ExecutionResources::JACOBIAN ) ),
+mThreadPoolID( ExecutionResources::JACOBIAN ),
 mStateData( new double*[ NUM_STATES ] ),
 #endif
+mUseDeltaCopy( Configuration::getInstance()->getBool( "delta-state-copy", false, false ) ),
+mVerifyDeltaCopy( false ),
+mClusterState( Configuration::getInstance()->getBool( "cluster-state", true, false ) ),
+mBaseGeneration( 0 ),
+mSlotGeneration( NUM_STATES, INVALID_GENERATION ),
+mSlotDirtyRanges( NUM_STATES ),
 mPeriodToCollect( aPeriod ),
 mYearToCollect( scenario->getModeltime()->getper_to_yr( aPeriod ) ),
 mCCStartYear( mYearToCollect - scenario->getModeltime()->gettimestep( aPeriod ) + 1 ),
-mNumCollected( 0 )
+mNumCollected( 0 ),
+mSchemaHash( RestartFile::INITIAL_HASH )
 {
+#if !GCAM_PARALLEL_ENABLED
+    // Value only logs the state that gets set when GCAM_PARALLEL_ENABLED so the
+    // state each activity writes can not be recorded, the full state is always
+    // copied and the state is not clustered.
+    static bool hasWarned = false;
+    if( mUseDeltaCopy || mClusterState ) {
+        mUseDeltaCopy = false;
+        mClusterState = false;
+        const Configuration* conf = Configuration::getInstance();
+        if( !hasWarned && ( conf->getBool( "delta-state-copy", false, false ) ||
+                            conf->getBool( "cluster-state", false, false ) ) )
+        {
+            hasWarned = true;
+            ILogger& mainLog = ILogger::getLogger( "main_log" );
+            mainLog.setLevel( ILogger::WARNING );
+            mainLog << "delta-state-copy and cluster-state require GCAM_PARALLEL_ENABLED and will be ignored." << endl;
+        }
+    }
+#else
+    // the slot indices threads were assigned for a previous period do not
+    // carry over to this new set of state slots
+    resetThreadStateSlots();
+#endif
     collectState();
 }
 
@@ -150,27 +347,35 @@ mNumCollected( 0 )
 ManageStateVariables::~ManageStateVariables() {
     resetState();
     for( size_t stateInd = 0; stateInd < NUM_STATES; ++stateInd ) {
-        delete[] mStateData[ stateInd ];
+        freeStateSlot( mStateData[ stateInd ], mNumCollected );
     }
     delete[] mStateData;
 #if !GCAM_PARALLEL_ENABLED
     Value::sCentralValue = 0;
 #else
     Value::sCentralValue.clear();
+    ++Value::sCentralValueEpoch;
 #endif
     Value::sBaseCentralValue = 0;
 }
 
 /*!
- * \brief Search for all relevant STATE Values and allocate space for them in the
- *        central state data arrays.  The "base" state will get initialized as the
- *        actual value set in the individual Value objects before being collected.
+ * \brief Search the model for all Data flagged as STATE and store their locations
+ *        in sStateCache.
+ * \details This only needs to be done again once the structure of the model may
+ *          have changed as indicated by invalidateStateCache or by a change in
+ *          the number of market containers.
  */
-void ManageStateVariables::collectState() {
+void ManageStateVariables::findState() {
+    sStateCache.mLocations.clear();
+    sStateCache.mContainerKeys.clear();
+    sStateCache.mContainerKeys.push_back( RestartFile::INITIAL_HASH );
+    
     // Set up the GCAM Fusion steps as well as the callback struct that will handle
     // the results from the search.
     DoCollect doCollectProc;
-    doCollectProc.mParentClass = this;
+    DoCollect::PathEntry rootEntry = { 0, 0 };
+    doCollectProc.mPath.push_back( rootEntry );
     // Note an empty string for the data name indicates match any name.  The first
     // step that does not match any name nor value indicates a "descendant" step
     // allowing for GCAM fusion to search at any depth to find Data of any name
@@ -182,15 +387,153 @@ void ManageStateVariables::collectState() {
     // are set to true.
     GCAMFusion<DoCollect, true, true, true> gatherState( doCollectProc, collectStateSteps );
     gatherState.startFilter( scenario );
+    sStateCache.mIsValid = true;
+    sStateCache.mNumMarkets = scenario->getMarketplace()->mMarkets.size();
+    
+    // clean up GCAMFusion related memory
+    for( auto filterStep : collectStateSteps ) {
+        delete filterStep;
+    }
+}
+
+/*!
+ * \brief Indicate that the structure of the model may have changed so that the
+ *        next time state is collected the model must be searched again.
+ * \details This must be called whenever containers which may hold STATE Data are
+ *          created or deleted, for instance when the model is initialized or a
+ *          policy is set.
+ */
+void ManageStateVariables::invalidateStateCache() {
+    sStateCache.mIsValid = false;
+    sStateCache.mLocations.clear();
+    sStateCache.mContainerKeys.clear();
+}
+
+/*!
+ * \brief Search the model again and check that it finds exactly the Data that
+ *        are in sStateCache.
+ * \details This is only meant for debugging as it is as expensive as not having
+ *          the cache at all.  The results of the new search are kept.
+ * \return Whether the cache was up to date with the structure of the model.
+ */
+bool ManageStateVariables::isStateCacheCurrent() {
+    const StateCache cached = sStateCache;
+    findState();
+    if( cached.mLocations.size() != sStateCache.mLocations.size() ||
+        cached.mContainerKeys != sStateCache.mContainerKeys )
+    {
+        return false;
+    }
+    for( size_t i = 0; i < cached.mLocations.size(); ++i ) {
+        const StateLocation& cachedLocation = cached.mLocations[ i ];
+        const StateLocation& location = sStateCache.mLocations[ i ];
+        if( cachedLocation.mType != location.mType || cachedLocation.mData != location.mData ||
+            cachedLocation.mTechnology != location.mTechnology || cachedLocation.mMarket != location.mMarket ||
+            cachedLocation.mNationalAccount != location.mNationalAccount ||
+            cachedLocation.mContainer != location.mContainer )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * \brief Check if the Values of a Data flagged as STATE may change during
+ *        World.calc( mPeriodToCollect ).
+ * \details Data in a Technology that is not operating, or in a Market or
+ *          NationalAccount for a different model year is inactive.
+ * \param aLocation The Data to check.
+ * \return Whether the Data is active.
+ */
+bool ManageStateVariables::isActive( const StateLocation& aLocation ) const {
+    return ( !aLocation.mTechnology || aLocation.mTechnology->isOperating( mPeriodToCollect ) ) &&
+           ( !aLocation.mMarket || aLocation.mMarket->getYear() == mYearToCollect ) &&
+           ( !aLocation.mNationalAccount || aLocation.mNationalAccount->getYear() == mYearToCollect );
+}
+
+/*!
+ * \brief Collect all relevant STATE Values and allocate space for them in the
+ *        central state data arrays.  The "base" state will get initialized as the
+ *        actual value set in the individual Value objects before being collected.
+ */
+void ManageStateVariables::collectState() {
+    if( !sStateCache.mIsValid || sStateCache.mNumMarkets != scenario->getMarketplace()->mMarkets.size() ) {
+        findState();
+    }
+#if DEBUG_STATE || !defined( NDEBUG )
+    else if( !isStateCacheCurrent() ) {
+        // something changed the structure of the model without calling
+        // invalidateStateCache
+        ILogger& mainLog = ILogger::getLogger( "main_log" );
+        mainLog.setLevel( ILogger::SEVERE );
+        mainLog << "The cached STATE locations did not match the model in period " << mPeriodToCollect << "." << endl;
+        abort();
+    }
+#endif
+    
+    // Find the Values which are active in this period along with a key for each
+    // generated from the key of its container and its position in it.
+    vector<uint64_t> numContainerValues( sStateCache.mContainerKeys.size(), 0 );
+    for( const auto& location : sStateCache.mLocations ) {
+        if( !isActive( location ) ) {
+            continue;
+        }
+        uint64_t& numValues = numContainerValues[ location.mContainer ];
+        const uint64_t containerKey = sStateCache.mContainerKeys[ location.mContainer ];
+        auto addStateValue = [&]( Value* aValue ) {
+            mStateValues.push_back( aValue );
+            mStateKeys.push_back( RestartFile::combineHash( containerKey, numValues++ ) );
+            if( location.mMarket ) {
+                mMarketStateValues.push_back( aValue );
+            }
+        };
+        switch( location.mType ) {
+            case StateLocation::SINGLE:
+                addStateValue( static_cast<Value*>( location.mData ) );
+                break;
+            case StateLocation::PERIOD_VECTOR:
+                // When an ARRAY of values are tagged only the Value in [ mPeriodToCollect]
+                // is considered active.
+                addStateValue( &( *static_cast<objects::PeriodVector<Value>*>( location.mData ) )[ mPeriodToCollect ] );
+                break;
+            case StateLocation::TECH_VINTAGE_VECTOR:
+                // Note, isActive should take care of out of bounds here
+                addStateValue( &( *static_cast<objects::TechVintageVector<Value>*>( location.mData ) )[ mPeriodToCollect ] );
+                break;
+            case StateLocation::YEAR_VECTOR: {
+                // When a year vector is tagged we only need to worry about values in the
+                // current timestep (already calculated the years ahead of time in the
+                // interest of speed to be from [mCCStartYear, mYearToCollect])
+                objects::YearVector<Value>& yearVector = *static_cast<objects::YearVector<Value>*>( location.mData );
+                for( int year = std::max( mCCStartYear, yearVector.getStartYear() ); year <= mYearToCollect; ++year ) {
+                    addStateValue( &yearVector[ year ] );
+                }
+                break;
+            }
+        }
+    }
+    // The state is collected in the reverse order it was found so that restart
+    // files remain in the same order.
+    reverse( mStateValues.begin(), mStateValues.end() );
+    reverse( mStateKeys.begin(), mStateKeys.end() );
+    mNumCollected = mStateValues.size();
+    for( auto key : mStateKeys ) {
+        mSchemaHash = RestartFile::combineHash( mSchemaHash, key );
+    }
     
-    // DoCollect has now gathered all active state into the mStateValues list to
-    // allow faster/easier processing for the remaining tasks at hand.
     ILogger& mainLog = ILogger::getLogger( "main_log" );
     mainLog.setLevel( ILogger::DEBUG );
     mainLog << "Number of active state values: " << mNumCollected << endl;
-    // Allocate space for each active state value for each state slot.
-    for( size_t stateInd = 0; stateInd < NUM_STATES; ++stateInd ) {
-        mStateData[ stateInd ] = new double[ mNumCollected ];
+    // Allocate space for each active state value for the "base" state.  The
+    // "scratch" states are allocated by the thread which will use them.
+    mStateData[ 0 ] = allocateStateSlot( mNumCollected );
+    for( size_t stateInd = 1; stateInd < NUM_STATES; ++stateInd ) {
+#if !GCAM_PARALLEL_ENABLED
+        mStateData[ stateInd ] = allocateStateSlot( mNumCollected );
+#else
+        mStateData[ stateInd ] = 0;
+#endif
     }
     
     // We can now initialize the static Value references into mStateData for fast
@@ -215,6 +558,13 @@ void ManageStateVariables::collectState() {
         ++currEncodedId;
     }
     
+    // Now that IDs have been assigned we can find the ranges of market state.
+    vector<uint32_t> marketStateIDs;
+    for( auto currValue : mMarketStateValues ) {
+        marketStateIDs.push_back( static_cast<uint32_t>( currValue->mBits & Value::ID_MASK ) );
+    }
+    mMarketStateRanges = toStateRanges( marketStateIDs );
+    
     // if configured, reset initial state data from a restart file
     // note because the value could be specified via restart-period or restart-year
     // we use the util::getConfigRunPeriod to reconcile the two.
@@ -229,11 +579,6 @@ void ManageStateVariables::collectState() {
     if( newRestartPeriod != -1 && mPeriodToCollect < newRestartPeriod ) {
         loadRestartFile();
     }
-    
-    // clean up GCAMFusion related memory
-    for( auto filterStep : collectStateSteps ) {
-        delete filterStep;
-    }
 }
 
 /*!
@@ -246,12 +591,13 @@ void ManageStateVariables::resetState() {
     }
     
 #if DEBUG_STATE
-    uint64_t count = Value::STATE_COPY_MASK;
+    uint64_t count = 0;
 #endif
     for( auto currValue : mStateValues ) {
 #if DEBUG_STATE
-        if( currValue->mBits != count ) {
-            cout << "Reset didn't match " << currValue->mBits << " != " << count << endl;
+        const uint64_t expected = Value::STATE_COPY_MASK | ( mStateOrder.empty() ? count : mStateOrder[ count ] );
+        if( currValue->mBits != expected ) {
+            cout << "Reset didn't match " << currValue->mBits << " != " << expected << endl;
             abort();
         }
         ++count;
@@ -272,10 +618,253 @@ void ManageStateVariables::copyState() {
 #if !GCAM_PARALLEL_ENABLED
     memcpy( mStateData[1], mStateData[0], (sizeof( double)) * mNumCollected );
 #else
-    memcpy( Value::sCentralValue.local(), mStateData[0], (sizeof( double)) * mNumCollected );
+    memcpy( Value::getCentralValue(), mStateData[0], (sizeof( double)) * mNumCollected );
+#endif
+    // we do not know what will be written next so the next copy must be full
+    mSlotGeneration[ getThreadSlotIndex() ] = INVALID_GENERATION;
+}
+
+/*!
+ * \brief Copies the "base" state over the "scratch" space before calculating a
+ *        partial derivative of the given activities.
+ * \details When the "scratch" space has not been fully copied since the "base"
+ *          state last changed this is the same as copyState().  Otherwise only
+ *          the state written by the activities of the previous partial derivative
+ *          calculated in this "scratch" space, the state the given activities will
+ *          write, and the market state needs to be copied.  When mVerifyDeltaCopy
+ *          is set the result is checked against the full copy.
+ * \param aActivities The activities which are about to be calculated.
+ */
+void ManageStateVariables::copyState( const vector<IActivity*>& aActivities ) {
+#if !GCAM_PARALLEL_ENABLED
+    double* state = mStateData[1];
+#else
+    double* state = Value::getCentralValue();
+#endif
+    const int slot = getThreadSlotIndex();
+    vector<const StateRanges*>& dirtyRanges = mSlotDirtyRanges[ slot ];
+    
+    // find the state ranges of each activity, if any were not recorded we can
+    // not know what will be written
+    vector<const StateRanges*> activityRanges;
+    activityRanges.reserve( aActivities.size() );
+    bool isKnown = mUseDeltaCopy;
+    for( auto activity = aActivities.begin(); isKnown && activity != aActivities.end(); ++activity ) {
+        auto ranges = mActivityStateRanges.find( *activity );
+        isKnown = ranges != mActivityStateRanges.end();
+        if( isKnown ) {
+            activityRanges.push_back( &( *ranges ).second );
+        }
+    }
+    
+    if( !isKnown ) {
+        copyState();
+        dirtyRanges.clear();
+        return;
+    }
+    
+    if( mSlotGeneration[ slot ] != mBaseGeneration ) {
+        memcpy( state, mStateData[0], (sizeof( double)) * mNumCollected );
+        mSlotGeneration[ slot ] = mBaseGeneration;
+    }
+    else {
+        for( auto ranges : dirtyRanges ) {
+            copyRanges( state, *ranges );
+        }
+        for( auto ranges : activityRanges ) {
+            copyRanges( state, *ranges );
+        }
+        copyRanges( state, mMarketStateRanges );
+        if( mVerifyDeltaCopy && !verifyDeltaCopy( state ) ) {
+            memcpy( state, mStateData[0], (sizeof( double)) * mNumCollected );
+        }
+    }
+    dirtyRanges.swap( activityRanges );
+}
+
+/*!
+ * \brief Check that a "scratch" state which was just delta copied matches the
+ *        "base" state.
+ * \details A mismatch means an activity wrote state during a partial derivative
+ *          which it did not write when recordActivityState calculated it, for
+ *          instance because the write depends on the data.  Such state would be
+ *          stale in the next partial derivative calculated in this "scratch"
+ *          space so delta copies are turned off for the rest of the period.
+ * \param aState The "scratch" state to check.
+ * \return True if aState matches the "base" state.
+ */
+bool ManageStateVariables::verifyDeltaCopy( double* aState ) {
+    if( memcmp( aState, mStateData[0], (sizeof( double)) * mNumCollected ) == 0 ) {
+        return true;
+    }
+    
+    // only the first thread to find a mismatch reports it
+    if( mUseDeltaCopy.exchange( false ) ) {
+        uint64_t numStale = 0;
+        for( uint64_t stateID = 0; stateID < mNumCollected; ++stateID ) {
+            numStale += memcmp( &aState[ stateID ], &mStateData[0][ stateID ], sizeof( double ) ) != 0;
+        }
+        ILogger& mainLog = ILogger::getLogger( "main_log" );
+        mainLog.setLevel( ILogger::WARNING );
+        mainLog << "Delta state copy left " << numStale << " stale state values in period "
+                << mPeriodToCollect << ", copying the full state for the rest of the period." << endl;
+    }
+    return false;
+}
+
+/*!
+ * \brief Copy the given ranges of the "base" state into the given state.
+ * \param aState The "scratch" state to copy into.
+ * \param aRanges The ranges of state IDs to copy.
+ */
+void ManageStateVariables::copyRanges( double* aState, const StateRanges& aRanges ) const {
+    for( auto range : aRanges ) {
+        memcpy( aState + range.first, mStateData[0] + range.first, (sizeof( double )) * ( range.second - range.first ) );
+    }
+}
+
+/*!
+ * \brief Get the index into mStateData of the "scratch" state assigned to the
+ *        calling thread.
+ * \return The index of the calling thread's "scratch" state.
+ */
+int ManageStateVariables::getThreadSlotIndex() {
+#if !GCAM_PARALLEL_ENABLED
+    return 1;
+#else
+    // ensure the slot has been assigned
+    Value::getCentralValue();
+    return sThreadStateSlot.mSlot;
+#endif
+}
+
+/*!
+ * \brief Record the state IDs each activity writes when it is calculated so
+ *        that copyState can limit what it copies to just that state and so the
+ *        state can be clustered by activity.
+ * \details Each activity is calculated in turn in the calling thread's "scratch"
+ *          space, as if it were a partial derivative, while Value logs the state
+ *          that gets set.  Market state is always copied so writes by the solver
+ *          to prices are covered as well.  This costs one extra serial World::calc
+ *          each period, on top of the initial one, with every state write logged.
+ *          It is skipped when the config parameters delta-state-copy and
+ *          cluster-state have both been set to false.  Value only logs writes
+ *          when GCAM_PARALLEL_ENABLED so without it the full state is always
+ *          copied and the state is not clustered.
+ *
+ *          The recorded writes are those of a single calculation so writes
+ *          which depend on the data may be missed, leaving stale state in a
+ *          "scratch" space.  For that reason delta-state-copy is off by default.
+ *          When DEBUG_STATE is set or the period is checked by ParallelCheck
+ *          each delta copy is verified against the "base" state and delta
+ *          copies are turned off should it not match.
+ * \param aActivities All of the activities in the model in calculation order.
+ * \param aPeriod The model period to calculate.
+ */
+void ManageStateVariables::recordActivityState( const vector<IActivity*>& aActivities, const int aPeriod ) {
+#if GCAM_PARALLEL_ENABLED
+    if( !mUseDeltaCopy && !mClusterState ) {
+        return;
+    }
+#if DEBUG_STATE
+    mVerifyDeltaCopy = true;
+#else
+    mVerifyDeltaCopy = ParallelCheck::getInstance().isCheckingPeriod();
+#endif
+    
+    setPartialDeriv( true );
+    copyState();
+    Marketplace::mIsDerivativeCalc = true;
+    
+    vector<vector<uint32_t> > activityWrites( aActivities.size() );
+    // unbind this thread's cached slot so that every write is logged
+    ++Value::sCentralValueEpoch;
+    for( size_t i = 0; i < aActivities.size(); ++i ) {
+        Value::sStateWriteLog = &activityWrites[ i ];
+        aActivities[ i ]->calc( aPeriod );
+    }
+    Value::sStateWriteLog = 0;
+    
+    Marketplace::mIsDerivativeCalc = false;
+    setPartialDeriv( false );
+    
+    if( mClusterState ) {
+        clusterState( activityWrites );
+    }
+    
+    for( size_t i = 0; i < aActivities.size(); ++i ) {
+        mActivityStateRanges[ aActivities[ i ] ] = toStateRanges( activityWrites[ i ] );
+    }
 #endif
 }
 
+/*!
+ * \brief Reassign state IDs so that the state each activity writes is contiguous
+ *        and laid out in the order in which activities are calculated.
+ * \details State written by more than one activity, such as market demands, is
+ *          placed with the first activity to write it.  State which was not
+ *          written is placed at the end in its original order.  The "base" state
+ *          is permuted to match and the recorded writes are updated to the new IDs
+ *          so the values an activity reads and writes are close together.
+ * \param aActivityWrites The state IDs written by each activity in calculation
+ *                        order as recorded by recordActivityState.  These will be
+ *                        updated to the new IDs.
+ */
+void ManageStateVariables::clusterState( vector<vector<uint32_t> >& aActivityWrites ) {
+    const uint32_t UNASSIGNED = numeric_limits<uint32_t>::max();
+    vector<uint32_t> newID( mNumCollected, UNASSIGNED );
+    uint32_t nextID = 0;
+    for( const auto& writes : aActivityWrites ) {
+        for( auto stateID : writes ) {
+            if( newID[ stateID ] == UNASSIGNED ) {
+                newID[ stateID ] = nextID++;
+            }
+        }
+    }
+    for( auto& stateID : newID ) {
+        if( stateID == UNASSIGNED ) {
+            stateID = nextID++;
+        }
+    }
+    
+    // permute the "base" state, the "scratch" states will get a full copy the
+    // next time they are used
+    double* newBase = allocateStateSlot( mNumCollected );
+    for( uint64_t stateID = 0; stateID < mNumCollected; ++stateID ) {
+        newBase[ newID[ stateID ] ] = mStateData[ 0 ][ stateID ];
+    }
+    freeStateSlot( mStateData[ 0 ], mNumCollected );
+    mStateData[ 0 ] = newBase;
+    Value::sBaseCentralValue = mStateData[ 0 ];
+    setPartialDeriv( false );
+    
+    // update the IDs held by each Value and keep track of the original collection
+    // order which is used by restart files
+    if( mStateOrder.empty() ) {
+        mStateOrder.resize( mNumCollected );
+        for( uint64_t stateID = 0; stateID < mNumCollected; ++stateID ) {
+            mStateOrder[ stateID ] = static_cast<uint32_t>( stateID );
+        }
+    }
+    for( auto& stateID : mStateOrder ) {
+        stateID = newID[ stateID ];
+    }
+    for( auto currValue : mStateValues ) {
+        currValue->mBits = Value::STATE_COPY_MASK | newID[ currValue->mBits & Value::ID_MASK ];
+    }
+    
+    for( auto& writes : aActivityWrites ) {
+        for( auto& stateID : writes ) {
+            stateID = newID[ stateID ];
+        }
+    }
+    vector<uint32_t> marketStateIDs;
+    for( auto currValue : mMarketStateValues ) {
+        marketStateIDs.push_back( static_cast<uint32_t>( currValue->mBits & Value::ID_MASK ) );
+    }
+    mMarketStateRanges = toStateRanges( marketStateIDs );
+}
+
 /*!
  * \brief Set up the Value classes static references into mStateData to appropriately
  *        point to the "base" state if aIsPartialDeriv is false or a "scratch"
@@ -285,47 +874,224 @@ void ManageStateVariables::copyState() {
  */
 void ManageStateVariables::setPartialDeriv( const bool aIsPartialDeriv ) {
 #if !GCAM_PARALLEL_ENABLED
+    if( !aIsPartialDeriv ) {
+        // The "base" state may now change so the "scratch" state will need a
+        // full copy before it is used again.
+        ++mBaseGeneration;
+    }
     Value::sCentralValue = mStateData[ aIsPartialDeriv ? 1 : 0 ];
 #else
     if( !aIsPartialDeriv ) {
+        // The "base" state may now change so any "scratch" state will need a
+        // full copy before it is used again.
+        ++mBaseGeneration;
         // Initialize the thread local storage to always access the "base" state.
         Value::sCentralValue = Value::CentralValueType( mStateData[0] );
     }
     else {
         // Use the AssignThreadStateFun helper functor to uniquely assign a state
         // slot to each worker thread.
-        Value::sCentralValue = Value::CentralValueType( AssignThreadStateFun( mStateData, NUM_STATES ) );
+        recycleThreadStateSlots();
+        Value::sCentralValue = Value::CentralValueType( AssignThreadStateFun( mStateData, NUM_STATES, mNumCollected ) );
     }
+    // let each thread know it needs to re-bind its cached slot
+    ++Value::sCentralValueEpoch;
 #endif
 }
 
+#if GCAM_PARALLEL_ENABLED
+/*!
+ * \brief Get the state slot the calling thread is currently calculating in.
+ * \return The state slot assigned to the calling thread.
+ */
+double* ManageStateVariables::getThreadState() {
+    return Value::getCentralValue();
+}
+
+/*!
+ * \brief Switch the state slot the calling thread is calculating in.
+ * \details This allows several threads to cooperate on a single partial
+ *          derivative calculation, such as when running a partial flow graph,
+ *          by temporarily sharing the state slot of the thread which started it.
+ *          The caller is responsible for restoring the previous slot when done.
+ * \param aState The state slot the calling thread should use.
+ * \return The state slot the calling thread was previously using.
+ */
+double* ManageStateVariables::swapThreadState( double* aState ) {
+    double*& threadState = Value::sCentralValue.local();
+    double* prevState = threadState;
+    threadState = aState;
+    Value::bindThreadCentralValue();
+    return prevState;
+}
+#endif
+
 /*!
  * \brief Generate the appropriate restart file name to use.
- * \details This method will append the model period this instance was created
- *          with to the base name as set in the Configuration.  It will also also
- *          follow the <Files> convetion, specificially obey append-scenario-name, when
- *          it generates the file name.
+ * \details The state of every period is kept in a single restart file with the
+ *          base name as set in the Configuration.  It will also also follow the
+ *          <Files> convetion, specificially obey append-scenario-name, when it
+ *          generates the file name.
  * \return The correct filename to use for restarts
  */
 string ManageStateVariables::getRestartFileName() const {
     Configuration* conf = Configuration::getInstance();
     const string fileName = conf->getFile( "restart", "restart/restart" );
     const string scnAppend = conf->shouldAppendScnToFile( "restart" ) ? "." + scenario->getName() : "";
-    const string period = util::toString( mPeriodToCollect );
-    return fileName + scnAppend + "." + period;
+    return fileName + scnAppend;
+}
+
+/*!
+ * \brief Generate the name of the restart file to read state from.
+ * \details This is the same as getRestartFileName() unless a restart-input file
+ *          was set in the Configuration which allows, for instance, a policy
+ *          scenario to start from the state of a reference scenario.
+ * \return The filename to read restarts from.
+ */
+string ManageStateVariables::getRestartInputFileName() const {
+    Configuration* conf = Configuration::getInstance();
+    const string fileName = conf->getFile( "restart-input", "", false );
+    if( fileName.empty() ) {
+        return getRestartFileName();
+    }
+    const string scnAppend = conf->shouldAppendScnToFile( "restart-input" ) ? "." + scenario->getName() : "";
+    return fileName + scnAppend;
+}
+
+/*!
+ * \brief Generate the name of a restart file in the older format which held the
+ *        state for only a single period.
+ * \details This appends the model period this instance was created with to
+ *          getRestartInputFileName().
+ * \return The filename of the older format restart file for this period.
+ */
+string ManageStateVariables::getLegacyRestartFileName() const {
+    return getRestartInputFileName() + "." + util::toString( mPeriodToCollect );
 }
 
 /*!
- * \brief Load a restart file from disk directly into the "base" state.
+ * \brief Load the state for this period from a restart file directly into the
+ *        "base" state.
+ * \details The state is checked against the checksum stored with it and the
+ *          structure of the model it was collected from must match the current
+ *          scenario.  When the state was stored uncompressed it is mapped into
+ *          memory and used as the "base" state directly rather than being read.
+ *          If the structure does not match but the config parameter restart-by-key
+ *          is set the state is instead matched by key.  If the restart file is not
+ *          in the current format we fall back to reading a restart file for this
+ *          period in the older format.  This is only called from collectState,
+ *          before clusterState may reassign the state IDs, so the "base" state is
+ *          still in the order it was collected as is the state in restart files.
+ * \sa ManageStateVariables::getRestartInputFileName
+ * \sa ManageStateVariables::saveRestartFile
+ */
+void ManageStateVariables::loadRestartFile() {
+    assert( mStateOrder.empty() );
+    const string restartFileName = getRestartInputFileName();
+    RestartFile restartFile( restartFileName );
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    if( !restartFile.isValid() ) {
+        mainLog.setLevel( ILogger::DEBUG );
+        mainLog << "Could not read restart file: " << restartFileName << ", trying: "
+                << getLegacyRestartFileName() << endl;
+        loadLegacyRestartFile();
+        return;
+    }
+    
+    const RestartFile::Section* section = restartFile.findSection( mPeriodToCollect, RestartFile::STATE_VALUES );
+    if( !section ) {
+        mainLog.setLevel( ILogger::SEVERE );
+        mainLog << "Restart file: " << restartFileName << " does not contain period " << mPeriodToCollect << "." << endl;
+        abort();
+    }
+    if( restartFile.getModelHash() != RestartFile::getCurrentModelHash() ) {
+        mainLog.setLevel( ILogger::WARNING );
+        mainLog << "Restart file: " << restartFileName << " was written by a different version of GCAM." << endl;
+    }
+    if( ( section->mSchemaHash != mSchemaHash || section->mNumValues != mNumCollected ) &&
+        Configuration::getInstance()->getBool( "restart-by-key", false, false ) )
+    {
+        loadRestartFileByKey( restartFile, *section );
+        return;
+    }
+    if( section->mSchemaHash != mSchemaHash || section->mNumValues != mNumCollected ) {
+        mainLog.setLevel( ILogger::SEVERE );
+        mainLog << "Restart file: " << restartFileName << " does not match the structure of the current scenario in period "
+                << mPeriodToCollect << ", read: " << section->mNumValues << " states, expected: " << mNumCollected << endl;
+        abort();
+    }
+    
+    double* mappedState = restartFile.mapSection( *section );
+    if( mappedState ) {
+        freeStateSlot( mStateData[0], mNumCollected );
+        mStateData[0] = mappedState;
+        Value::sBaseCentralValue = mStateData[0];
+        setPartialDeriv( false );
+        return;
+    }
+    
+    if( !restartFile.readSection( *section, mStateData[0] ) ) {
+        mainLog.setLevel( ILogger::SEVERE );
+        mainLog << "Restart file: " << restartFileName << " is corrupt in period " << mPeriodToCollect << "." << endl;
+        abort();
+    }
+}
+
+/*!
+ * \brief Load the state for this period from a restart file which was written
+ *        from a model with a different structure by matching the key of each
+ *        state value.
+ * \details This allows a scenario to start from the state of a structurally
+ *          similar one, such as a policy scenario from its reference scenario.
+ *          State values which are not found in the restart file keep their
+ *          current values.
+ * \param aRestartFile The open restart file.
+ * \param aSection The section which holds the state values of this period.
+ */
+void ManageStateVariables::loadRestartFileByKey( const RestartFile& aRestartFile, const RestartFile::Section& aSection ) {
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    const RestartFile::Section* keySection = aRestartFile.findSchemaSection( aSection.mSchemaHash, RestartFile::STATE_KEYS );
+    vector<double> restartState( aSection.mNumValues );
+    vector<uint64_t> restartKeys( aSection.mNumValues );
+    if( !keySection || keySection->mNumValues != aSection.mNumValues ||
+        !aRestartFile.readSection( aSection, restartState.data() ) ||
+        !aRestartFile.readSection( *keySection, restartKeys.data() ) )
+    {
+        mainLog.setLevel( ILogger::SEVERE );
+        mainLog << "Could not read state keys from restart file: " << getRestartInputFileName() << " in period "
+                << mPeriodToCollect << "." << endl;
+        abort();
+    }
+    
+    unordered_map<uint64_t, uint64_t> restartIndex( restartKeys.size() );
+    for( uint64_t restartInd = 0; restartInd < restartKeys.size(); ++restartInd ) {
+        restartIndex.emplace( restartKeys[ restartInd ], restartInd );
+    }
+    uint64_t numMatched = 0;
+    for( uint64_t stateInd = 0; stateInd < mNumCollected; ++stateInd ) {
+        auto restartInd = restartIndex.find( mStateKeys[ stateInd ] );
+        if( restartInd != restartIndex.end() ) {
+            mStateData[0][ stateInd ] = restartState[ ( *restartInd ).second ];
+            ++numMatched;
+        }
+    }
+    
+    mainLog.setLevel( numMatched == 0 ? ILogger::WARNING : ILogger::NOTICE );
+    mainLog << "Matched " << numMatched << " of " << mNumCollected << " state values by key from restart file: "
+            << getRestartInputFileName() << " (" << restartKeys.size() << " in file)." << endl;
+}
+
+/*!
+ * \brief Load a restart file in the older format from disk directly into the
+ *        "base" state.
  * \warning Very little error checking is done to ensure the state read in was generated
  *          from the exact same scenario.  All we can do in terms of error checking is
  *          check that the size of the data coming in is exactly the same size as mNumCollected.
- * \sa ManageStateVariables::getRestartFileName
- * \sa ManageStateVariables::saveRestartFile
+ * \sa ManageStateVariables::getLegacyRestartFileName
  */
-void ManageStateVariables::loadRestartFile() {
+void ManageStateVariables::loadLegacyRestartFile() {
     // read from the appropriate file which is in binary format
-    const string restartFileName = getRestartFileName();
+    const string restartFileName = getLegacyRestartFileName();
     fstream restartFile( restartFileName.c_str(), ios_base::in | ios_base::binary );
     
     if( !restartFile.is_open() ) {
@@ -365,10 +1131,15 @@ void ManageStateVariables::loadRestartFile() {
 }
 
 /*!
- * \brief Dump the contents of the "base" state array into a binary restart file.
- * \details The first value written is mNumCollected (size written: size_t) to help with do some error checking
- *          when we try to read it back in.  Then we just write the entire content of mStateData[0]
- *          (size written: double * mNumCollected).
+ * \brief Write the contents of the "base" state array into the restart file.
+ * \details The state is written in the order it was collected along with a hash
+ *          of the structure of the model so that it can be checked when we try to
+ *          read it back in.  The key of each state value is written as well so that
+ *          a scenario with a different structure may still match up the state,
+ *          although only if the file does not already hold the keys for the same
+ *          structure from another period.  The state of any other periods already
+ *          in the file is kept.  If the config parameter compress-restart is set
+ *          the state is compressed.
  * \sa ManageStateVariables::getRestartFileName
  */
 void ManageStateVariables::saveRestartFile() {
@@ -376,24 +1147,34 @@ void ManageStateVariables::saveRestartFile() {
     ILogger& mainLog = ILogger::getLogger( "main_log" );
     mainLog.setLevel( ILogger::DEBUG );
     mainLog << "Writing restart file: " << restartFileName << "... ";
-    fstream restartFile( restartFileName.c_str(), ios_base::out | ios_base::trunc | ios_base::binary );
     
-    if( !restartFile.is_open() ) {
-        ILogger& mainLog = ILogger::getLogger( "main_log" );
+    // write the entire contents of the "base" state in the order the state was
+    // collected so that the file does not depend on how the state was clustered
+    vector<double> collectedState;
+    const double* restartState = mStateData[0];
+    if( !mStateOrder.empty() ) {
+        collectedState.resize( mNumCollected );
+        for( size_t stateInd = 0; stateInd < collectedState.size(); ++stateInd ) {
+            collectedState[ stateInd ] = mStateData[0][ mStateOrder[ stateInd ] ];
+        }
+        restartState = &collectedState[0];
+    }
+    
+    const bool compress = Configuration::getInstance()->getBool( "compress-restart", false, false );
+    vector<RestartFile::SectionData> sections( 2 );
+    sections[ 0 ].mKind = RestartFile::STATE_VALUES;
+    sections[ 0 ].mData = restartState;
+    sections[ 0 ].mNumValues = mNumCollected;
+    sections[ 1 ].mKind = RestartFile::STATE_KEYS;
+    sections[ 1 ].mData = mStateKeys.data();
+    sections[ 1 ].mNumValues = mStateKeys.size();
+    if( !RestartFile::writeSections( restartFileName, mPeriodToCollect, mSchemaHash, sections, compress ) )
+    {
         mainLog.setLevel( ILogger::SEVERE );
-        mainLog << "Could not open restart file: " << restartFileName << " for write." << endl;
+        mainLog << "Could not write restart file: " << restartFileName << endl;
         abort();
     }
     
-    // first write the total number of entries that should be expected to help with error
-    // checking on read in
-    restartFile.write( reinterpret_cast<char*>( &mNumCollected ), sizeof( uint64_t ) );
-    
-    // write the entire contents of the "base" state
-    restartFile.write( reinterpret_cast<char*>( mStateData[0] ), sizeof( double ) * mNumCollected );
-    
-    restartFile.close();
-    
     mainLog << "Done." << endl;
 }
 
@@ -409,6 +1190,17 @@ void Value::doStateCheck() const {
 }
 #endif
 
+/*!
+ * \brief Add a Data flagged as STATE to sStateCache along with the containers
+ *        it is in.
+ * \param aType The type of the Data.
+ * \param aData The Data.
+ */
+void ManageStateVariables::DoCollect::addStateLocation( const StateLocation::DataType aType, void* aData ) {
+    StateLocation location = { aType, aData, mCurrTechnology, mCurrMarket, mCurrNationalAccount, mPath.back().mContainer };
+    sStateCache.mLocations.push_back( location );
+}
+
 template<typename DataType>
 void ManageStateVariables::DoCollect::processData( DataType& aData ) {
 #if DEBUG_STATE
@@ -420,100 +1212,123 @@ void ManageStateVariables::DoCollect::processData( DataType& aData ) {
 
 template<>
 void ManageStateVariables::DoCollect::processData<Value>( Value& aData ) {
-    // Any SINGLE value that is tagged is considered active so long as it is not
-    // contained in a retired technology for instance.
-    if( !mIgnoreCurrValue ) {
-        mParentClass->mStateValues.push_front( &aData );
-        ++mParentClass->mNumCollected;
-    }
+    addStateLocation( StateLocation::SINGLE, &aData );
 }
 
 template<>
 void ManageStateVariables::DoCollect::processData<objects::PeriodVector<Value> >( objects::PeriodVector<Value>& aData ) {
-    // When an ARRAY of values are tagged only the Value in [ mPeriodToCollect] is
-    // considered active.
-    if( !mIgnoreCurrValue ) {
-        mParentClass->mStateValues.push_front( &aData[ mParentClass->mPeriodToCollect ] );
-        ++mParentClass->mNumCollected;
-    }
+    addStateLocation( StateLocation::PERIOD_VECTOR, &aData );
 }
 
 template<>
 void ManageStateVariables::DoCollect::processData<objects::TechVintageVector<Value> >( objects::TechVintageVector<Value>& aData ) {
-    // When an ARRAY of values are tagged only the Value in [ mPeriodToCollect] is
-    // considered active.
-    
-    // Note, mIgnoreCurrValue should take care of out of bounds here
-    if( !mIgnoreCurrValue ) {
-        mParentClass->mStateValues.push_front( &aData[ mParentClass->mPeriodToCollect ] );
-        ++mParentClass->mNumCollected;
-    }
+    addStateLocation( StateLocation::TECH_VINTAGE_VECTOR, &aData );
 }
 
 template<>
 void ManageStateVariables::DoCollect::processData<objects::YearVector<Value> >( objects::YearVector<Value>& aData ) {
-    // When a year vector is tagged we only need to worry about values in the current
-    // timestep (already calculated the years ahead of time in the interest of speed
-    // to be from [mCCStartYear, mYearToCollect])
-    if( !mIgnoreCurrValue ) {
-        for( int year = std::max( mParentClass->mCCStartYear, aData.getStartYear() ); year <= mParentClass->mYearToCollect; ++year ) {
-            mParentClass->mStateValues.push_front( &aData[ year ] );
-            ++mParentClass->mNumCollected;
-        }
+    addStateLocation( StateLocation::YEAR_VECTOR, &aData );
+}
+
+/*!
+ * \brief Step into a container on the path to the state values.
+ * \details The key of the container is generated from the key of its parent and
+ *          its name if it has one, its year if it has one, or otherwise its position
+ *          in its parent.
+ * \param aContainer The container being stepped into.
+ */
+template<typename ContainerType>
+void ManageStateVariables::DoCollect::pushPath( const ContainerType* aContainer ) {
+    PathEntry& parent = mPath.back();
+    const uint64_t parentKey = sStateCache.mContainerKeys[ parent.mContainer ];
+    const INamed* named = 0;
+    const IYeared* yeared = 0;
+    if constexpr( is_base_of<INamed, ContainerType>::value ) {
+        named = aContainer;
+    }
+    else if constexpr( is_base_of<IYeared, ContainerType>::value ) {
+        yeared = aContainer;
+    }
+    else if constexpr( is_polymorphic<ContainerType>::value ) {
+        named = dynamic_cast<const INamed*>( aContainer );
+        yeared = dynamic_cast<const IYeared*>( aContainer );
+    }
+    
+    uint64_t key;
+    if( named ) {
+        const string& name = named->getName();
+        key = RestartFile::hashBytes( name.data(), name.size(), RestartFile::combineHash( parentKey, 1 ) );
+    }
+    else if( yeared ) {
+        key = RestartFile::combineHash( RestartFile::combineHash( parentKey, 2 ), yeared->getYear() );
+    }
+    else {
+        key = RestartFile::combineHash( RestartFile::combineHash( parentKey, 3 ), parent.mNumChildren );
     }
+    ++parent.mNumChildren;
+    PathEntry entry = { static_cast<uint32_t>( sStateCache.mContainerKeys.size() ), 0 };
+    sStateCache.mContainerKeys.push_back( key );
+    mPath.push_back( entry );
+}
+
+/*!
+ * \brief Step out of the current container on the path to the state values.
+ */
+void ManageStateVariables::DoCollect::popPath() {
+    mPath.pop_back();
 }
 
 template<typename DataType>
 void ManageStateVariables::DoCollect::pushFilterStep( const DataType& aData ) {
-    // ignore most steps
+    // most steps only need to keep track of the path
+    pushPath( aData );
 }
 
 template<typename DataType>
 void ManageStateVariables::DoCollect::popFilterStep( const DataType& aData ) {
-    // ignore most steps
+    // most steps only need to keep track of the path
+    popPath();
 }
 
 
 template<>
 void ManageStateVariables::DoCollect::pushFilterStep<ITechnology*>( ITechnology* const& aData ) {
-    // Ignore any data set within a Technology that is not operating in the current
-    // model period.
-    if( !aData->isOperating( mParentClass->mPeriodToCollect ) ) {
-        mIgnoreCurrValue = true;
-    }
+    pushPath( aData );
+    // Data set within a Technology is only active when it is operating.
+    mCurrTechnology = aData;
 }
 
 template<>
 void ManageStateVariables::DoCollect::popFilterStep<ITechnology*>( ITechnology* const& aData ) {
-    // Moving out of the current Technology so reset the ignore flag.
-    mIgnoreCurrValue = false;
+    popPath();
+    // Moving out of the current Technology.
+    mCurrTechnology = 0;
 }
 
 template<>
 void ManageStateVariables::DoCollect::pushFilterStep<Market*>( Market* const& aData ) {
-    // Ignore any data set within a Market which is not for the current model year.
-    if( aData->getYear() != mParentClass->mYearToCollect ) {
-        mIgnoreCurrValue = true;
-    }
+    pushPath( aData );
+    // Data set within a Market is only active in the Market's model year.
+    mCurrMarket = aData;
 }
 
 template<>
 void ManageStateVariables::DoCollect::popFilterStep<Market*>( Market* const& aData ) {
-    // Moving out of the current Market so reset the ignore flag.
-    mIgnoreCurrValue = false;
+    popPath();
+    // Moving out of the current Market.
+    mCurrMarket = 0;
 }
             
 template<>
 void ManageStateVariables::DoCollect::pushFilterStep<NationalAccount*>( NationalAccount* const& aData ) {
-    // Ignore any data set within a NationalAccount which is not for the current model year.
-    if( aData->getYear() != mParentClass->mYearToCollect ) {
-        mIgnoreCurrValue = true;
-    }
+    pushPath( aData );
+    // Data set within a NationalAccount is only active in its model year.
+    mCurrNationalAccount = aData;
 }
 
 template<>
 void ManageStateVariables::DoCollect::popFilterStep<NationalAccount*>( NationalAccount* const& aData ) {
-    // Moving out of the current NationalAccount so reset the ignore flag.
-    mIgnoreCurrValue = false;
+    popPath();
+    // Moving out of the current NationalAccount.
+    mCurrNationalAccount = 0;
 }
-
@@ -0,0 +1,366 @@
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ */
+
+
+/*!
+ * \file memory_report.cpp
+ * \ingroup util
+ * \brief MemoryReport class source file.
+ */
+
+#include "util/base/include/definitions.h"
+#include <algorithm>
+#include <ostream>
+#include <boost/core/demangle.hpp>
+
+#include "util/base/include/memory_report.h"
+#include "containers/include/scenario.h"
+#include "util/base/include/gcam_fusion.hpp"
+#include "util/base/include/gcam_data_containers.h"
+#include "util/base/include/xml_parse_helper.h"
+
+using namespace std;
+
+namespace {
+    //! The approximate bookkeeping in each node of a std::map: the color and the
+    //! parent, left and right pointers.
+    const uint64_t MAP_NODE_OVERHEAD = 4 * sizeof( void* );
+    
+    /*!
+     * \brief Determines the type of some Data for the report and the heap memory
+     *        it owns.
+     * \details The default is for Data which does not own any memory, specializations
+     *          handle strings and the various arrays.  Note pointers are assumed to
+     *          point to containers which are accounted for when they are visited.
+     */
+    template<typename T>
+    struct DataMemory {
+        static const char* getType() {
+            return boost::is_pointer<T>::value ? "pointer" :
+                boost::is_arithmetic<T>::value || boost::is_enum<T>::value ? "scalar" : "other";
+        }
+        static uint64_t getHeapSize( const T& aData ) {
+            return 0;
+        }
+    };
+    
+    template<typename ArrayType>
+    uint64_t getArrayHeapSize( const ArrayType& aData );
+    
+    template<>
+    struct DataMemory<Value> {
+        static const char* getType() {
+            return "Value";
+        }
+        static uint64_t getHeapSize( const Value& aData ) {
+            return 0;
+        }
+    };
+    
+    template<>
+    struct DataMemory<string> {
+        static const char* getType() {
+            return "std::string";
+        }
+        static uint64_t getHeapSize( const string& aData ) {
+            // Short strings are stored within the string object itself.
+            const char* data = aData.data();
+            const char* self = reinterpret_cast<const char*>( &aData );
+            return data >= self && data < self + sizeof( aData ) ? 0 : aData.capacity() + 1;
+        }
+    };
+    
+    template<typename T>
+    struct DataMemory<vector<T> > {
+        static const char* getType() {
+            return "std::vector";
+        }
+        static uint64_t getHeapSize( const vector<T>& aData ) {
+            return ( aData.capacity() - aData.size() ) * sizeof( T ) + getArrayHeapSize( aData );
+        }
+    };
+    
+    template<>
+    struct DataMemory<vector<bool> > {
+        static const char* getType() {
+            return "std::vector";
+        }
+        static uint64_t getHeapSize( const vector<bool>& aData ) {
+            return ( aData.capacity() + 7 ) / 8;
+        }
+    };
+    
+    template<typename K, typename V>
+    struct DataMemory<map<K, V> > {
+        static const char* getType() {
+            return "std::map";
+        }
+        static uint64_t getHeapSize( const map<K, V>& aData ) {
+            uint64_t size = aData.size() * ( sizeof( typename map<K, V>::value_type ) + MAP_NODE_OVERHEAD );
+            for( const auto& entry : aData ) {
+                size += DataMemory<K>::getHeapSize( entry.first ) + DataMemory<V>::getHeapSize( entry.second );
+            }
+            return size;
+        }
+    };
+    
+    template<typename T>
+    struct DataMemory<objects::PeriodVector<T> > {
+        static const char* getType() {
+            return "PeriodVector";
+        }
+        static uint64_t getHeapSize( const objects::PeriodVector<T>& aData ) {
+            return getArrayHeapSize( aData );
+        }
+    };
+    
+    template<typename T>
+    struct DataMemory<objects::YearVector<T> > {
+        static const char* getType() {
+            return "YearVector";
+        }
+        static uint64_t getHeapSize( const objects::YearVector<T>& aData ) {
+            return getArrayHeapSize( aData );
+        }
+    };
+    
+    template<typename T>
+    struct DataMemory<objects::TechVintageVector<T> > {
+        static const char* getType() {
+            return "TechVintageVector";
+        }
+        static uint64_t getHeapSize( const objects::TechVintageVector<T>& aData ) {
+            // The array is not allocated until the vector is initialized.
+            return aData.getStartPeriod() == static_cast<unsigned int>( -1 ) ? 0 : getArrayHeapSize( aData );
+        }
+    };
+    
+    template<typename T>
+    struct DataMemory<shared_ptr<T> > {
+        static const char* getType() {
+            return DataMemory<T>::getType();
+        }
+        static uint64_t getHeapSize( const shared_ptr<T>& aData ) {
+            return aData ? sizeof( T ) + DataMemory<T>::getHeapSize( *aData ) : 0;
+        }
+    };
+    
+    /*!
+     * \brief Get the heap memory of an array which stores its elements contiguously.
+     * \param aData The array.
+     * \return The size of the elements and any heap memory they own in turn.
+     */
+    template<typename ArrayType>
+    uint64_t getArrayHeapSize( const ArrayType& aData ) {
+        using ElementType = typename ArrayType::value_type;
+        uint64_t size = aData.size() * sizeof( ElementType );
+        for( const auto& element : aData ) {
+            size += DataMemory<ElementType>::getHeapSize( element );
+        }
+        return size;
+    }
+}
+
+//! Constructor
+MemoryReport::MemoryReport():
+mStoredXMLBytes( 0 ),
+mTotalBytes( 0 )
+{
+}
+
+/*!
+ * \brief Walk the model and account for the memory it uses.
+ * \details This is meant to be called after completeInit once all of the model
+ *          structure has been created.
+ * \param aScenario The scenario to account for.
+ */
+void MemoryReport::calcFootprint( Scenario* aScenario ) {
+    mClassTotals.clear();
+    mTypeTotals.clear();
+    
+    DoAccount doAccountProc( *this );
+    // The scenario is where the search starts so it will not be pushed by GCAMFusion.
+    doAccountProc.pushFilterStep( aScenario );
+    
+    // The first step is a descendant step which steps into every container at any
+    // depth.  The second step is required to end the search but as the Data is
+    // sized when each container is entered the matches are not used.
+    vector<FilterStep*> accountSteps( 2, 0 );
+    accountSteps[ 0 ] = new FilterStep( "" );
+    accountSteps[ 1 ] = new FilterStep( "", DataFlags::CONTAINER );
+    GCAMFusion<DoAccount, true, true, false> accountMemory( doAccountProc, accountSteps );
+    accountMemory.startFilter( aScenario );
+    
+    doAccountProc.popFilterStep( aScenario );
+    
+    // clean up GCAMFusion related memory
+    for( auto filterStep : accountSteps ) {
+        delete filterStep;
+    }
+    
+    mStoredXMLBytes = XMLParseHelper::getStoreXMLSize();
+    mTotalBytes = mStoredXMLBytes;
+    for( const auto& typeTotal : mTypeTotals ) {
+        mTotalBytes += typeTotal.second.mBytes;
+    }
+}
+
+/*!
+ * \brief Get the total bytes accounted for by the last call to calcFootprint.
+ * \return The total bytes.
+ */
+uint64_t MemoryReport::getTotalBytes() const {
+    return mTotalBytes;
+}
+
+/*!
+ * \brief Write the totals in CSV format.
+ * \details Each class is written with the number of instances and the bytes of
+ *          its own Data and inclusive of nested containers, followed by its bytes
+ *          by type of Data.  Classes are in order of decreasing inclusive bytes so
+ *          the largest consumers come first.  This is followed by the totals by
+ *          type of Data, the retained XML and the grand total.
+ * \param aOut The stream to write to.
+ */
+void MemoryReport::printCSV( ostream& aOut ) const {
+    typedef pair<string, const ClassTotals*> NamedClass;
+    vector<NamedClass> classes;
+    for( const auto& classTotal : mClassTotals ) {
+        classes.push_back( NamedClass( boost::core::demangle( classTotal.first.name() ), &classTotal.second ) );
+    }
+    sort( classes.begin(), classes.end(), [] ( const NamedClass& aLHS, const NamedClass& aRHS ) {
+        return aLHS.second->mInclusiveBytes > aRHS.second->mInclusiveBytes ||
+            ( aLHS.second->mInclusiveBytes == aRHS.second->mInclusiveBytes && aLHS.first < aRHS.first );
+    } );
+    
+    aOut << "level,class,data-type,count,bytes,inclusive-bytes" << endl;
+    for( const auto& currClass : classes ) {
+        aOut << "class," << currClass.first << ",," << currClass.second->mInstances << ","
+             << currClass.second->mSelfBytes << "," << currClass.second->mInclusiveBytes << endl;
+        for( const auto& typeTotal : currClass.second->mByType ) {
+            aOut << "class-data," << currClass.first << "," << typeTotal.first << ","
+                 << typeTotal.second.mCount << "," << typeTotal.second.mBytes << "," << endl;
+        }
+    }
+    for( const auto& typeTotal : mTypeTotals ) {
+        aOut << "data-type,," << typeTotal.first << "," << typeTotal.second.mCount << ","
+             << typeTotal.second.mBytes << "," << endl;
+    }
+    aOut << "xml,,retained-rapidxml,," << mStoredXMLBytes << "," << endl;
+    aOut << "total,,,," << mTotalBytes << "," << endl;
+}
+
+/*!
+ * \brief Constructor
+ * \param aReport The report to add the totals to.
+ */
+MemoryReport::DoAccount::DoAccount( MemoryReport& aReport ):
+mReport( aReport )
+{
+}
+
+/*!
+ * \brief Enter a container.
+ * \param aType The actual type of the container.
+ * \param aContainer The container which is used to detect if it was already visited.
+ */
+void MemoryReport::DoAccount::pushContainer( const type_index& aType, const void* aContainer ) {
+    const bool isParentDuplicate = !mStack.empty() && mStack.back().mIsDuplicate;
+    Frame frame = { &mReport.mClassTotals[ aType ], 0, isParentDuplicate || !mVisited.insert( aContainer ).second };
+    if( !frame.mIsDuplicate ) {
+        ++frame.mClass->mInstances;
+    }
+    mStack.push_back( frame );
+}
+
+/*!
+ * \brief Leave the current container adding its bytes to its class and to the
+ *        container it is nested within.
+ */
+void MemoryReport::DoAccount::popContainer() {
+    const Frame frame = mStack.back();
+    mStack.pop_back();
+    if( !frame.mIsDuplicate ) {
+        frame.mClass->mInclusiveBytes += frame.mBytes;
+        if( !mStack.empty() ) {
+            mStack.back().mBytes += frame.mBytes;
+        }
+    }
+}
+
+/*!
+ * \brief Add the bytes of a Data member of the current container.
+ * \param aType The type of the Data.
+ * \param aBytes The bytes used by the Data.
+ */
+void MemoryReport::DoAccount::addData( const char* aType, const uint64_t aBytes ) {
+    Frame& frame = mStack.back();
+    if( frame.mIsDuplicate ) {
+        return;
+    }
+    frame.mBytes += aBytes;
+    frame.mClass->mSelfBytes += aBytes;
+    Totals& classTotals = frame.mClass->mByType[ aType ];
+    ++classTotals.mCount;
+    classTotals.mBytes += aBytes;
+    Totals& typeTotals = mReport.mTypeTotals[ aType ];
+    ++typeTotals.mCount;
+    typeTotals.mBytes += aBytes;
+}
+
+/*!
+ * \brief The callback from ExpandDataVector with the full Data vector of the
+ *        container being entered.
+ * \param aDataVector The Data of the current container.
+ */
+template<typename DataVectorType>
+void MemoryReport::DoAccount::processDataVector( DataVectorType aDataVector ) {
+    boost::fusion::for_each( aDataVector, [this] ( auto& aData ) {
+        using DataType = typename boost::remove_cv<typename boost::remove_reference<decltype( aData.mData )>::type>::type;
+        this->addData( DataMemory<DataType>::getType(), sizeof( DataType ) + DataMemory<DataType>::getHeapSize( aData.mData ) );
+    } );
+}
+
+template<typename DataType>
+void MemoryReport::DoAccount::pushFilterStep( const DataType& aData ) {
+    pushContainer( type_index( typeid( *aData ) ), aData );
+    
+    // Size all of the Data in the container now.
+    using ContainerType = typename boost::remove_pointer<DataType>::type;
+    ExpandDataVector<typename ContainerType::SubClassFamilyVector> getDataVector;
+    aData->doDataExpansion( getDataVector );
+    getDataVector.getFullDataVector( *this );
+}
+
+template<typename DataType>
+void MemoryReport::DoAccount::popFilterStep( const DataType& aData ) {
+    popContainer();
+}
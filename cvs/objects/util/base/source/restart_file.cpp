@@ -0,0 +1,736 @@
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ */
+
+
+/*!
+ * \file restart_file.cpp
+ * \ingroup util
+ * \brief RestartFile class source file.
+ */
+
+#include "util/base/include/definitions.h"
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <cstddef>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "util/base/include/restart_file.h"
+#include "util/base/include/version.h"
+#include "util/logger/include/ilogger.h"
+
+using namespace std;
+
+//! Identifies a file as a restart file.
+static const char RESTART_MAGIC[ 8 ] = { 'G', 'C', 'A', 'M', 'R', 'S', 'T', '\0' };
+
+//! The current version of the restart file format.
+static const uint32_t RESTART_FORMAT_VERSION = 2;
+
+//! The alignment of the data of each section which must be a multiple of the
+//! page size for sections to be mapped.
+static const uint64_t SECTION_ALIGNMENT = 4096;
+
+//! The FNV-1a 64 bit prime.
+static const uint64_t HASH_PRIME = 1099511628211ULL;
+
+//! The control byte XOR_DELTA uses for a value which is the same as the last.
+static const unsigned char REPEAT_VALUE = 0x80;
+
+// The on disk layout must not depend on the compiler.
+static_assert( sizeof( double ) == sizeof( uint64_t ), "Restart files require 64 bit doubles." );
+static_assert( sizeof( RestartFile::Section ) == 64, "Unexpected RestartFile::Section layout." );
+
+/*!
+ * \brief Round the given offset up to the alignment of section data.
+ * \param aOffset A file offset.
+ * \return The next aligned offset.
+ */
+static uint64_t alignSectionOffset( const uint64_t aOffset ) {
+    return ( aOffset + SECTION_ALIGNMENT - 1 ) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+/*!
+ * \brief Constructor which opens the given file and reads its section table.
+ * \details A file which does not exist or is not a restart file is not an
+ *          error here, it is simply not valid.
+ * \param aFileName The restart file to open.
+ */
+RestartFile::RestartFile( const string& aFileName ):
+mFileName( aFileName ),
+mFD( -1 ),
+mData( 0 ),
+mSize( 0 )
+{
+    static_assert( sizeof( Header ) == 64, "Unexpected RestartFile::Header layout." );
+    memset( &mHeader, 0, sizeof( Header ) );
+    open();
+}
+
+//! Destructor
+RestartFile::~RestartFile() {
+    close();
+}
+
+/*!
+ * \brief Map or read in the contents of the file and validate the header and
+ *        section table.
+ */
+void RestartFile::open() {
+#if !defined(_WIN32)
+    mFD = ::open( mFileName.c_str(), O_RDONLY );
+    if( mFD == -1 ) {
+        return;
+    }
+    struct stat fileStat;
+    if( fstat( mFD, &fileStat ) != 0 || static_cast<size_t>( fileStat.st_size ) < sizeof( Header ) ) {
+        return;
+    }
+    mSize = fileStat.st_size;
+    void* data = mmap( 0, mSize, PROT_READ, MAP_PRIVATE, mFD, 0 );
+    if( data != MAP_FAILED ) {
+        mData = static_cast<const char*>( data );
+    }
+    else {
+        mBuffer.resize( mSize );
+        if( pread( mFD, &mBuffer[ 0 ], mSize, 0 ) != static_cast<ssize_t>( mSize ) ) {
+            mBuffer.clear();
+            mSize = 0;
+            return;
+        }
+        mData = &mBuffer[ 0 ];
+    }
+#else
+    ifstream file( mFileName.c_str(), ios_base::in | ios_base::binary );
+    if( !file.is_open() ) {
+        return;
+    }
+    mBuffer.assign( istreambuf_iterator<char>( file ), istreambuf_iterator<char>() );
+    if( mBuffer.size() < sizeof( Header ) ) {
+        return;
+    }
+    mSize = mBuffer.size();
+    mData = &mBuffer[ 0 ];
+#endif
+    
+    // use the newest copy of the header which is intact and refers to an intact
+    // section table, the other copy is either older or was being written
+    bool isRestartFile = false;
+    bool hasHeader = false;
+    uint32_t unsupportedVersion = RESTART_FORMAT_VERSION;
+    for( int headerInd = 0; headerInd < NUM_HEADERS; ++headerInd ) {
+        Header header;
+        if( !isValidRange( headerInd * sizeof( Header ), sizeof( Header ) ) ) {
+            break;
+        }
+        memcpy( &header, mData + headerInd * sizeof( Header ), sizeof( Header ) );
+        if( memcmp( header.mMagic, RESTART_MAGIC, sizeof( RESTART_MAGIC ) ) != 0 ) {
+            continue;
+        }
+        isRestartFile = true;
+        if( header.mVersion != RESTART_FORMAT_VERSION ) {
+            unsupportedVersion = header.mVersion;
+            continue;
+        }
+        const uint64_t tableSize = uint64_t( header.mNumSections ) * sizeof( Section );
+        if( hashHeader( header ) == header.mHeaderChecksum &&
+            isValidRange( header.mTableOffset, tableSize ) &&
+            hashBytes( mData + header.mTableOffset, tableSize ) == header.mTableChecksum &&
+            ( !hasHeader || header.mSequence > mHeader.mSequence ) )
+        {
+            mHeader = header;
+            hasHeader = true;
+        }
+    }
+    if( !isRestartFile ) {
+        // not a restart file, likely in the older format
+        return;
+    }
+    
+    ILogger& mainLog = ILogger::getLogger( "main_log" );
+    mainLog.setLevel( ILogger::WARNING );
+    if( !hasHeader && unsupportedVersion != RESTART_FORMAT_VERSION ) {
+        mainLog << "Restart file: " << mFileName << " has unsupported version " << unsupportedVersion << "." << endl;
+    }
+    else if( !hasHeader ) {
+        mainLog << "Restart file: " << mFileName << " has a corrupt header or section table." << endl;
+    }
+    else {
+        mSections.resize( mHeader.mNumSections );
+        if( mHeader.mNumSections > 0 ) {
+            memcpy( &mSections[ 0 ], mData + mHeader.mTableOffset, mHeader.mNumSections * sizeof( Section ) );
+        }
+    }
+}
+
+/*!
+ * \brief Release the contents of the file.
+ * \details Any section mapped by mapSection is unaffected.
+ */
+void RestartFile::close() {
+#if !defined(_WIN32)
+    if( mData && mBuffer.empty() ) {
+        munmap( const_cast<char*>( mData ), mSize );
+    }
+    if( mFD != -1 ) {
+        ::close( mFD );
+    }
+#endif
+    mFD = -1;
+    mData = 0;
+    mSize = 0;
+    mBuffer.clear();
+    mSections.clear();
+}
+
+/*!
+ * \brief Whether the file was opened and is a restart file in a readable format.
+ * \return True if sections may be read from this file.
+ */
+bool RestartFile::isValid() const {
+    return !mSections.empty();
+}
+
+/*!
+ * \brief Get the hash of the revision of the model which wrote the file.
+ * \return The model hash.
+ * \sa getCurrentModelHash
+ */
+uint64_t RestartFile::getModelHash() const {
+    return mHeader.mModelHash;
+}
+
+/*!
+ * \brief Find the section for the given period and kind of data.
+ * \param aPeriod The model period.
+ * \param aKind The kind of data.
+ * \return The section or null if the file does not have one.
+ */
+const RestartFile::Section* RestartFile::findSection( const int aPeriod, const SectionKind aKind ) const {
+    for( const auto& section : mSections ) {
+        if( section.mPeriod == aPeriod && section.mKind == static_cast<uint32_t>( aKind ) ) {
+            return &section;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * \brief Find the section of the given kind for the given structure of the model.
+ * \details This is used to find the STATE_KEYS which are shared by all of the
+ *          periods that have the same structure.
+ * \param aSchemaHash The hash of the structure of the model.
+ * \param aKind The kind of data.
+ * \return The section or null if the file does not have one.
+ */
+const RestartFile::Section* RestartFile::findSchemaSection( const uint64_t aSchemaHash, const SectionKind aKind ) const {
+    for( const auto& section : mSections ) {
+        if( section.mSchemaHash == aSchemaHash && section.mKind == static_cast<uint32_t>( aKind ) ) {
+            return &section;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * \brief Check that a range of bytes lies entirely within the file.
+ * \param aOffset The start of the range.
+ * \param aSize The size of the range.
+ * \return True if the range is within the file.
+ */
+bool RestartFile::isValidRange( const uint64_t aOffset, const uint64_t aSize ) const {
+    return aOffset <= mSize && aSize <= mSize - aOffset;
+}
+
+/*!
+ * \brief Verify and decode the data of a section into the given array.
+ * \param aSection The section to read.
+ * \param aValues The array to read into which must hold aSection.mNumValues
+ *                64 bit values.
+ * \return True if the data was read successfully, false if it was corrupt.
+ */
+bool RestartFile::readSection( const Section& aSection, void* aValues ) const {
+    if( !isValidRange( aSection.mOffset, aSection.mStoredSize ) ) {
+        return false;
+    }
+    const char* data = mData + aSection.mOffset;
+    if( hashBytes( data, aSection.mStoredSize ) != aSection.mChecksum ) {
+        return false;
+    }
+    switch( aSection.mCompression ) {
+        case NONE:
+            if( aSection.mStoredSize != aSection.mNumValues * sizeof( double ) ) {
+                return false;
+            }
+            memcpy( aValues, data, aSection.mStoredSize );
+            return true;
+        case XOR_DELTA:
+            return decode( data, aSection.mStoredSize, static_cast<double*>( aValues ), aSection.mNumValues );
+        default:
+            return false;
+    }
+}
+
+/*!
+ * \brief Map the data of an uncompressed section directly into memory.
+ * \details The mapping is private and writable so the caller may use it as the
+ *          storage for the values without the file ever being modified.  The
+ *          mapping is aNumValues doubles long and must be released with munmap
+ *          by the caller.  This is only possible on systems that support mmap
+ *          and for sections which are not compressed.
+ * \param aSection The section to map.
+ * \return The mapped values or null if the section could not be mapped or its
+ *         checksum did not match in which case readSection should be used.
+ */
+double* RestartFile::mapSection( const Section& aSection ) const {
+#if !defined(_WIN32)
+    const uint64_t size = aSection.mNumValues * sizeof( double );
+    if( mFD == -1 || aSection.mCompression != NONE || aSection.mNumValues == 0 ||
+        aSection.mStoredSize != size || !isValidRange( aSection.mOffset, size ) ||
+        aSection.mOffset % sysconf( _SC_PAGESIZE ) != 0 )
+    {
+        return 0;
+    }
+    void* data = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, mFD, aSection.mOffset );
+    if( data == MAP_FAILED ) {
+        return 0;
+    }
+    if( hashBytes( data, size ) != aSection.mChecksum ) {
+        munmap( data, size );
+        return 0;
+    }
+    return static_cast<double*>( data );
+#else
+    return 0;
+#endif
+}
+
+/*!
+ * \brief Write the data for a period into a restart file keeping the data for
+ *        all other periods which are already in the file.
+ * \details Any existing section for the same period and kind is replaced.  A
+ *          STATE_KEYS section is only written if the file does not already hold
+ *          one for aSchemaHash and it is dropped once no period has STATE_VALUES
+ *          with its hash.  To avoid rewriting the data of every other period each
+ *          time a period is written the new sections are appended to the file
+ *          followed by a new section table and finally the older header copy is
+ *          updated to point to it, thus a reader will either see the old or new
+ *          table.  The space of replaced
+ *          sections is only reclaimed once it would make up more than half of the
+ *          file, at which point the whole file is written to a temporary file
+ *          which is then renamed over aFileName.  The same is done if the existing
+ *          file is not a valid restart file.
+ * \param aFileName The restart file to write.
+ * \param aPeriod The model period of the data.
+ * \param aSchemaHash A hash of the structure of the model the data was collected from.
+ * \param aSections The data to write for each kind of section.
+ * \param aCompress Whether to store STATE_VALUES sections with XOR_DELTA compression.
+ * \return True if the file was successfully written.
+ */
+bool RestartFile::writeSections( const string& aFileName, const int aPeriod, const uint64_t aSchemaHash,
+                                 const vector<SectionData>& aSections, const bool aCompress )
+{
+    RestartFile existingFile( aFileName );
+    
+    // prepare the new sections, the state keys only depend on the structure of
+    // the model so they are not written again if the file already has them
+    vector<pair<Section, const char*> > newSections;
+    vector<vector<char> > encoded( aSections.size() );
+    for( size_t i = 0; i < aSections.size(); ++i ) {
+        const Section* keySection = existingFile.findSchemaSection( aSchemaHash, STATE_KEYS );
+        if( aSections[ i ].mKind == STATE_KEYS && keySection && keySection->mNumValues == aSections[ i ].mNumValues &&
+            existingFile.isValidRange( keySection->mOffset, keySection->mStoredSize ) )
+        {
+            continue;
+        }
+        Section section;
+        memset( &section, 0, sizeof( Section ) );
+        section.mPeriod = aPeriod;
+        section.mKind = aSections[ i ].mKind;
+        section.mSchemaHash = aSchemaHash;
+        section.mNumValues = aSections[ i ].mNumValues;
+        section.mCompression = NONE;
+        section.mStoredSize = aSections[ i ].mNumValues * sizeof( uint64_t );
+        const char* data = static_cast<const char*>( aSections[ i ].mData );
+        // only keep the compressed data if it is actually smaller
+        if( aCompress && aSections[ i ].mKind == STATE_VALUES ) {
+            encode( static_cast<const double*>( aSections[ i ].mData ), aSections[ i ].mNumValues, encoded[ i ] );
+            if( encoded[ i ].size() < section.mStoredSize ) {
+                data = encoded[ i ].data();
+                section.mCompression = XOR_DELTA;
+                section.mStoredSize = encoded[ i ].size();
+            }
+        }
+        section.mChecksum = hashBytes( data, section.mStoredSize );
+        newSections.push_back( make_pair( section, data ) );
+    }
+    
+    // keep all of the other sections which are already in the file
+    vector<pair<Section, const char*> > sections;
+    for( const auto& section : existingFile.mSections ) {
+        bool isReplaced = false;
+        for( const auto& newSection : newSections ) {
+            isReplaced |= section.mKind == newSection.first.mKind &&
+                ( section.mKind == STATE_KEYS ? section.mSchemaHash == aSchemaHash : section.mPeriod == aPeriod );
+        }
+        if( !isReplaced && existingFile.isValidRange( section.mOffset, section.mStoredSize ) ) {
+            sections.push_back( make_pair( section, existingFile.mData + section.mOffset ) );
+        }
+    }
+    
+    // drop the state keys of any structure which no period has state values for
+    auto hasValues = [aSchemaHash, &sections]( const uint64_t aHash ) {
+        return aHash == aSchemaHash ||
+            any_of( sections.begin(), sections.end(), [aHash]( const pair<Section, const char*>& aSection ) {
+                return aSection.first.mKind == STATE_VALUES && aSection.first.mSchemaHash == aHash;
+            } );
+    };
+    sections.erase( remove_if( sections.begin(), sections.end(), [&hasValues]( const pair<Section, const char*>& aSection ) {
+        return aSection.first.mKind == STATE_KEYS && !hasValues( aSection.first.mSchemaHash );
+    } ), sections.end() );
+    const bool isReplacing = sections.size() < existingFile.mSections.size();
+    
+    uint64_t liveSize = 0;
+    for( const auto& section : sections ) {
+        liveSize += section.first.mStoredSize;
+    }
+    for( const auto& newSection : newSections ) {
+        liveSize += newSection.first.mStoredSize;
+    }
+    
+    if( existingFile.isValid() && !( isReplacing && existingFile.mSize > 2 * liveSize ) ) {
+        const uint64_t existingSize = existingFile.mSize;
+        const uint64_t existingSequence = existingFile.mHeader.mSequence;
+        existingFile.close();
+        return appendSections( aFileName, existingSize, existingSequence, sections, newSections );
+    }
+    
+    sections.insert( sections.end(), newSections.begin(), newSections.end() );
+    sort( sections.begin(), sections.end(), []( const pair<Section, const char*>& aLHS, const pair<Section, const char*>& aRHS ) {
+        return aLHS.first.mPeriod != aRHS.first.mPeriod ? aLHS.first.mPeriod < aRHS.first.mPeriod : aLHS.first.mKind < aRHS.first.mKind;
+    } );
+    const string tempFileName = aFileName + ".tmp";
+    const bool success = writeFile( tempFileName, sections );
+    existingFile.close();
+    if( !success ) {
+        remove( tempFileName.c_str() );
+        return false;
+    }
+#if defined(_WIN32)
+    // rename will not replace an existing file on Windows
+    remove( aFileName.c_str() );
+#endif
+    return rename( tempFileName.c_str(), aFileName.c_str() ) == 0;
+}
+
+/*!
+ * \brief Write a complete restart file.
+ * \param aFileName The file to write.
+ * \param aSections The sections to write along with their data, the offsets
+ *                  will be set as they are laid out.
+ * \return True if the file was successfully written.
+ */
+bool RestartFile::writeFile( const string& aFileName, vector<pair<Section, const char*> >& aSections ) {
+    // lay out the file: headers, section table, then each section's data aligned
+    // so that it could be mapped
+    const uint64_t tableOffset = NUM_HEADERS * sizeof( Header );
+    uint64_t offset = tableOffset + aSections.size() * sizeof( Section );
+    vector<Section> table;
+    for( auto& section : aSections ) {
+        offset = alignSectionOffset( offset );
+        section.first.mOffset = offset;
+        offset += section.first.mStoredSize;
+        table.push_back( section.first );
+    }
+    
+    ofstream file( aFileName.c_str(), ios_base::out | ios_base::trunc | ios_base::binary );
+    if( !file.is_open() ) {
+        return false;
+    }
+    // only the first header copy is in use, the second is left zero
+    const Header header = createHeader( table, tableOffset, 0 );
+    const vector<char> padding( SECTION_ALIGNMENT, 0 );
+    file.write( reinterpret_cast<const char*>( &header ), sizeof( Header ) );
+    file.write( padding.data(), tableOffset - sizeof( Header ) );
+    file.write( reinterpret_cast<const char*>( table.data() ), table.size() * sizeof( Section ) );
+    uint64_t written = tableOffset + table.size() * sizeof( Section );
+    for( const auto& section : aSections ) {
+        file.write( padding.data(), section.first.mOffset - written );
+        file.write( section.second, section.first.mStoredSize );
+        written = section.first.mOffset + section.first.mStoredSize;
+    }
+    file.close();
+    // make sure the data is on disk before the file may be renamed over the
+    // existing restart file
+    return !file.fail() && syncFile( aFileName );
+}
+
+/*!
+ * \brief Append sections to an existing restart file.
+ * \details The data of the new sections is written after the end of the file
+ *          followed by a section table which includes them.  Only once that is
+ *          synced to disk is the older of the two header copies overwritten to
+ *          refer to the new table.  The current header is left untouched so should that
+ *          write not complete the checksum of the new header will not match and
+ *          readers keep using the current one.
+ * \param aFileName The file to append to.
+ * \param aFileSize The current size of the file.
+ * \param aPrevSequence The sequence number of the current header.
+ * \param aSections The existing sections to keep which are already in the file.
+ * \param aNewSections The sections to append along with their data, the offsets
+ *                     will be set as they are laid out.
+ * \return True if the file was successfully written.
+ */
+bool RestartFile::appendSections( const string& aFileName, const uint64_t aFileSize,
+                                  const uint64_t aPrevSequence,
+                                  const vector<pair<Section, const char*> >& aSections,
+                                  vector<pair<Section, const char*> >& aNewSections )
+{
+    fstream file( aFileName.c_str(), ios_base::in | ios_base::out | ios_base::binary );
+    if( !file.is_open() ) {
+        return false;
+    }
+    file.seekp( aFileSize );
+    uint64_t written = aFileSize;
+    const vector<char> padding( SECTION_ALIGNMENT, 0 );
+    vector<Section> table;
+    for( const auto& section : aSections ) {
+        table.push_back( section.first );
+    }
+    for( auto& section : aNewSections ) {
+        section.first.mOffset = alignSectionOffset( written );
+        file.write( padding.data(), section.first.mOffset - written );
+        file.write( section.second, section.first.mStoredSize );
+        written = section.first.mOffset + section.first.mStoredSize;
+        table.push_back( section.first );
+    }
+    file.write( reinterpret_cast<const char*>( table.data() ), table.size() * sizeof( Section ) );
+    file.flush();
+    // the new data and table must be on disk before the header which refers to
+    // them otherwise a crash could leave a valid header pointing at garbage
+    if( file.fail() || !syncFile( aFileName ) ) {
+        return false;
+    }
+    
+    const Header header = createHeader( table, written, aPrevSequence + 1 );
+    file.seekp( ( header.mSequence % NUM_HEADERS ) * sizeof( Header ) );
+    file.write( reinterpret_cast<const char*>( &header ), sizeof( Header ) );
+    file.close();
+    return !file.fail() && syncFile( aFileName );
+}
+
+/*!
+ * rief Force the written data of a file out to disk.
+ * \details The file streams only flush to the OS so the file is opened again
+ *          to sync it.  Any descriptor for the file syncs all of its data.
+ * \param aFileName The file to sync.
+ * 
+eturn True if the file was successfully synced.
+ */
+bool RestartFile::syncFile( const string& aFileName ) {
+#if !defined(_WIN32)
+    const int fd = ::open( aFileName.c_str(), O_RDONLY );
+    if( fd == -1 ) {
+        return false;
+    }
+    const bool success = fsync( fd ) == 0;
+    ::close( fd );
+    return success;
+#else
+    // _commit requires a descriptor opened for writing
+    const int fd = _open( aFileName.c_str(), _O_RDWR | _O_BINARY );
+    if( fd == -1 ) {
+        return false;
+    }
+    const bool success = _commit( fd ) == 0;
+    _close( fd );
+    return success;
+#endif
+}
+
+/*!
+ * \brief Create the header for a restart file written by this model.
+ * \param aTable The section table.
+ * \param aTableOffset The offset of the section table in the file.
+ * \param aSequence The sequence number of the header.
+ * \return The header.
+ */
+RestartFile::Header RestartFile::createHeader( const vector<Section>& aTable, const uint64_t aTableOffset,
+                                               const uint64_t aSequence )
+{
+    Header header;
+    memset( &header, 0, sizeof( Header ) );
+    memcpy( header.mMagic, RESTART_MAGIC, sizeof( RESTART_MAGIC ) );
+    header.mVersion = RESTART_FORMAT_VERSION;
+    header.mNumSections = static_cast<uint32_t>( aTable.size() );
+    header.mModelHash = getCurrentModelHash();
+    header.mTableOffset = aTableOffset;
+    header.mTableChecksum = hashBytes( aTable.data(), aTable.size() * sizeof( Section ) );
+    header.mSequence = aSequence;
+    header.mHeaderChecksum = hashHeader( header );
+    return header;
+}
+
+/*!
+ * \brief Checksum the fields of a header which precede its checksum.
+ * \param aHeader The header.
+ * \return The checksum of aHeader.
+ */
+uint64_t RestartFile::hashHeader( const Header& aHeader ) {
+    return hashBytes( &aHeader, offsetof( Header, mHeaderChecksum ) );
+}
+
+/*!
+ * \brief Get the hash of the revision of the currently running model.
+ * \details This is stored in each restart file so that we can warn when state
+ *          is loaded from a different revision of the model.
+ * \return The model hash.
+ */
+uint64_t RestartFile::getCurrentModelHash() {
+    const string revision( __REVISION_NUMBER__ );
+    return hashBytes( revision.data(), revision.size() );
+}
+
+/*!
+ * \brief Hash or checksum a block of data.
+ * \details This is FNV-1a taken 64 bits at a time rather than byte by byte so
+ *          that checksumming large sections of state stays fast.
+ * \param aData The data to hash.
+ * \param aSize The number of bytes in aData.
+ * \param aHash The hash to continue from.
+ * \return The hash of aData.
+ */
+uint64_t RestartFile::hashBytes( const void* aData, const size_t aSize, const uint64_t aHash ) {
+    const char* data = static_cast<const char*>( aData );
+    uint64_t hash = aHash;
+    size_t pos = 0;
+    for( ; pos + sizeof( uint64_t ) <= aSize; pos += sizeof( uint64_t ) ) {
+        uint64_t word;
+        memcpy( &word, data + pos, sizeof( uint64_t ) );
+        hash = combineHash( hash, word );
+    }
+    for( ; pos < aSize; ++pos ) {
+        hash = combineHash( hash, static_cast<unsigned char>( data[ pos ] ) );
+    }
+    return hash;
+}
+
+/*!
+ * \brief Combine a value into a hash.
+ * \param aHash The hash to continue from.
+ * \param aValue The value to add to the hash.
+ * \return The combined hash.
+ */
+uint64_t RestartFile::combineHash( const uint64_t aHash, const uint64_t aValue ) {
+    return ( aHash ^ aValue ) * HASH_PRIME;
+}
+
+/*!
+ * \brief Compress values with the XOR_DELTA encoding.
+ * \details Each value is XORed with the previous value and only the bytes
+ *          between the leading and trailing zero bytes of the result are kept.
+ *          A control byte holding the number of leading zero bytes in the high
+ *          nibble and trailing zero bytes in the low nibble precedes them.  A
+ *          result of zero, which is common, is stored as the single control
+ *          byte REPEAT_VALUE.
+ * \param aValues The values to encode.
+ * \param aNumValues The number of values.
+ * \param aOutput The encoded bytes will be appended to this vector.
+ */
+void RestartFile::encode( const double* aValues, const uint64_t aNumValues, vector<char>& aOutput ) {
+    aOutput.reserve( aOutput.size() + aNumValues * sizeof( double ) / 2 );
+    uint64_t prev = 0;
+    for( uint64_t i = 0; i < aNumValues; ++i ) {
+        uint64_t curr;
+        memcpy( &curr, &aValues[ i ], sizeof( uint64_t ) );
+        const uint64_t delta = curr ^ prev;
+        prev = curr;
+        if( delta == 0 ) {
+            aOutput.push_back( static_cast<char>( REPEAT_VALUE ) );
+            continue;
+        }
+        int leading = 0;
+        while( ( delta >> ( 8 * ( 7 - leading ) ) & 0xFF ) == 0 ) {
+            ++leading;
+        }
+        int trailing = 0;
+        while( ( delta >> ( 8 * trailing ) & 0xFF ) == 0 ) {
+            ++trailing;
+        }
+        aOutput.push_back( static_cast<char>( leading << 4 | trailing ) );
+        for( int byte = trailing; byte < 8 - leading; ++byte ) {
+            aOutput.push_back( static_cast<char>( delta >> ( 8 * byte ) & 0xFF ) );
+        }
+    }
+}
+
+/*!
+ * \brief Decompress values stored with the XOR_DELTA encoding.
+ * \param aData The encoded bytes.
+ * \param aSize The number of encoded bytes.
+ * \param aValues The array to decode into.
+ * \param aNumValues The number of values expected.
+ * \return True if exactly aNumValues were decoded from aSize bytes.
+ * \sa encode
+ */
+bool RestartFile::decode( const char* aData, const uint64_t aSize, double* aValues, const uint64_t aNumValues ) {
+    uint64_t pos = 0;
+    uint64_t prev = 0;
+    for( uint64_t i = 0; i < aNumValues; ++i ) {
+        if( pos >= aSize ) {
+            return false;
+        }
+        const unsigned char control = static_cast<unsigned char>( aData[ pos++ ] );
+        uint64_t delta = 0;
+        if( control != REPEAT_VALUE ) {
+            const int leading = control >> 4;
+            const int trailing = control & 0x0F;
+            if( leading + trailing >= 8 || pos + ( 8 - leading - trailing ) > aSize ) {
+                return false;
+            }
+            for( int byte = trailing; byte < 8 - leading; ++byte ) {
+                delta |= uint64_t( static_cast<unsigned char>( aData[ pos++ ] ) ) << ( 8 * byte );
+            }
+        }
+        prev ^= delta;
+        memcpy( &aValues[ i ], &prev, sizeof( uint64_t ) );
+    }
+    return pos == aSize;
+}
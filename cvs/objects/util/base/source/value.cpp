@@ -0,0 +1,85 @@
+/*
+ * LEGAL NOTICE
+ * This computer software was prepared by Battelle Memorial Institute,
+ * hereinafter the Contractor, under Contract No. DE-AC05-76RL0 1830
+ * with the Department of Energy (DOE). NEITHER THE GOVERNMENT NOR THE
+ * CONTRACTOR MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY
+ * LIABILITY FOR THE USE OF THIS SOFTWARE. This notice including this
+ * sentence must appear on any copies of this computer software.
+ *
+ * EXPORT CONTROL
+ * User agrees that the Software will not be shipped, transferred or
+ * exported into any country or used in any manner prohibited by the
+ * United States Export Administration Act or any other applicable
+ * export laws, restrictions or regulations (collectively the "Export Laws").
+ * Export of the Software may require some form of license or other
+ * authority from the U.S. Government, and failure to obtain such
+ * export control license may result in criminal liability under
+ * U.S. laws. In addition, if the Software is identified as export controlled
+ * items under the Export Laws, User represents and warrants that User
+ * is not a citizen, or otherwise located within, an embargoed nation
+ * (including without limitation Iran, Syria, Sudan, Cuba, and North Korea)
+ *     and that User is not otherwise prohibited
+ * under the Export Laws from receiving the Software.
+ *
+ * Copyright 2011 Battelle Memorial Institute.  All Rights Reserved.
+ * Distributed as open-source under the terms of the Educational Community
+ * License version 2.0 (ECL 2.0). http://www.opensource.org/licenses/ecl2.php
+ *
+ * For further details, see: http://www.globalchange.umd.edu/models/gcam/
+ *
+ */
+
+
+/*!
+ * \file value.cpp
+ * \ingroup util
+ * \brief The out of line parts of the Value class which are kept separate
+ *        from ManageStateVariables so that the Value benchmark can share them.
+ */
+
+#include "util/base/include/value.h"
+
+using namespace std;
+
+// Note we must static initialize static class member variables in a cpp file.
+Value::CentralValueType Value::sCentralValue( (double*)0 );
+double* Value::sBaseCentralValue( 0 );
+#if GCAM_PARALLEL_ENABLED
+vector<uint32_t>* Value::sStateWriteLog( 0 );
+#endif
+
+#if GCAM_PARALLEL_ENABLED
+/*!
+ * \brief Bind the calling thread's cached state slot to its current slot in
+ *        sCentralValue.
+ * \details This is called the first time a thread accesses state after
+ *          sCentralValue has been reassigned.  While state writes are being
+ *          recorded the slot is left unbound so that every write continues to
+ *          go through bindThreadCentralValueForWrite.
+ * \return The state slot for the calling thread.
+ */
+double* Value::bindThreadCentralValue() {
+    if( sStateWriteLog ) {
+        return sCentralValue.local();
+    }
+    sThreadCentralValue = sCentralValue.local();
+    sThreadCentralValueEpoch = sCentralValueEpoch;
+    return sThreadCentralValue;
+}
+
+/*!
+ * \brief Bind the calling thread's cached state slot as bindThreadCentralValue
+ *        when about to set the given state.
+ * \details When state writes are being recorded the state ID is logged in
+ *          sStateWriteLog.
+ * \param aStateID The ID of the state about to be set.
+ * \return The state slot for the calling thread.
+ */
+double* Value::bindThreadCentralValueForWrite( const uint32_t aStateID ) {
+    if( sStateWriteLog ) {
+        sStateWriteLog->push_back( aStateID );
+    }
+    return bindThreadCentralValue();
+}
+#endif
@@ -168,6 +168,7 @@ void XMLParseHelper::cleanupParser() {
     // should free the memory, which can be significant, to make room during
     // the model run.
     getStoreXMLMemoryPool().clear();
+    getStoreXMLSizeRef() = 0;
     
     // Clear out all temporary storage arrays for TechVintageVector.
     boost::fusion::for_each(sTechVectorParseHelperMap, [] (auto& aPair) {